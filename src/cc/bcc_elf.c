@@ -14,30 +14,77 @@
  * limitations under the License.
  */
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <gelf.h>
 #include "bcc_elf.h"
 #define NT_STAPSDT 3
 
-static int openelf(const char *path, Elf **elf_out, int *fd_out) {
+struct bcc_elf_file {
+  char *path;
+  void *map;
+  size_t size;
+  Elf *e;
+  GElf_Ehdr ehdr;
+};
+
+struct bcc_elf_file *bcc_elf_open(const char *path) {
+  struct bcc_elf_file *elf;
+  struct stat st;
+  int fd;
+
   if (elf_version(EV_CURRENT) == EV_NONE)
-    return -1;
+    return NULL;
 
-  *fd_out = open(path, O_RDONLY);
-  if (*fd_out < 0)
-    return -1;
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
 
-  *elf_out = elf_begin(*fd_out, ELF_C_READ, 0);
-  if (*elf_out == 0) {
-    close(*fd_out);
-    return -1;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
   }
 
-  return 0;
+  elf = calloc(1, sizeof(*elf));
+  if (!elf) {
+    close(fd);
+    return NULL;
+  }
+
+  // private and writable, libelf may convert the headers in place
+  elf->size = st.st_size;
+  elf->map = mmap(NULL, elf->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (elf->map == MAP_FAILED) {
+    free(elf);
+    return NULL;
+  }
+
+  elf->e = elf_memory(elf->map, elf->size);
+  elf->path = strdup(path);
+  if (!elf->e || !elf->path || !gelf_getehdr(elf->e, &elf->ehdr)) {
+    bcc_elf_close(elf);
+    return NULL;
+  }
+
+  return elf;
+}
+
+void bcc_elf_close(struct bcc_elf_file *elf) {
+  if (!elf)
+    return;
+  if (elf->e)
+    elf_end(elf->e);
+  munmap(elf->map, elf->size);
+  free(elf->path);
+  free(elf);
 }
 
 static const char *parse_stapsdt_note(struct bcc_elf_usdt *probe,
@@ -129,17 +176,21 @@ static int listprobes(Elf *e, bcc_elf_probecb callback, const char *binpath,
   return 0;
 }
 
+int bcc_elf_file_foreach_usdt(struct bcc_elf_file *elf,
+                              bcc_elf_probecb callback, void *payload) {
+  return listprobes(elf->e, callback, elf->path, payload);
+}
+
 int bcc_elf_foreach_usdt(const char *path, bcc_elf_probecb callback,
                          void *payload) {
-  Elf *e;
-  int fd, res;
+  struct bcc_elf_file *elf = bcc_elf_open(path);
+  int res;
 
-  if (openelf(path, &e, &fd) < 0)
+  if (!elf)
     return -1;
 
-  res = listprobes(e, callback, path, payload);
-  elf_end(e);
-  close(fd);
+  res = bcc_elf_file_foreach_usdt(elf, callback, payload);
+  bcc_elf_close(elf);
 
   return res;
 }
@@ -196,17 +247,21 @@ static int listsymbols(Elf *e, bcc_elf_symcb callback, void *payload) {
   return 0;
 }
 
+int bcc_elf_file_foreach_sym(struct bcc_elf_file *elf, bcc_elf_symcb callback,
+                             void *payload) {
+  return listsymbols(elf->e, callback, payload);
+}
+
 int bcc_elf_foreach_sym(const char *path, bcc_elf_symcb callback,
                         void *payload) {
-  Elf *e;
-  int fd, res;
+  struct bcc_elf_file *elf = bcc_elf_open(path);
+  int res;
 
-  if (openelf(path, &e, &fd) < 0)
+  if (!elf)
     return -1;
 
-  res = listsymbols(e, callback, payload);
-  elf_end(e);
-  close(fd);
+  res = bcc_elf_file_foreach_sym(elf, callback, payload);
+  bcc_elf_close(elf);
   return res;
 }
 
@@ -232,33 +287,239 @@ static int loadaddr(Elf *e, uint64_t *addr) {
   return -1;
 }
 
+int bcc_elf_file_foreach_load_segment(struct bcc_elf_file *elf,
+                                      bcc_elf_segcb callback, void *payload) {
+  size_t phnum, i;
+
+  if (elf_getphdrnum(elf->e, &phnum) != 0)
+    return -1;
+
+  for (i = 0; i < phnum; ++i) {
+    GElf_Phdr header;
+
+    if (!gelf_getphdr(elf->e, (int)i, &header) || header.p_type != PT_LOAD)
+      continue;
+
+    if (callback(header.p_offset, header.p_vaddr, header.p_filesz,
+                 payload) < 0)
+      break;
+  }
+
+  return 0;
+}
+
+int bcc_elf_file_loadaddr(struct bcc_elf_file *elf, uint64_t *address) {
+  return loadaddr(elf->e, address);
+}
+
 int bcc_elf_loadaddr(const char *path, uint64_t *address) {
-  Elf *e;
-  int fd, res;
+  struct bcc_elf_file *elf = bcc_elf_open(path);
+  int res;
 
-  if (openelf(path, &e, &fd) < 0)
+  if (!elf)
     return -1;
 
-  res = loadaddr(e, address);
-  elf_end(e);
-  close(fd);
+  res = bcc_elf_file_loadaddr(elf, address);
+  bcc_elf_close(elf);
 
   return res;
 }
 
-int bcc_elf_is_shared_obj(const char *path) {
-  Elf *e;
-  GElf_Ehdr hdr;
-  int fd, res = -1;
+static int find_buildid(Elf *e, char *buildid, size_t size) {
+  Elf_Scn *section = NULL;
+
+  while ((section = elf_nextscn(e, section)) != 0) {
+    GElf_Shdr header;
+    Elf_Data *data = NULL;
+
+    if (!gelf_getshdr(section, &header) || header.sh_type != SHT_NOTE)
+      continue;
+
+    while ((data = elf_getdata(section, data)) != 0) {
+      size_t offset = 0, name_off, desc_off, i;
+      GElf_Nhdr hdr;
+
+      while ((offset = gelf_getnote(data, offset, &hdr, &name_off,
+                                    &desc_off)) != 0) {
+        const unsigned char *desc;
 
-  if (openelf(path, &e, &fd) < 0)
+        if (hdr.n_type != NT_GNU_BUILD_ID || hdr.n_namesz != 4 ||
+            memcmp((const char *)data->d_buf + name_off, "GNU", 4) != 0)
+          continue;
+
+        if (hdr.n_descsz * 2 + 1 > size)
+          return -1;
+
+        desc = (const unsigned char *)data->d_buf + desc_off;
+        for (i = 0; i < hdr.n_descsz; ++i)
+          sprintf(buildid + i * 2, "%02x", desc[i]);
+        buildid[i * 2] = 0;
+        return 0;
+      }
+    }
+  }
+
+  return -1;
+}
+
+int bcc_elf_file_get_buildid(struct bcc_elf_file *elf, char *buildid,
+                             size_t size) {
+  return find_buildid(elf->e, buildid, size);
+}
+
+int bcc_elf_get_buildid(const char *path, char *buildid, size_t size) {
+  struct bcc_elf_file *elf = bcc_elf_open(path);
+  int res;
+
+  if (!elf)
     return -1;
 
-  if (gelf_getehdr(e, &hdr))
-    res = (hdr.e_type == ET_DYN);
+  res = bcc_elf_file_get_buildid(elf, buildid, size);
+  bcc_elf_close(elf);
 
-  elf_end(e);
-  close(fd);
+  return res;
+}
+
+static Elf_Scn *find_section(struct bcc_elf_file *elf, const char *name,
+                             GElf_Shdr *header) {
+  Elf_Scn *section = NULL;
+  size_t stridx;
+
+  if (elf_getshdrstrndx(elf->e, &stridx) != 0)
+    return NULL;
+
+  while ((section = elf_nextscn(elf->e, section)) != 0) {
+    const char *scn_name;
+
+    if (!gelf_getshdr(section, header) || header->sh_type == SHT_NOBITS)
+      continue;
+
+    scn_name = elf_strptr(elf->e, stridx, header->sh_name);
+    if (scn_name && !strcmp(scn_name, name))
+      return section;
+  }
+
+  return NULL;
+}
+
+const void *bcc_elf_file_section(struct bcc_elf_file *elf, const char *name,
+                                 size_t *size) {
+  GElf_Shdr header;
+  Elf_Scn *section = find_section(elf, name, &header);
+  Elf_Data *data;
+
+  if (!section)
+    return NULL;
+
+  // debug sections are often compressed, inflate them in place
+  if ((header.sh_flags & SHF_COMPRESSED) && elf_compress(section, 0, 0) < 0)
+    return NULL;
+
+  data = elf_getdata(section, NULL);
+  if (!data || !data->d_buf)
+    return NULL;
+  *size = data->d_size;
+  return data->d_buf;
+}
+
+int bcc_elf_file_section_addr(struct bcc_elf_file *elf, const char *name,
+                              uint64_t *addr) {
+  GElf_Shdr header;
+
+  if (!find_section(elf, name, &header))
+    return -1;
+  *addr = header.sh_addr;
+  return 0;
+}
+
+static int get_debuglink(struct bcc_elf_file *elf, char *name, size_t size) {
+  size_t len;
+  const char *link = bcc_elf_file_section(elf, ".gnu_debuglink", &len);
+
+  // the name is followed by padding and a crc32 of the debug file
+  if (!link || !memchr(link, '\0', len) || strlen(link) + 1 > size)
+    return -1;
+  strcpy(name, link);
+  return 0;
+}
+
+static bool has_debug_info(struct bcc_elf_file *elf) {
+  size_t size;
+  return bcc_elf_file_section(elf, ".debug_line", &size) != NULL;
+}
+
+// a debug file must come from the same build when both have a build-id
+static bool debug_file_matches(const char *path, const char *buildid) {
+  struct bcc_elf_file *debug = bcc_elf_open(path);
+  char debug_buildid[128];
+  bool res;
+
+  if (!debug)
+    return false;
+  res = has_debug_info(debug) &&
+        (!buildid[0] ||
+         bcc_elf_file_get_buildid(debug, debug_buildid,
+                                  sizeof(debug_buildid)) < 0 ||
+         !strcmp(buildid, debug_buildid));
+  bcc_elf_close(debug);
+  return res;
+}
+
+int bcc_elf_file_find_debug_file(struct bcc_elf_file *elf, char *path,
+                                 size_t size) {
+  char buildid[128] = "", link[256], dir[4096];
+  char *slash;
+  int n;
+
+  if (has_debug_info(elf)) {
+    n = snprintf(path, size, "%s", elf->path);
+    return n < (int)size ? 0 : -1;
+  }
+
+  if (bcc_elf_file_get_buildid(elf, buildid, sizeof(buildid)) == 0 &&
+      strlen(buildid) > 2) {
+    n = snprintf(path, size, "/usr/lib/debug/.build-id/%.2s/%s.debug",
+                 buildid, buildid + 2);
+    if (n < (int)size && debug_file_matches(path, buildid))
+      return 0;
+  }
+
+  if (get_debuglink(elf, link, sizeof(link)) < 0)
+    return -1;
+
+  snprintf(dir, sizeof(dir), "%s", elf->path);
+  slash = strrchr(dir, '/');
+  if (slash)
+    *slash = '\0';
+  else
+    strcpy(dir, ".");
+
+  n = snprintf(path, size, "%s/%s", dir, link);
+  if (n < (int)size && strcmp(path, elf->path) &&
+      debug_file_matches(path, buildid))
+    return 0;
+  n = snprintf(path, size, "%s/.debug/%s", dir, link);
+  if (n < (int)size && debug_file_matches(path, buildid))
+    return 0;
+  n = snprintf(path, size, "/usr/lib/debug%s/%s", dir, link);
+  if (n < (int)size && debug_file_matches(path, buildid))
+    return 0;
+  return -1;
+}
+
+int bcc_elf_file_is_shared_obj(struct bcc_elf_file *elf) {
+  return elf->ehdr.e_type == ET_DYN;
+}
+
+int bcc_elf_is_shared_obj(const char *path) {
+  struct bcc_elf_file *elf = bcc_elf_open(path);
+  int res;
+
+  if (!elf)
+    return -1;
+
+  res = bcc_elf_file_is_shared_obj(elf);
+  bcc_elf_close(elf);
 
   return res;
 }
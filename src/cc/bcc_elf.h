@@ -20,6 +20,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 struct bcc_elf_usdt {
@@ -35,6 +36,40 @@ struct bcc_elf_usdt {
 typedef void (*bcc_elf_probecb)(const char *, const struct bcc_elf_usdt *,
                                 void *);
 typedef int (*bcc_elf_symcb)(const char *, uint64_t, uint64_t, int, void *);
+typedef int (*bcc_elf_segcb)(uint64_t offset, uint64_t vaddr, uint64_t size,
+                             void *payload);
+
+// An ELF file opened and mapped once, for callers that need several of the
+// answers below about the same file. The bcc_elf_file_* functions behave
+// like the path based ones; bcc_elf_file_foreach_usdt passes the path given
+// to bcc_elf_open to the callback.
+struct bcc_elf_file;
+
+struct bcc_elf_file *bcc_elf_open(const char *path);
+void bcc_elf_close(struct bcc_elf_file *elf);
+int bcc_elf_file_foreach_usdt(struct bcc_elf_file *elf,
+                              bcc_elf_probecb callback, void *payload);
+int bcc_elf_file_loadaddr(struct bcc_elf_file *elf, uint64_t *address);
+// PT_LOAD segments in program header order, until callback returns < 0
+int bcc_elf_file_foreach_load_segment(struct bcc_elf_file *elf,
+                                      bcc_elf_segcb callback, void *payload);
+int bcc_elf_file_foreach_sym(struct bcc_elf_file *elf, bcc_elf_symcb callback,
+                             void *payload);
+int bcc_elf_file_is_shared_obj(struct bcc_elf_file *elf);
+int bcc_elf_file_get_buildid(struct bcc_elf_file *elf, char *buildid,
+                             size_t size);
+// contents of the section called name, uncompressed, valid until the file is
+// closed; NULL if there is no such section
+const void *bcc_elf_file_section(struct bcc_elf_file *elf, const char *name,
+                                 size_t *size);
+// link time address of the section called name, 0 for sections that are not
+// loaded
+int bcc_elf_file_section_addr(struct bcc_elf_file *elf, const char *name,
+                              uint64_t *addr);
+// path of the file with the DWARF line info of elf: elf itself, or a separate
+// debug file found by build-id or .gnu_debuglink
+int bcc_elf_file_find_debug_file(struct bcc_elf_file *elf, char *path,
+                                 size_t size);
 
 int bcc_elf_foreach_usdt(const char *path, bcc_elf_probecb callback,
                          void *payload);
@@ -42,6 +77,8 @@ int bcc_elf_loadaddr(const char *path, uint64_t *address);
 int bcc_elf_foreach_sym(const char *path, bcc_elf_symcb callback,
                         void *payload);
 int bcc_elf_is_shared_obj(const char *path);
+// hex encoded GNU build-id of path, -1 if it has none or size is too small
+int bcc_elf_get_buildid(const char *path, char *buildid, size_t size);
 
 #ifdef __cplusplus
 }
@@ -19,6 +19,7 @@
 #include <string.h>
 
 #include "bcc_perf_map.h"
+#include "bcc_proc.h"
 
 int bcc_perf_map_nstgid(int pid) {
   char status_path[64];
@@ -61,12 +62,44 @@ bool bcc_perf_map_path(char *map_path, size_t map_len, int pid) {
   if (strcmp(target, "/") == 0)
     target[0] = '\0';
 
+  // the root of a container is not a path we can see, go through the link
+  char mount_root[64];
+  if (bcc_procutils_mount_root(pid, mount_root, sizeof(mount_root)) == 0 &&
+      mount_root[0])
+    strcpy(target, mount_root);
+
   int nstgid = bcc_perf_map_nstgid(pid);
 
   snprintf(map_path, map_len, "%s/tmp/perf-%d.map", target, nstgid);
   return true;
 }
 
+// "<start> <size> <name>", start and size in hex
+static void parse_perf_map_line(char *line, bcc_perf_map_symcb callback,
+                                void *payload) {
+  char *cursor = line;
+  char *newline, *sep;
+  long long begin, len;
+
+  begin = strtoull(cursor, &sep, 16);
+  if (*sep != ' ' || (sep == cursor && begin == 0))
+    return;
+  cursor = sep;
+  while (*cursor && isspace(*cursor)) cursor++;
+
+  len = strtoull(cursor, &sep, 16);
+  if (*sep != ' ' || (sep == cursor && begin == 0))
+    return;
+  cursor = sep;
+  while (*cursor && isspace(*cursor)) cursor++;
+
+  newline = strchr(cursor, '\n');
+  if (newline)
+      newline[0] = '\0';
+
+  callback(cursor, begin, len, 0, payload);
+}
+
 int bcc_perf_map_foreach_sym(const char *path, bcc_perf_map_symcb callback,
                              void* payload) {
   FILE* file = fopen(path, "r");
@@ -75,28 +108,32 @@ int bcc_perf_map_foreach_sym(const char *path, bcc_perf_map_symcb callback,
 
   char *line = NULL;
   size_t size = 0;
-  long long begin, len;
-  while (getline(&line, &size, file) != -1) {
-    char *cursor = line;
-    char *newline, *sep;
-
-    begin = strtoull(cursor, &sep, 16);
-    if (*sep != ' ' || (sep == cursor && begin == 0))
-      continue;
-    cursor = sep;
-    while (*cursor && isspace(*cursor)) cursor++;
-
-    len = strtoull(cursor, &sep, 16);
-    if (*sep != ' ' || (sep == cursor && begin == 0))
-      continue;
-    cursor = sep;
-    while (*cursor && isspace(*cursor)) cursor++;
-
-    newline = strchr(cursor, '\n');
-    if (newline)
-        newline[0] = '\0';
-
-    callback(cursor, begin, len, 0, payload);
+  while (getline(&line, &size, file) != -1)
+    parse_perf_map_line(line, callback, payload);
+
+  free(line);
+  fclose(file);
+
+  return 0;
+}
+
+int bcc_perf_map_foreach_sym_from(const char *path, uint64_t *offset,
+                                  bcc_perf_map_symcb callback, void *payload) {
+  FILE* file = fopen(path, "r");
+  if (!file)
+    return -1;
+  if (fseeko(file, *offset, SEEK_SET) < 0) {
+    fclose(file);
+    return -1;
+  }
+
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  // a line without its newline is still being written, leave it for later
+  while ((len = getline(&line, &size, file)) > 0 && line[len - 1] == '\n') {
+    parse_perf_map_line(line, callback, payload);
+    *offset += len;
   }
 
   free(line);
@@ -31,6 +31,10 @@ int bcc_perf_map_nstgid(int pid);
 bool bcc_perf_map_path(char *map_path, size_t map_len, int pid);
 int bcc_perf_map_foreach_sym(const char *path, bcc_perf_map_symcb callback,
                              void* payload);
+// like bcc_perf_map_foreach_sym, for the complete lines past *offset, which
+// is moved past the last of them
+int bcc_perf_map_foreach_sym_from(const char *path, uint64_t *offset,
+                                  bcc_perf_map_symcb callback, void *payload);
 
 #ifdef __cplusplus
 }
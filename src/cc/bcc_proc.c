@@ -23,6 +23,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <stdio.h>
 
 #include "bcc_perf_map.h"
@@ -69,46 +70,140 @@ char *bcc_procutils_which(const char *binpath) {
   return 0;
 }
 
-int bcc_procutils_each_module(int pid, bcc_procutils_modulecb callback,
-                              void *payload) {
-  char procmap_filename[128];
-  FILE *procmap;
-  int ret;
+int bcc_procutils_mount_root(int pid, char *root, size_t size) {
+  char ns_path[64];
+  struct stat self_ns, pid_ns;
 
-  sprintf(procmap_filename, "/proc/%ld/maps", (long)pid);
-  procmap = fopen(procmap_filename, "r");
+  snprintf(ns_path, sizeof(ns_path), "/proc/%d/ns/mnt", pid);
+  if (stat("/proc/self/ns/mnt", &self_ns) < 0 || stat(ns_path, &pid_ns) < 0 ||
+      (self_ns.st_dev == pid_ns.st_dev && self_ns.st_ino == pid_ns.st_ino)) {
+    if (size < 1)
+      return -1;
+    root[0] = '\0';
+    return 0;
+  }
 
-  if (!procmap)
+  if (snprintf(root, size, "/proc/%d/root", pid) >= (int)size)
     return -1;
+  return 0;
+}
 
-  do {
-    char endline[4096];
-    char perm[8], dev[8];
-    long long begin, end, size, inode;
+static const char *parse_hex(const char *p, uint64_t *value) {
+  uint64_t v = 0;
+  for (;; ++p) {
+    int digit;
+    if (*p >= '0' && *p <= '9')
+      digit = *p - '0';
+    else if (*p >= 'a' && *p <= 'f')
+      digit = *p - 'a' + 10;
+    else
+      break;
+    v = (v << 4) | digit;
+  }
+  *value = v;
+  return p;
+}
 
-    ret = fscanf(procmap, "%llx-%llx %s %llx %s %lld", &begin, &end, perm,
-                 &size, dev, &inode);
+// "7f1c2a000000-7f1c2a1c0000 r-xp 00028000 fd:01 1316  /usr/lib/libc.so.6"
+static int parse_maps_line(char *line, struct bcc_mapping *map) {
+  static const char DELETED[] = " (deleted)";
+  const size_t deleted_len = sizeof(DELETED) - 1;
+  const char *p = line;
+  uint64_t dev_major, dev_minor;
+  char *path;
+  size_t len;
 
-    if (!fgets(endline, sizeof(endline), procmap))
-      break;
+  p = parse_hex(p, &map->start);
+  if (*p++ != '-')
+    return -1;
+  p = parse_hex(p, &map->end);
+  if (*p++ != ' ' || strlen(p) < 5 || p[4] != ' ')
+    return -1;
+  memcpy(map->perms, p, 4);
+  map->perms[4] = '\0';
+  p = parse_hex(p + 5, &map->offset);
+  if (*p++ != ' ')
+    return -1;
+  p = parse_hex(p, &dev_major);
+  if (*p++ != ':')
+    return -1;
+  p = parse_hex(p, &dev_minor);
+  if (*p++ != ' ')
+    return -1;
+  map->dev_major = dev_major;
+  map->dev_minor = dev_minor;
+  map->inode = strtoull(p, (char **)&p, 10);
+
+  while (*p == ' ' || *p == '\t')
+    ++p;
+  path = (char *)p;
+  len = strlen(path);
+  map->deleted = len > deleted_len &&
+                 !strcmp(path + len - deleted_len, DELETED);
+  if (map->deleted)
+    path[len - deleted_len] = '\0';
+  map->path = path;
+  return 0;
+}
 
-    if (ret == 6) {
-      char *mapname = endline;
-      char *newline = strchr(endline, '\n');
+int bcc_procutils_each_mapping(int pid, bcc_procutils_mappingcb callback,
+                               void *payload) {
+  char buf[8192];
+  char procmap_filename[128];
+  size_t len = 0;
+  ssize_t n;
+  int fd;
 
-      if (newline)
-        newline[0] = '\0';
+  sprintf(procmap_filename, "/proc/%ld/maps", (long)pid);
+  fd = open(procmap_filename, O_RDONLY);
+  if (fd < 0)
+    return -1;
 
-      while (isspace(mapname[0])) mapname++;
+  while ((n = read(fd, buf + len, sizeof(buf) - len - 1)) > 0) {
+    char *line = buf, *end = buf + len + n, *nl;
 
-      if (strchr(perm, 'x') && mapname[0] && mapname[0] != '[') {
-        if (callback(mapname, (uint64_t)begin, (uint64_t)end, payload) < 0)
-          break;
+    while ((nl = memchr(line, '\n', end - line))) {
+      struct bcc_mapping map;
+
+      *nl = '\0';
+      if (parse_maps_line(line, &map) == 0 && callback(&map, payload) < 0) {
+        close(fd);
+        return 0;
       }
+      line = nl + 1;
     }
-  } while (ret && ret != EOF);
 
-  fclose(procmap);
+    // carry the partial last line over to the next read, a line longer than
+    // the buffer cannot be a valid mapping and is dropped
+    len = end - line;
+    if (len == sizeof(buf) - 1)
+      len = 0;
+    memmove(buf, line, len);
+  }
+
+  close(fd);
+  return n < 0 ? -1 : 0;
+}
+
+struct module_cb {
+  bcc_procutils_modulecb callback;
+  void *payload;
+};
+
+static int _each_module(const struct bcc_mapping *map, void *p) {
+  struct module_cb *cb = (struct module_cb *)p;
+
+  if (!strchr(map->perms, 'x') || !map->path[0] || map->path[0] == '[')
+    return 0;
+  return cb->callback(map->path, map->start, map->end, cb->payload);
+}
+
+int bcc_procutils_each_module(int pid, bcc_procutils_modulecb callback,
+                              void *payload) {
+  struct module_cb cb = {callback, payload};
+
+  if (bcc_procutils_each_mapping(pid, _each_module, &cb) < 0)
+    return -1;
 
   // Add a mapping to /tmp/perf-pid.map for the entire address space. This will
   // be used if symbols aren't resolved in an earlier mapping.
@@ -119,38 +214,97 @@ int bcc_procutils_each_module(int pid, bcc_procutils_modulecb callback,
   return 0;
 }
 
-int bcc_procutils_each_ksym(bcc_procutils_ksymcb callback, void *payload) {
-  char line[2048];
-  FILE *kallsyms;
+// "ffffffffc0a01000 t nf_nat_setup_info\t[nf_nat]"
+static void parse_kallsyms_line(char *line, bcc_procutils_kallsymcb callback,
+                                void *payload) {
+  uint64_t addr;
+  char *p, *name, *module = NULL;
+  char type;
+
+  p = (char *)parse_hex(line, &addr);
+  if (p == line || p[0] != ' ' || !p[1] || p[2] != ' ')
+    return;
+
+  type = p[1];
+  name = p + 3;
+  for (p = name; *p && *p != '\t' && *p != ' '; ++p)
+    ;
+  if (*p) {
+    *p++ = '\0';
+    while (*p == '\t' || *p == ' ')
+      ++p;
+    if (*p == '[') {
+      module = ++p;
+      while (*p && *p != ']')
+        ++p;
+      *p = '\0';
+    }
+  }
+
+  callback(name, addr, type, module, payload);
+}
+
+int bcc_procutils_each_kallsym(bcc_procutils_kallsymcb callback,
+                               void *payload) {
+  const size_t bufsize = 1 << 16;
+  size_t len = 0;
+  ssize_t n;
+  char *buf;
+  int fd;
 
   /* root is needed to list ksym addresses */
   if (geteuid() != 0)
     return -1;
 
-  kallsyms = fopen("/proc/kallsyms", "r");
-  if (!kallsyms)
+  fd = open("/proc/kallsyms", O_RDONLY);
+  if (fd < 0)
     return -1;
 
-  if (!fgets(line, sizeof(line), kallsyms)) {
-    fclose(kallsyms);
+  buf = malloc(bufsize);
+  if (!buf) {
+    close(fd);
     return -1;
   }
 
-  while (fgets(line, sizeof(line), kallsyms)) {
-    char *symname, *endsym;
-    unsigned long long addr;
+  while ((n = read(fd, buf + len, bufsize - len - 1)) > 0) {
+    char *line = buf, *end = buf + len + n, *nl;
 
-    addr = strtoull(line, &symname, 16);
-    endsym = symname = symname + 3;
-
-    while (*endsym && !isspace(*endsym)) endsym++;
+    while ((nl = memchr(line, '\n', end - line))) {
+      *nl = '\0';
+      parse_kallsyms_line(line, callback, payload);
+      line = nl + 1;
+    }
 
-    *endsym = '\0';
-    callback(symname, addr, payload);
+    // carry the partial last line over to the next read
+    len = end - line;
+    if (len == bufsize - 1)
+      len = 0;
+    memmove(buf, line, len);
+  }
+  if (len) {
+    buf[len] = '\0';
+    parse_kallsyms_line(buf, callback, payload);
   }
 
-  fclose(kallsyms);
-  return 0;
+  free(buf);
+  close(fd);
+  return n < 0 ? -1 : 0;
+}
+
+struct ksym_cb {
+  bcc_procutils_ksymcb callback;
+  void *payload;
+};
+
+static void _each_ksym(const char *name, uint64_t addr, char type,
+                       const char *module, void *p) {
+  struct ksym_cb *cb = (struct ksym_cb *)p;
+  cb->callback(name, addr, cb->payload);
+}
+
+int bcc_procutils_each_ksym(bcc_procutils_ksymcb callback, void *payload) {
+  struct ksym_cb cb = {callback, payload};
+  return bcc_procutils_each_kallsym(_each_ksym, &cb);
 }
 
 #define CACHE1_HEADER "ld.so-1.7.0"
@@ -189,96 +343,258 @@ struct ld_cache2 {
   struct ld_cache2_entry entries[0];
 };
 
-static int lib_cache_count;
-static struct ld_lib {
-  char *libname;
-  char *path;
-  int flags;
-} * lib_cache;
+// A mapped ld.so.cache with its entries hashed by soname, which is the name
+// up to ".so" and is what bcc_procutils_which_so() looks up. The cache is
+// unmapped once ldconfig replaces it; the paths handed out are copies.
+struct ld_slot {
+  const char *soname;
+  size_t len;
+  const char *path;
+};
+
+struct ld_cache {
+  const char *map;
+  size_t size;
+  struct ld_slot *slots;
+  size_t mask;
+  size_t used;
+};
+
+// identity of the file last loaded, or found missing or invalid
+struct ld_cache_stamp {
+  bool exists;
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+};
+
+static struct ld_cache *ld_cache;
+static struct ld_cache_stamp ld_cache_stamp;
+static bool ld_cache_checked;
+static pthread_mutex_t ld_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Paths returned by bcc_procutils_which_so(), each distinct one copied once
+// and never freed so that they outlive the cache they were found in. Their
+// number is that of the libraries looked up, not of the cache reloads.
+static char **ld_paths;
+static size_t ld_paths_mask;
+static size_t ld_paths_used;
+
+static bool match_so_flags(int flags);
+
+static uint32_t hash_soname(const char *name, size_t len) {
+  uint32_t h = 2166136261u;
+  size_t i;
+  for (i = 0; i < len; ++i)
+    h = (h ^ (unsigned char)name[i]) * 16777619u;
+  return h;
+}
+
+static struct ld_slot *find_slot(struct ld_cache *cache, const char *soname,
+                                 size_t len) {
+  size_t b = hash_soname(soname, len) & cache->mask;
+  for (; cache->slots[b].soname; b = (b + 1) & cache->mask) {
+    struct ld_slot *slot = &cache->slots[b];
+    if (slot->len == len && !memcmp(slot->soname, soname, len))
+      return slot;
+  }
+  return &cache->slots[b];
+}
+
+// A name is found by any of its prefixes that end in ".so", the first entry
+// in the cache with a usable ABI wins.
+static void index_entry(struct ld_cache *cache, const char *name,
+                        const char *path, int flags) {
+  const char *so = name;
+
+  if (!match_so_flags(flags))
+    return;
+
+  while ((so = strstr(so, ".so"))) {
+    size_t len = so + 3 - name;
+    struct ld_slot *slot;
+
+    // names with many ".so" in them could fill the table, keep it sparse
+    if ((cache->used + 1) * 4 > (cache->mask + 1) * 3)
+      return;
+    slot = find_slot(cache, name, len);
+    if (!slot->soname) {
+      slot->soname = name;
+      slot->len = len;
+      slot->path = path;
+      cache->used++;
+    }
+    so += 3;
+  }
+}
+
+static char **find_path(char **paths, size_t mask, const char *path) {
+  size_t b = hash_soname(path, strlen(path)) & mask;
+  for (; paths[b]; b = (b + 1) & mask)
+    if (!strcmp(paths[b], path))
+      break;
+  return &paths[b];
+}
 
-static int read_cache1(const char *ld_map) {
-  struct ld_cache1 *ldcache = (struct ld_cache1 *)ld_map;
+// the copy of path kept in ld_paths, NULL if out of memory
+static const char *intern_path(const char *path) {
+  char **slot;
+
+  if ((ld_paths_used + 1) * 2 > ld_paths_mask) {
+    size_t n = ld_paths ? (ld_paths_mask + 1) * 2 : 16, i;
+    char **paths = calloc(n, sizeof(char *));
+    if (!paths)
+      return NULL;
+    for (i = 0; ld_paths && i <= ld_paths_mask; ++i)
+      if (ld_paths[i])
+        *find_path(paths, n - 1, ld_paths[i]) = ld_paths[i];
+    free(ld_paths);
+    ld_paths = paths;
+    ld_paths_mask = n - 1;
+  }
+
+  slot = find_path(ld_paths, ld_paths_mask, path);
+  if (!*slot) {
+    if (!(*slot = strdup(path)))
+      return NULL;
+    ld_paths_used++;
+  }
+  return *slot;
+}
+
+static bool valid_string(const struct ld_cache *cache, const char *str) {
+  return str >= cache->map && str < cache->map + cache->size &&
+         memchr(str, '\0', cache->map + cache->size - str);
+}
+
+static int alloc_slots(struct ld_cache *cache, uint32_t count) {
+  size_t n = 16;
+  while (n < (size_t)count * 2)
+    n <<= 1;
+  cache->slots = calloc(n, sizeof(struct ld_slot));
+  cache->mask = n - 1;
+  return cache->slots ? 0 : -1;
+}
+
+static int read_cache1(struct ld_cache *cache, const char *ld_map) {
+  const struct ld_cache1 *ldcache = (const struct ld_cache1 *)ld_map;
   const char *ldstrings =
       (const char *)(ldcache->entries + ldcache->entry_count);
   uint32_t i;
 
-  lib_cache =
-      (struct ld_lib *)malloc(ldcache->entry_count * sizeof(struct ld_lib));
-  lib_cache_count = (int)ldcache->entry_count;
+  if ((const char *)ldstrings > cache->map + cache->size ||
+      alloc_slots(cache, ldcache->entry_count) < 0)
+    return -1;
 
   for (i = 0; i < ldcache->entry_count; ++i) {
     const char *key = ldstrings + ldcache->entries[i].key;
     const char *val = ldstrings + ldcache->entries[i].value;
-    const int flags = ldcache->entries[i].flags;
 
-    lib_cache[i].libname = strdup(key);
-    lib_cache[i].path = strdup(val);
-    lib_cache[i].flags = flags;
+    if (valid_string(cache, key) && valid_string(cache, val))
+      index_entry(cache, key, val, ldcache->entries[i].flags);
   }
   return 0;
 }
 
-static int read_cache2(const char *ld_map) {
-  struct ld_cache2 *ldcache = (struct ld_cache2 *)ld_map;
+static int read_cache2(struct ld_cache *cache, const char *ld_map) {
+  const struct ld_cache2 *ldcache = (const struct ld_cache2 *)ld_map;
   uint32_t i;
 
-  if (memcmp(ld_map, CACHE2_HEADER, CACHE2_HEADER_LEN))
+  if (ld_map + sizeof(struct ld_cache2) > cache->map + cache->size ||
+      memcmp(ld_map, CACHE2_HEADER, CACHE2_HEADER_LEN))
     return -1;
 
-  lib_cache =
-      (struct ld_lib *)malloc(ldcache->entry_count * sizeof(struct ld_lib));
-  lib_cache_count = (int)ldcache->entry_count;
+  if ((const char *)(ldcache->entries + ldcache->entry_count) >
+          cache->map + cache->size ||
+      alloc_slots(cache, ldcache->entry_count) < 0)
+    return -1;
 
   for (i = 0; i < ldcache->entry_count; ++i) {
     const char *key = ld_map + ldcache->entries[i].key;
     const char *val = ld_map + ldcache->entries[i].value;
-    const int flags = ldcache->entries[i].flags;
 
-    lib_cache[i].libname = strdup(key);
-    lib_cache[i].path = strdup(val);
-    lib_cache[i].flags = flags;
+    if (valid_string(cache, key) && valid_string(cache, val))
+      index_entry(cache, key, val, ldcache->entries[i].flags);
   }
   return 0;
 }
 
-static int load_ld_cache(const char *cache_path) {
+static void free_ld_cache(struct ld_cache *cache) {
+  munmap((void *)cache->map, cache->size);
+  free(cache->slots);
+  free(cache);
+}
+
+static struct ld_cache *load_ld_cache(const char *cache_path) {
+  struct ld_cache *cache;
   struct stat st;
-  size_t ld_size;
-  const char *ld_map;
   int ret, fd = open(cache_path, O_RDONLY);
 
   if (fd < 0)
-    return -1;
+    return NULL;
 
   if (fstat(fd, &st) < 0 || st.st_size < sizeof(struct ld_cache1)) {
     close(fd);
-    return -1;
+    return NULL;
   }
 
-  ld_size = st.st_size;
-  ld_map = (const char *)mmap(NULL, ld_size, PROT_READ, MAP_PRIVATE, fd, 0);
-  if (ld_map == MAP_FAILED) {
+  cache = calloc(1, sizeof(*cache));
+  if (!cache) {
     close(fd);
-    return -1;
+    return NULL;
+  }
+  cache->size = st.st_size;
+  cache->map = (const char *)mmap(NULL, cache->size, PROT_READ, MAP_PRIVATE,
+                                  fd, 0);
+  close(fd);
+  if (cache->map == MAP_FAILED) {
+    free(cache);
+    return NULL;
   }
 
-  if (memcmp(ld_map, CACHE1_HEADER, CACHE1_HEADER_LEN) == 0) {
-    const struct ld_cache1 *cache1 = (struct ld_cache1 *)ld_map;
+  if (memcmp(cache->map, CACHE1_HEADER, CACHE1_HEADER_LEN) == 0) {
+    const struct ld_cache1 *cache1 = (struct ld_cache1 *)cache->map;
     size_t cache1_len = sizeof(struct ld_cache1) +
                         (cache1->entry_count * sizeof(struct ld_cache1_entry));
     cache1_len = (cache1_len + 0x7) & ~0x7ULL;
 
-    if (ld_size > (cache1_len + sizeof(struct ld_cache2)))
-      ret = read_cache2(ld_map + cache1_len);
+    if (cache->size > (cache1_len + sizeof(struct ld_cache2)))
+      ret = read_cache2(cache, cache->map + cache1_len);
     else
-      ret = read_cache1(ld_map);
+      ret = read_cache1(cache, cache->map);
   } else {
-    ret = read_cache2(ld_map);
+    ret = read_cache2(cache, cache->map);
   }
 
-  munmap((void *)ld_map, ld_size);
-  close(fd);
-  return ret;
+  if (ret < 0) {
+    free_ld_cache(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+// whether cache_path is not the file last seen there, ldconfig replaces it
+// with a new file so the inode changes along with the mtime
+static bool ld_cache_changed(const char *cache_path) {
+  struct ld_cache_stamp stamp = {0};
+  struct stat st;
+
+  if (stat(cache_path, &st) == 0) {
+    stamp.exists = true;
+    stamp.dev = st.st_dev;
+    stamp.ino = st.st_ino;
+    stamp.mtime = st.st_mtim;
+  }
+
+  if (ld_cache_checked && stamp.exists == ld_cache_stamp.exists &&
+      stamp.dev == ld_cache_stamp.dev && stamp.ino == ld_cache_stamp.ino &&
+      stamp.mtime.tv_sec == ld_cache_stamp.mtime.tv_sec &&
+      stamp.mtime.tv_nsec == ld_cache_stamp.mtime.tv_nsec)
+    return false;
+
+  ld_cache_checked = true;
+  ld_cache_stamp = stamp;
+  return stamp.exists;
 }
 
 #define LD_SO_CACHE "/etc/ld.so.cache"
@@ -310,25 +626,29 @@ static bool match_so_flags(int flags) {
 const char *bcc_procutils_which_so(const char *libname) {
   const size_t soname_len = strlen(libname) + strlen("lib.so");
   char soname[soname_len + 1];
-  int i;
+  const char *path = NULL;
 
   if (strchr(libname, '/'))
     return libname;
 
-  if (lib_cache_count < 0)
-    return NULL;
-
-  if (!lib_cache_count && load_ld_cache(LD_SO_CACHE) < 0) {
-    lib_cache_count = -1;
-    return NULL;
-  }
-
   snprintf(soname, soname_len + 1, "lib%s.so", libname);
 
-  for (i = 0; i < lib_cache_count; ++i) {
-    if (!strncmp(lib_cache[i].libname, soname, soname_len) &&
-        match_so_flags(lib_cache[i].flags))
-      return lib_cache[i].path;
+  pthread_mutex_lock(&ld_cache_lock);
+  // a cache that failed to load leaves the last good one in use
+  if (ld_cache_changed(LD_SO_CACHE)) {
+    struct ld_cache *cache = load_ld_cache(LD_SO_CACHE);
+    if (cache) {
+      if (ld_cache)
+        free_ld_cache(ld_cache);
+      ld_cache = cache;
+    }
+  }
+  if (ld_cache) {
+    path = find_slot(ld_cache, soname, soname_len)->path;
+    if (path)
+      path = intern_path(path);
   }
-  return NULL;
+  pthread_mutex_unlock(&ld_cache_lock);
+
+  return path;
 }
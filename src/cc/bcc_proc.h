@@ -24,14 +24,45 @@ extern "C" {
 
 #include <stdint.h>
 
+// One line of /proc/PID/maps
+struct bcc_mapping {
+  uint64_t start;
+  uint64_t end;
+  // offset in the file of start
+  uint64_t offset;
+  uint64_t inode;
+  unsigned int dev_major;
+  unsigned int dev_minor;
+  char perms[5];
+  // the file was unlinked, or is a memfd; path has " (deleted)" removed
+  int deleted;
+  // empty for anonymous mappings, only valid during the callback
+  const char *path;
+};
+
+typedef int (*bcc_procutils_mappingcb)(const struct bcc_mapping *, void *);
 typedef int (*bcc_procutils_modulecb)(const char *, uint64_t, uint64_t, void *);
 typedef void (*bcc_procutils_ksymcb)(const char *, uint64_t, void *);
+// module is NULL for symbols of the kernel image, "bpf" for bpf programs
+typedef void (*bcc_procutils_kallsymcb)(const char *name, uint64_t addr,
+                                        char type, const char *module,
+                                        void *payload);
 
+// path of lib<libname>.so from ld.so.cache, valid for the life of the process
 const char *bcc_procutils_which_so(const char *libname);
 char *bcc_procutils_which(const char *binpath);
+// Prefix that opens the paths pid sees from here: "" when pid shares our
+// mount namespace, "/proc/PID/root" when it does not, as in a container.
+int bcc_procutils_mount_root(int pid, char *root, size_t size);
+// every mapping of pid, until callback returns < 0
+int bcc_procutils_each_mapping(int pid, bcc_procutils_mappingcb callback,
+                               void *payload);
+// executable mappings of named files, and the perf map of pid
 int bcc_procutils_each_module(int pid, bcc_procutils_modulecb callback,
                               void *payload);
 int bcc_procutils_each_ksym(bcc_procutils_ksymcb callback, void *payload);
+int bcc_procutils_each_kallsym(bcc_procutils_kallsymcb callback,
+                               void *payload);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,424 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <errno.h>
+#include <map>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bcc_stacks.h"
+#include "bcc_syms.h"
+#include "libbpf.h"
+#include "stacks.h"
+
+namespace {
+
+// entries of a stack trace map value, which the kernel zero fills past the
+// last frame; larger than BPF_MAX_STACK_DEPTH to allow for bigger maps
+const size_t MAX_STACK_ENTRIES = 1024;
+const uint64_t KERNEL = 1ull << 32;
+
+// the subset of the protobuf encoding a pprof profile needs
+class ProtoWriter {
+  std::string buf_;
+
+public:
+  void varint(uint64_t v) {
+    for (; v >= 0x80; v >>= 7)
+      buf_ += (char)(v | 0x80);
+    buf_ += (char)v;
+  }
+  void uint(int field, uint64_t v) {
+    varint((uint64_t)field << 3);
+    varint(v);
+  }
+  void bytes(int field, const std::string &s) {
+    varint((uint64_t)field << 3 | 2);
+    varint(s.size());
+    buf_ += s;
+  }
+  void packed(int field, const std::vector<uint64_t> &vs) {
+    ProtoWriter p;
+    for (uint64_t v : vs)
+      p.varint(v);
+    bytes(field, p.str());
+  }
+  const std::string &str() const { return buf_; }
+};
+
+uint64_t read_uint(const uint8_t *p, int size) {
+  if (size == 4) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// get_stackid ids of -1 and -EFAULT are left by tools for stacks they do
+// not collect and by the kernel for threads without a user stack
+bool is_missing(int id) { return id < 0 && id != -1 && id != -EFAULT; }
+
+}  // namespace
+
+bool StackReport::read_samples(int counts_fd, const struct bcc_stack_key &key,
+                               std::vector<Sample> *samples) {
+  if (key.key_size <= 0 || key.value_size <= 0)
+    return false;
+  auto has = [&](int offset, int size) {
+    return offset >= 0 && offset + size <= key.key_size;
+  };
+
+  std::vector<uint8_t> k(key.key_size), next(key.key_size);
+  std::vector<uint8_t> value(key.value_size);
+  bool counted = key.value_size == 4 || key.value_size == 8;
+  int res = bpf_get_first_key(counts_fd, k.data(), k.size());
+  for (; res == 0; k.swap(next)) {
+    if (bpf_lookup_elem(counts_fd, k.data(), value.data()) == 0) {
+      Sample s = {0, std::string(), -1, -1, 0,
+                  counted ? read_uint(value.data(), key.value_size) : 0};
+      if (has(key.pid_offset, 4))
+        s.pid = read_uint(&k[key.pid_offset], 4);
+      if (has(key.comm_offset, key.comm_size)) {
+        const char *comm = (const char *)&k[key.comm_offset];
+        s.comm.assign(comm, strnlen(comm, key.comm_size));
+      }
+      if (has(key.user_stack_offset, 4))
+        s.user_stack = (int)read_uint(&k[key.user_stack_offset], 4);
+      if (has(key.kernel_stack_offset, 4))
+        s.kernel_stack = (int)read_uint(&k[key.kernel_stack_offset], 4);
+      if (has(key.kernel_ip_offset, 8))
+        s.kernel_ip = read_uint(&k[key.kernel_ip_offset], 8);
+      samples->push_back(s);
+    }
+    res = bpf_get_next_key(counts_fd, k.data(), next.data());
+  }
+  return true;
+}
+
+bool StackReport::read(int counts_fd, int stacks_fd,
+                       const struct bcc_stack_key &key) {
+  if (!read_samples(counts_fd, key, &samples_))
+    return false;
+
+  // most samples share their stacks with others
+  std::vector<uint64_t> ips(MAX_STACK_ENTRIES);
+  std::unordered_map<int, bool> lost;
+  for (const Sample &s : samples_) {
+    bool missing = false;
+    if (s.user_stack == -ENOMEM || s.kernel_stack == -ENOMEM)
+      ++out_of_room_;
+    for (int id : {s.user_stack, s.kernel_stack}) {
+      if (id < 0) {
+        missing = missing || is_missing(id);
+        continue;
+      }
+      if (!stacks_.count(id) && !lost.count(id)) {
+        std::fill(ips.begin(), ips.end(), 0);
+        if (bpf_lookup_elem(stacks_fd, &id, ips.data()) < 0) {
+          lost[id] = true;
+        } else {
+          size_t n = std::find(ips.begin(), ips.end(), 0) - ips.begin();
+          stacks_[id].assign(ips.begin(), ips.begin() + n);
+        }
+      }
+      missing = missing || lost.count(id);
+    }
+    if (missing)
+      ++missing_;
+  }
+  return true;
+}
+
+void StackReport::frames(const Sample &s, std::vector<Frame> *out) {
+  out->clear();
+  auto user = stacks_.find(s.user_stack);
+  if (s.user_stack >= 0 && user != stacks_.end()) {
+    auto &names = user_names_[s.pid];
+    for (auto it = user->second.rbegin(); it != user->second.rend(); ++it)
+      out->push_back({*it, names[*it], false});
+  }
+  auto kernel = stacks_.find(s.kernel_stack);
+  if (s.kernel_stack >= 0 && kernel != stacks_.end()) {
+    for (auto it = kernel->second.rbegin(); it != kernel->second.rend(); ++it)
+      out->push_back({*it, kernel_names_[*it], true});
+    // the ip of the sample, which the kernel stack can miss
+    if (s.kernel_ip)
+      out->push_back({s.kernel_ip, kernel_names_[s.kernel_ip], true});
+  }
+  for (Frame &f : *out)
+    if (!f.name)
+      f.name = "[unknown]";
+}
+
+void StackReport::symbolize() {
+  std::unordered_map<uint32_t, std::vector<uint64_t>> user;
+  std::vector<uint64_t> kernel;
+  for (const Sample &s : samples_) {
+    auto it = stacks_.find(s.user_stack);
+    if (s.user_stack >= 0 && it != stacks_.end()) {
+      auto &addrs = user[s.pid];
+      addrs.insert(addrs.end(), it->second.begin(), it->second.end());
+    }
+    it = stacks_.find(s.kernel_stack);
+    if (s.kernel_stack >= 0 && it != stacks_.end()) {
+      kernel.insert(kernel.end(), it->second.begin(), it->second.end());
+      if (s.kernel_ip)
+        kernel.push_back(s.kernel_ip);
+    }
+  }
+
+  std::vector<struct bcc_symbol> syms;
+  auto resolve = [&](SymbolCache *cache, std::vector<uint64_t> &addrs,
+                     std::unordered_map<uint64_t, const char *> *names) {
+    std::sort(addrs.begin(), addrs.end());
+    addrs.erase(std::unique(addrs.begin(), addrs.end()), addrs.end());
+    syms.resize(addrs.size());
+    cache->resolve_batch(addrs.data(), addrs.size(), syms.data());
+    for (size_t i = 0; i < addrs.size(); ++i)
+      (*names)[addrs[i]] = syms[i].name ? syms[i].demangle_name : nullptr;
+  };
+
+  if (!kernel.empty()) {
+    if (!ksyms_)
+      ksyms_.reset(new KSyms());
+    resolve(ksyms_.get(), kernel, &kernel_names_);
+  }
+  for (auto &pid : user) {
+    auto &cache = procs_[pid.first];
+    if (!cache)
+      cache.reset(new ProcSyms(pid.first, true));
+    resolve(cache.get(), pid.second, &user_names_[pid.first]);
+  }
+}
+
+std::string StackReport::folded() {
+  symbolize();
+
+  std::map<std::string, uint64_t> lines;
+  std::vector<Frame> stack;
+  for (const Sample &s : samples_) {
+    frames(s, &stack);
+    std::string line = s.comm;
+    for (size_t i = 0; i < stack.size(); ++i) {
+      if ((flags_ & BCC_STACKS_DELIMIT) && stack[i].kernel &&
+          (i == 0 || !stack[i - 1].kernel))
+        line += ";-";
+      line += ";";
+      line += stack[i].name;
+      if ((flags_ & BCC_STACKS_ANNOTATE) && stack[i].kernel)
+        line += "_[k]";
+    }
+    if (s.comm.empty() && !line.empty())
+      line.erase(0, 1);
+    if (!line.empty())
+      lines[line] += s.count;
+  }
+
+  std::string out;
+  for (auto &line : lines)
+    out += line.first + " " + std::to_string(line.second) + "\n";
+  return out;
+}
+
+std::string StackReport::pprof() {
+  symbolize();
+
+  std::vector<std::string> strings(1);
+  std::unordered_map<std::string, uint64_t> string_ids;
+  auto intern = [&](const std::string &s) -> uint64_t {
+    if (s.empty())
+      return 0;
+    auto it = string_ids.find(s);
+    if (it != string_ids.end())
+      return it->second;
+    strings.push_back(s);
+    return string_ids[s] = strings.size() - 1;
+  };
+
+  ProtoWriter profile;
+  ProtoWriter sample_type;
+  sample_type.uint(1, intern("samples"));
+  sample_type.uint(2, intern("count"));
+  profile.bytes(1, sample_type.str());
+
+  // a location per address of each process and of the kernel, a function
+  // per name
+  std::map<std::pair<uint64_t, uint64_t>, uint64_t> locations;
+  std::unordered_map<std::string, uint64_t> functions;
+  ProtoWriter defs;
+  std::vector<Frame> stack;
+  std::vector<uint64_t> ids;
+  for (const Sample &s : samples_) {
+    frames(s, &stack);
+    ids.clear();
+    // pprof lists the leaf first
+    for (auto f = stack.rbegin(); f != stack.rend(); ++f) {
+      auto key = std::make_pair(f->kernel ? KERNEL : s.pid, f->addr);
+      auto loc = locations.find(key);
+      if (loc == locations.end()) {
+        auto fn = functions.find(f->name);
+        if (fn == functions.end()) {
+          fn = functions.emplace(f->name, functions.size() + 1).first;
+          uint64_t name = intern(f->name);
+          ProtoWriter function;
+          function.uint(1, fn->second);
+          function.uint(2, name);
+          function.uint(3, name);
+          defs.bytes(5, function.str());
+        }
+        loc = locations.emplace(key, locations.size() + 1).first;
+        ProtoWriter line, location;
+        line.uint(1, fn->second);
+        location.uint(1, loc->second);
+        location.uint(3, f->addr);
+        location.bytes(4, line.str());
+        defs.bytes(4, location.str());
+      }
+      ids.push_back(loc->second);
+    }
+
+    ProtoWriter sample, pid, comm;
+    sample.packed(1, ids);
+    sample.packed(2, {s.count});
+    pid.uint(1, intern("pid"));
+    pid.uint(3, s.pid);
+    sample.bytes(3, pid.str());
+    if (!s.comm.empty()) {
+      comm.uint(1, intern("comm"));
+      comm.uint(2, intern(s.comm));
+      sample.bytes(3, comm.str());
+    }
+    profile.bytes(2, sample.str());
+  }
+
+  std::string out = profile.str() + defs.str();
+  ProtoWriter table;
+  for (const std::string &s : strings)
+    table.bytes(6, s);
+  return out + table.str();
+}
+
+bool StackReclaimer::stack_ids(int stacks_fd, int max_entries,
+                               std::vector<uint32_t> *ids) {
+  uint32_t id, next;
+  if (bpf_get_first_key(stacks_fd, &id, sizeof(id)) == 0) {
+    do
+      ids->push_back(id);
+    while (bpf_get_next_key(stacks_fd, &id, &next) == 0 && (id = next, true));
+    return true;
+  }
+  if (errno == ENOENT)
+    return true;
+
+  // stack trace maps of older kernels cannot be walked, try every id
+  if (max_entries <= 0)
+    return false;
+  std::vector<uint64_t> ips(MAX_STACK_ENTRIES);
+  for (id = 0; id < (uint32_t)max_entries; ++id)
+    if (bpf_lookup_elem(stacks_fd, &id, ips.data()) == 0)
+      ids->push_back(id);
+  return true;
+}
+
+int StackReclaimer::reclaim(const int *counts_fds,
+                            const struct bcc_stack_key *keys, int n) {
+  std::unordered_set<uint32_t> referenced;
+  std::vector<StackReport::Sample> samples;
+  for (int i = 0; i < n; ++i) {
+    samples.clear();
+    if (!StackReport::read_samples(counts_fds[i], keys[i], &samples))
+      return -1;
+    for (const StackReport::Sample &s : samples) {
+      if (s.user_stack >= 0)
+        referenced.insert(s.user_stack);
+      if (s.kernel_stack >= 0)
+        referenced.insert(s.kernel_stack);
+    }
+  }
+
+  std::vector<uint32_t> ids;
+  if (!stack_ids(stacks_fd_, max_entries_, &ids))
+    return -1;
+  std::unordered_set<uint32_t> unreferenced;
+  int deleted = 0;
+  for (uint32_t id : ids) {
+    if (referenced.count(id))
+      continue;
+    if (unreferenced_.count(id) && bpf_delete_elem(stacks_fd_, &id) == 0)
+      ++deleted;
+    else
+      unreferenced.insert(id);
+  }
+  unreferenced_.swap(unreferenced);
+  return deleted;
+}
+
+extern "C" {
+
+int bcc_stacks_report(int counts_fd, int stacks_fd,
+                      const struct bcc_stack_key *key, int flags, int out_fd,
+                      int *out_of_room) {
+  StackReport report(flags);
+  if (!report.read(counts_fd, stacks_fd, *key))
+    return -1;
+  if (out_of_room)
+    *out_of_room = report.out_of_room();
+
+  std::string out =
+      (flags & BCC_STACKS_PPROF) ? report.pprof() : report.folded();
+  for (size_t done = 0; done < out.size();) {
+    ssize_t n = write(out_fd, out.data() + done, out.size() - done);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    done += n;
+  }
+  return report.missing();
+}
+
+int bcc_stacks_clear(int stacks_fd, int max_entries) {
+  std::vector<uint32_t> ids;
+  if (!StackReclaimer::stack_ids(stacks_fd, max_entries, &ids))
+    return -1;
+  int deleted = 0;
+  for (uint32_t id : ids)
+    if (bpf_delete_elem(stacks_fd, &id) == 0)
+      ++deleted;
+  return deleted;
+}
+
+void *bcc_stacks_reclaimer_new(int stacks_fd, int max_entries) {
+  return new StackReclaimer(stacks_fd, max_entries);
+}
+
+void bcc_stacks_reclaimer_free(void *reclaimer) {
+  delete static_cast<StackReclaimer *>(reclaimer);
+}
+
+int bcc_stacks_reclaim(void *reclaimer, const int *counts_fds,
+                       const struct bcc_stack_key *keys, int n) {
+  return static_cast<StackReclaimer *>(reclaimer)->reclaim(counts_fds, keys,
+                                                           n);
+}
+
+}
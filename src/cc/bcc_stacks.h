@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LIBBCC_STACKS_H
+#define LIBBCC_STACKS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Where the fields of the key of a counts map are, as offsets into the key;
+// -1 for the fields the key does not have. Stack ids are ints as returned by
+// get_stackid, the pid is a u32 and kernel_ip a u64 that, when non-zero, is
+// the top frame of the kernel stack.
+struct bcc_stack_key {
+  int key_size;
+  // size of the values, which are read as counts when of 4 or 8 bytes
+  int value_size;
+  int pid_offset;
+  int comm_offset;
+  int comm_size;
+  int user_stack_offset;
+  int kernel_stack_offset;
+  int kernel_ip_offset;
+};
+
+// a pprof profile rather than folded stacks
+#define BCC_STACKS_PPROF 0x1
+// kernel frames get a _[k] suffix in folded stacks
+#define BCC_STACKS_ANNOTATE 0x2
+// a "-" frame between user and kernel frames in folded stacks
+#define BCC_STACKS_DELIMIT 0x4
+
+// Write the stacks counted in counts_fd to out_fd, as folded stacks for
+// flame graphs or as a pprof profile. Each stack is read from stacks_fd once
+// and each address symbolized once. Returns the number of keys whose stacks
+// are missing, or -1 on error. If out_of_room is not NULL, it is set to the
+// number of keys with a stack id of -ENOMEM, for a stack trace map too small.
+int bcc_stacks_report(int counts_fd, int stacks_fd,
+                      const struct bcc_stack_key *key, int flags, int out_fd,
+                      int *out_of_room);
+
+// delete every stack of a stack trace map of max_entries entries; returns
+// the number deleted, or -1 on error
+int bcc_stacks_clear(int stacks_fd, int max_entries);
+
+// Reclaims stacks of stacks_fd over repeated calls to bcc_stacks_reclaim,
+// which deletes the stacks that none of the n counts maps counts_fds, with
+// keys described by keys, refers to. A stack stored since the previous call
+// is left for the next one, as its count may not be in yet. Returns the
+// number of stacks deleted, or -1 on error.
+void *bcc_stacks_reclaimer_new(int stacks_fd, int max_entries);
+void bcc_stacks_reclaimer_free(void *reclaimer);
+int bcc_stacks_reclaim(void *reclaimer, const int *counts_fds,
+                       const struct bcc_stack_key *keys, int n);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
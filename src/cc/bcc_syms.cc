@@ -14,10 +14,21 @@
  * limitations under the License.
  */
 
+#include <atomic>
 #include <cxxabi.h>
+#include <iterator>
+#include <map>
+#include <thread>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "bcc_elf.h"
@@ -36,172 +47,1393 @@ ino_t ProcStat::getinode_() {
 ProcStat::ProcStat(int pid)
     : procfs_(tfm::format("/proc/%d/exe", pid)), inode_(getinode_()) {}
 
-void KSyms::_add_symbol(const char *symname, uint64_t addr, void *p) {
-  KSyms *ks = static_cast<KSyms *>(p);
-  ks->syms_.emplace_back(symname, addr);
+// indices of addrs in address order: walking them keeps consecutive lookups
+// in the same module and the same part of its table
+static std::vector<size_t> sorted_order(const uint64_t *addrs, size_t n) {
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(),
+            [addrs](size_t a, size_t b) { return addrs[a] < addrs[b]; });
+  return order;
 }
 
-void KSyms::refresh() {
-  if (syms_.empty()) {
-    bcc_procutils_each_ksym(_add_symbol, this);
-    std::sort(syms_.begin(), syms_.end());
+size_t SymbolCache::resolve_batch(const uint64_t *addrs, size_t n,
+                                  struct bcc_symbol *out) {
+  std::vector<size_t> order = sorted_order(addrs, n);
+  size_t resolved = 0;
+  bool last_res = false;
+  for (size_t k = 0; k < n; ++k) {
+    size_t i = order[k];
+    if (k > 0 && addrs[i] == addrs[order[k - 1]])
+      out[i] = out[order[k - 1]];
+    else
+      last_res = resolve_addr(addrs[i], &out[i]);
+    if (last_res)
+      ++resolved;
   }
+  return resolved;
 }
 
-bool KSyms::resolve_addr(uint64_t addr, struct bcc_symbol *sym) {
-  refresh();
+static uint64_t monotonic_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
 
-  if (syms_.empty()) {
-    sym->name = nullptr;
-    sym->demangle_name = nullptr;
-    sym->module = nullptr;
-    sym->offset = 0x0;
-    return false;
+KSyms::KSyms()
+    : loaded_(false), check_interval_ms_(DEFAULT_CHECK_INTERVAL_MS),
+      last_check_ms_(monotonic_ms()) {}
+
+void KSyms::_add_symbol(const char *symname, uint64_t addr, char type,
+                        const char *module, void *p) {
+  LoadState *state = static_cast<LoadState *>(p);
+  if (!module) {
+    if (state->kernel)
+      state->kernel->add(symname, addr, 0, type);
+    return;
   }
+  SymbolTable *table = state->module_names->count(module) ? state->modules
+                                                           : state->live;
+  if (table) {
+    char group[256];
+    snprintf(group, sizeof(group), "[%s]", module);
+    table->add(symname, addr, 0, type, group);
+  }
+}
 
-  auto it = std::upper_bound(syms_.begin(), syms_.end(), Symbol("", addr)) - 1;
-  sym->name = (*it).name.c_str();
-  sym->demangle_name = sym->name;
-  sym->module = "[kernel]";
-  sym->offset = addr - (*it).addr;
+static std::string read_boot_id() {
+  char boot_id[64] = {};
+  FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+  if (!f)
+    return std::string();
+  bool ok = fscanf(f, "%63s", boot_id) == 1;
+  fclose(f);
+  return ok ? boot_id : std::string();
+}
+
+// FNV-1a of the name and address of each loaded module, whose names go to
+// names if it is not NULL
+static std::string read_modules_key(std::set<std::string> *names = nullptr) {
+  uint64_t hash = 14695981039346656037ull;
+  FILE *f = fopen("/proc/modules", "r");
+  if (f) {
+    char name[256], addr[32];
+    while (fscanf(f, "%255s %*s %*s %*s %*s %31s%*[^\n]", name, addr) == 2) {
+      for (const char *c : {(const char *)name, (const char *)addr})
+        for (; *c; ++c)
+          hash = (hash ^ (uint8_t)*c) * 1099511628211ull;
+      if (names)
+        names->insert(name);
+    }
+    fclose(f);
+  }
+  return tfm::format("%016llx", (unsigned long long)hash);
+}
+
+// The image symbols are saved per boot and module symbols per set of loaded
+// modules; kallsyms is only read for what has no index yet. Other groups are
+// left to load_live().
+void KSyms::load(bool reload_modules) {
+  SymbolTableCache *cache = SymbolTableCache::instance();
+  std::set<std::string> names;
+  std::string boot_id = read_boot_id(), key = read_modules_key(&names);
+  std::string kernel_index, modules_index;
+  if (!boot_id.empty()) {
+    kernel_index = cache->index_path(tfm::format("kallsyms-%s.syms", boot_id));
+    modules_index = cache->index_path(
+        tfm::format("kallsyms-%s-%s.syms", boot_id, key));
+  }
+
+  LoadState state = {nullptr, nullptr, nullptr, &names};
+  if (kernel_.count() == 0 &&
+      (kernel_index.empty() || !kernel_.load_index(kernel_index)))
+    state.kernel = &kernel_;
+
+  std::unique_ptr<SymbolTable> modules;
+  if (!modules_ || reload_modules) {
+    modules.reset(new SymbolTable());
+    if (modules_index.empty() || !modules->load_index(modules_index))
+      state.modules = modules.get();
+  }
+
+  if ((state.kernel || state.modules) &&
+      bcc_procutils_each_kallsym(_add_symbol, &state) < 0)
+    return;
+
+  if (state.kernel) {
+    kernel_.finalize();
+    if (!kernel_index.empty() && kernel_.count())
+      kernel_.save_index(kernel_index);
+  }
+  if (state.modules) {
+    modules->finalize();
+    if (!modules_index.empty() && modules->count())
+      modules->save_index(modules_index);
+  }
+  if (modules)
+    modules_ = std::move(modules);
+  module_names_ = std::move(names);
+  modules_key_ = key;
+  loaded_ = kernel_.count() > 0;
+}
+
+// BPF programs and trampolines come and go with nothing to key an index on,
+// so their symbols are read from kallsyms each time.
+bool KSyms::load_live() {
+  std::unique_ptr<SymbolTable> live(new SymbolTable());
+  LoadState state = {nullptr, nullptr, live.get(), &module_names_};
+  if (bcc_procutils_each_kallsym(_add_symbol, &state) < 0)
+    return false;
+  live->finalize();
+  live_ = std::move(live);
   return true;
 }
 
+// Called when an address resolved outside of the kernel image. Returns true
+// if the module or live symbols were reloaded and the lookup is worth
+// retrying.
+bool KSyms::check_modules() {
+  uint64_t now = monotonic_ms();
+  if (now - last_check_ms_ < check_interval_ms_)
+    return false;
+  last_check_ms_ = now;
+  if (read_modules_key() != modules_key_)
+    load(true);
+  return load_live();
+}
+
+void KSyms::refresh() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!loaded_)
+    load(false);
+  else if (read_modules_key() != modules_key_)
+    load(true);
+  live_.reset();
+  last_check_ms_ = monotonic_ms();
+}
+
+size_t KSyms::memory() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return sizeof(*this) + kernel_.memory() +
+         (modules_ ? modules_->memory() : 0) + (live_ ? live_->memory() : 0);
+}
+
+bool KSyms::find_addr(uint64_t addr, struct bcc_symbol *sym, Cursors *cursors,
+                      bool *outside) {
+  sym->name = nullptr;
+  sym->demangle_name = nullptr;
+  sym->module = nullptr;
+  sym->offset = 0x0;
+
+  ssize_t k = kernel_.find_preceding(addr, cursors->kernel);
+  if (k >= 0)
+    cursors->kernel = k;
+  // past the last symbol of the image: a module, maybe one loaded since
+  *outside = k < 0 || (size_t)k + 1 == kernel_.count();
+  if (*outside && !live_)
+    load_live();
+
+  // the closest preceding symbol of any table wins
+  const SymbolTable *table = k >= 0 ? &kernel_ : nullptr;
+  ssize_t i = k;
+  for (auto t : {std::make_pair(modules_.get(), &cursors->modules),
+                 std::make_pair(live_.get(), &cursors->live)}) {
+    ssize_t j = t.first ? t.first->find_preceding(addr, *t.second) : -1;
+    if (j < 0)
+      continue;
+    *t.second = j;
+    if (!table || t.first->start(j) > table->start(i)) {
+      table = t.first;
+      i = j;
+    }
+  }
+  *outside = *outside || (table && table != &kernel_);
+
+  if (table && table != &kernel_) {
+    sym->name = table->name(i);
+    sym->module = table->group(i);
+    sym->offset = addr - table->start(i);
+  } else if (k >= 0) {
+    sym->name = kernel_.name(k);
+    sym->module = "[kernel]";
+    sym->offset = addr - kernel_.start(k);
+  }
+  sym->demangle_name = sym->name;
+  return sym->name != nullptr;
+}
+
+bool KSyms::resolve_addr(uint64_t addr, struct bcc_symbol *sym) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!loaded_)
+    load(false);
+
+  Cursors cursors = {0, 0, 0};
+  bool outside;
+  bool res = find_addr(addr, sym, &cursors, &outside);
+  if (outside && check_modules()) {
+    cursors.modules = cursors.live = 0;
+    res = find_addr(addr, sym, &cursors, &outside);
+  }
+  return res;
+}
+
+size_t KSyms::resolve_batch(const uint64_t *addrs, size_t n,
+                            struct bcc_symbol *out) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!loaded_)
+    load(false);
+
+  std::vector<size_t> order = sorted_order(addrs, n);
+  size_t resolved = 0;
+  for (int pass = 0; pass < 2; ++pass) {
+    Cursors cursors = {0, 0, 0};
+    bool last_res = false, any_outside = false;
+    resolved = 0;
+    for (size_t k = 0; k < n; ++k) {
+      size_t i = order[k];
+      if (k > 0 && addrs[i] == addrs[order[k - 1]]) {
+        out[i] = out[order[k - 1]];
+      } else {
+        bool outside;
+        last_res = find_addr(addrs[i], &out[i], &cursors, &outside);
+        any_outside |= outside;
+      }
+      if (last_res)
+        ++resolved;
+    }
+    // reloaded module symbols replace those the first pass pointed into, so
+    // the whole batch resolves again
+    if (pass || !any_outside || !check_modules())
+      break;
+  }
+  return resolved;
+}
+
 bool KSyms::resolve_name(const char *_unused, const char *name,
                          uint64_t *addr) {
-  refresh();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!loaded_)
+    load(false);
 
-  if (syms_.size() != symnames_.size()) {
-    symnames_.clear();
-    for (Symbol &sym : syms_) {
-      symnames_[sym.name] = sym.addr;
-    }
+  ssize_t i = kernel_.find_name(name);
+  if (i >= 0) {
+    *addr = kernel_.start(i);
+    return true;
   }
+  if (modules_ && (i = modules_->find_name(name)) >= 0) {
+    *addr = modules_->start(i);
+    return true;
+  }
+  if (!live_)
+    load_live();
+  if (live_ && (i = live_->find_name(name)) >= 0) {
+    *addr = live_->start(i);
+    return true;
+  }
+  return false;
+}
 
-  auto it = symnames_.find(name);
-  if (it == symnames_.end())
-    return false;
+ProcSyms::ProcSyms(int pid, bool prefetch)
+    : pid_(pid), last_hit_(0), procstat_(pid),
+      check_interval_ms_(DEFAULT_CHECK_INTERVAL_MS),
+      last_check_ms_(monotonic_ms()) {
+  char root[64];
+  if (bcc_procutils_mount_root(pid, root, sizeof(root)) == 0)
+    root_ = root;
+  std::shared_ptr<Mappings> mappings(new Mappings());
+  load_modules(mappings.get());
+  std::atomic_store(&mappings_, std::shared_ptr<const Mappings>(mappings));
+  if (prefetch)
+    this->prefetch();
+}
 
-  *addr = it->second;
-  return true;
+bool ProcSyms::load_modules(Mappings *mappings) {
+  LoadState state = {this, mappings};
+  bool res = bcc_procutils_each_mapping(pid_, _add_module, &state) == 0;
+  // the perf map covers whatever no mapping does
+  char map_path[4096];
+  if (res && bcc_perf_map_path(map_path, sizeof(map_path), pid_))
+    mappings->perf_map.reset(new Module(map_path, map_path, 0, -1, 0, 0));
+  std::sort(mappings->modules.begin(), mappings->modules.end(),
+            [](const ModulePtr &a, const ModulePtr &b) {
+              return a->start_ < b->start_;
+            });
+  return res;
+}
+
+// Re-read the mappings of the process. Modules whose mapping did not change
+// stay as they are, with their symbol table and the names earlier results
+// point into, unless the process exec'ed; only the mappings that came or went
+// are added or dropped. Lookups under way keep the snapshot they started
+// with. Called with reload_mutex_ held.
+void ProcSyms::reload_modules() {
+  bool keep_tables = !procstat_.is_stale();
+  procstat_.reset();
+  std::shared_ptr<const Mappings> old = std::atomic_load(&mappings_);
+  std::shared_ptr<Mappings> mappings(new Mappings());
+  load_modules(mappings.get());
+
+  if (keep_tables) {
+    // the perf map keeps what it read and carries on from there
+    if (mappings->perf_map && old->perf_map &&
+        mappings->perf_map->name_ == old->perf_map->name_)
+      mappings->perf_map = old->perf_map;
+
+    // both are sorted by start address
+    auto it = old->modules.begin();
+    for (ModulePtr &mod : mappings->modules) {
+      while (it != old->modules.end() && (*it)->start_ < mod->start_)
+        ++it;
+      if (it != old->modules.end() && (*it)->same_mapping(*mod))
+        mod = *it++;
+    }
+  }
+
+  std::atomic_store(&mappings_, std::shared_ptr<const Mappings>(mappings));
+  last_hit_ = 0;
+  last_check_ms_ = monotonic_ms();
 }
 
-ProcSyms::ProcSyms(int pid) : pid_(pid), procstat_(pid) { load_modules(); }
+void ProcSyms::prefetch() {
+  std::shared_ptr<const Mappings> mappings = std::atomic_load(&mappings_);
+  std::vector<Module *> pending;
+  for (const ModulePtr &mod : mappings->modules)
+    if (!mod->loaded_ && !mod->is_perf_map())
+      pending.push_back(mod.get());
+  if (pending.empty())
+    return;
 
-bool ProcSyms::load_modules() {
-  return bcc_procutils_each_module(pid_, _add_module, this) == 0;
+  // each module is loaded by one thread; the table cache takes care of
+  // modules backed by the same file
+  size_t nthreads = std::thread::hardware_concurrency();
+  if (nthreads > MAX_PREFETCH_THREADS)
+    nthreads = MAX_PREFETCH_THREADS;
+  if (nthreads > pending.size())
+    nthreads = pending.size();
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t i; (i = next++) < pending.size();)
+      pending[i]->load_sym_table();
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < nthreads; ++i)
+    threads.emplace_back(work);
+  work();
+  for (std::thread &t : threads)
+    t.join();
 }
 
 void ProcSyms::refresh() {
-  modules_.clear();
-  load_modules();
-  procstat_.reset();
+  std::lock_guard<std::mutex> lock(reload_mutex_);
+  reload_modules();
+}
+
+// Called after a lookup missed. Returns true if the modules were reloaded,
+// here or by another thread meanwhile, and the lookup is worth retrying.
+bool ProcSyms::check_stale() {
+  uint64_t last = last_check_ms_;
+  if (monotonic_ms() - last < check_interval_ms_)
+    return false;
+  std::lock_guard<std::mutex> lock(reload_mutex_);
+  if (last_check_ms_ == last)
+    reload_modules();
+  return true;
 }
 
-int ProcSyms::_add_module(const char *modname, uint64_t start, uint64_t end,
-                          void *payload) {
-  ProcSyms *ps = static_cast<ProcSyms *>(payload);
-  ps->modules_.emplace_back(modname, start, end);
+int ProcSyms::_add_module(const struct bcc_mapping *map, void *payload) {
+  LoadState *state = static_cast<LoadState *>(payload);
+  ProcSyms *ps = state->ps;
+  if (!strchr(map->perms, 'x') || !map->path[0] || map->path[0] == '[')
+    return 0;
+
+  // a deleted file can still be read through its mapping
+  std::string path = ps->root_ + map->path;
+  if (map->deleted)
+    path = tfm::format("/proc/%d/map_files/%llx-%llx", ps->pid_,
+                       (unsigned long long)map->start,
+                       (unsigned long long)map->end);
+  state->mappings->modules.emplace_back(new Module(
+      map->path, path, map->start, map->end, map->offset, map->inode));
   return 0;
 }
 
-bool ProcSyms::resolve_addr(uint64_t addr, struct bcc_symbol *sym) {
-  if (procstat_.is_stale())
-    refresh();
+ProcSyms::Module *ProcSyms::find_module(const Mappings &mappings,
+                                        uint64_t addr) {
+  const std::vector<ModulePtr> &modules = mappings.modules;
+  size_t hit = last_hit_;
+  if (hit < modules.size()) {
+    Module *mod = modules[hit].get();
+    if (addr >= mod->start_ && addr < mod->end_)
+      return mod;
+  }
 
+  auto it = std::upper_bound(
+      modules.begin(), modules.end(), addr,
+      [](uint64_t a, const ModulePtr &m) { return a < m->start_; });
+  if (it == modules.begin() || addr >= (*--it)->end_)
+    return nullptr;
+  last_hit_ = it - modules.begin();
+  return it->get();
+}
+
+bool ProcSyms::resolve_addr(uint64_t addr, struct bcc_symbol *sym) {
   sym->module = nullptr;
   sym->name = nullptr;
   sym->demangle_name = nullptr;
   sym->offset = 0x0;
 
-  for (Module &mod : modules_) {
-    if (addr >= mod.start_ && addr < mod.end_) {
-      bool res = mod.find_addr(addr, sym);
-      if (sym->name) {
-        sym->demangle_name = abi::__cxa_demangle(sym->name, nullptr, nullptr, nullptr);
-        if (!sym->demangle_name)
-          sym->demangle_name = sym->name;
+  bool res = false;
+  for (int attempt = 0; !res && attempt < 2; ++attempt) {
+    if (attempt && !check_stale())
+      break;
+    std::shared_ptr<const Mappings> mappings = std::atomic_load(&mappings_);
+    Module *mod = find_module(*mappings, addr);
+    if (!mod)
+      mod = mappings->perf_map.get();
+    if (mod)
+      res = mod->find_addr(addr, sym, demangle_);
+  }
+  return res;
+}
+
+size_t ProcSyms::resolve_sorted(const Mappings &mappings, const uint64_t *addrs,
+                                const std::vector<size_t> &order,
+                                struct bcc_symbol *out,
+                                std::vector<size_t> *missed) {
+  const std::vector<ModulePtr> &modules = mappings.modules;
+  size_t resolved = 0, next = 0, cursor = 0;
+  Module *mod = nullptr;
+  bool last_res = false;
+  for (size_t k = 0; k < order.size(); ++k) {
+    size_t i = order[k];
+    uint64_t addr = addrs[i];
+    if (k > 0 && addr == addrs[order[k - 1]]) {
+      out[i] = out[order[k - 1]];
+    } else {
+      while (next < modules.size() && modules[next]->end_ <= addr)
+        ++next;
+      Module *found = next < modules.size() && addr >= modules[next]->start_
+                          ? modules[next].get()
+                          : mappings.perf_map.get();
+      if (found != mod) {
+        mod = found;
+        cursor = 0;
       }
-      return res;
+      out[i] = bcc_symbol();
+      last_res = mod && mod->find_addr(addr, &out[i], demangle_, &cursor, false);
     }
+    if (last_res)
+      ++resolved;
+    else
+      missed->push_back(i);
   }
-  return false;
+  return resolved;
+}
+
+size_t ProcSyms::resolve_batch(const uint64_t *addrs, size_t n,
+                               struct bcc_symbol *out) {
+  std::shared_ptr<const Mappings> mappings = std::atomic_load(&mappings_);
+  std::vector<size_t> order = sorted_order(addrs, n);
+  std::vector<size_t> missed;
+  size_t resolved = resolve_sorted(*mappings, addrs, order, out, &missed);
+  if (missed.empty())
+    return resolved;
+
+  // the misses may be code jitted since the perf maps were read
+  bool updated = false;
+  for (const ModulePtr &mod : mappings->modules)
+    updated |= mod->update_perf_map();
+  if (mappings->perf_map)
+    updated |= mappings->perf_map->update_perf_map();
+
+  // or in mappings added since the last reload, which also drops the modules
+  // of mappings that went away, so the whole batch resolves again
+  if (check_stale()) {
+    missed.clear();
+    mappings = std::atomic_load(&mappings_);
+    return resolve_sorted(*mappings, addrs, order, out, &missed);
+  }
+  if (updated) {
+    std::vector<size_t> retry;
+    retry.swap(missed);
+    resolved += resolve_sorted(*mappings, addrs, retry, out, &missed);
+  }
+  return resolved;
+}
+
+size_t ProcSyms::resolve_source(uint64_t addr,
+                                std::vector<LineTable::Frame> *frames) {
+  frames->clear();
+  std::shared_ptr<const Mappings> mappings = std::atomic_load(&mappings_);
+  Module *mod = find_module(*mappings, addr);
+  return mod ? mod->find_source(addr, frames, demangle_) : 0;
+}
+
+size_t ProcSyms::unwind(const struct bcc_user_regs *regs, const void *stack,
+                        size_t size, uint64_t *ips, size_t max) {
+  const uint8_t *copy = static_cast<const uint8_t *>(stack);
+  // a word of the stack as copied, false for anything outside of the copy
+  auto load = [&](uint64_t addr, uint64_t *value) {
+    uint64_t off = addr - regs->sp;
+    if (addr < regs->sp || off > size || size - off < sizeof(*value))
+      return false;
+    memcpy(value, copy + off, sizeof(*value));
+    return true;
+  };
+
+  std::shared_ptr<const Mappings> mappings = std::atomic_load(&mappings_);
+  uint64_t ip = regs->ip, sp = regs->sp, bp = regs->bp;
+  size_t n = 0;
+  while (n < max && ip) {
+    ips[n++] = ip;
+    // a return address is past its call, which may end the function
+    uint64_t pc = n > 1 ? ip - 1 : ip;
+    Module *mod = find_module(*mappings, pc);
+    if (!mod && n == 1 && check_stale()) {
+      mappings = std::atomic_load(&mappings_);
+      mod = find_module(*mappings, pc);
+    }
+    const UnwindTable *table = mod ? mod->unwind_table() : nullptr;
+
+    UnwindTable::Row row;
+    uint64_t cfa, ra;
+    if (table && table->lookup(pc - mod->bias_, &row)) {
+      // an undefined return address marks the outermost frame
+      if (row.ra != UnwindTable::RULE_OFFSET)
+        break;
+      cfa = (row.cfa == UnwindTable::CFA_SP ? sp : bp) + row.cfa_offset;
+      if (!load(cfa + row.ra_offset, &ra))
+        break;
+      if (row.bp == UnwindTable::RULE_OFFSET && !load(cfa + row.bp_offset, &bp))
+        break;
+    } else {
+      cfa = bp + 16;
+      if (!load(bp + 8, &ra) || !load(bp, &bp))
+        break;
+    }
+    // callers' frames are above their callees', anything else is garbage
+    if (cfa <= sp)
+      break;
+    sp = cfa;
+    ip = ra;
+  }
+  return n;
+}
+
+size_t ProcSyms::memory() const {
+  std::shared_ptr<const Mappings> mappings = std::atomic_load(&mappings_);
+  size_t bytes = sizeof(*this) + sizeof(Mappings) +
+                 mappings->modules.capacity() * sizeof(ModulePtr);
+  for (const ModulePtr &mod : mappings->modules)
+    bytes += sizeof(Module) + mod->memory();
+  if (mappings->perf_map)
+    bytes += sizeof(Module) + mappings->perf_map->memory();
+  return bytes;
 }
 
 bool ProcSyms::resolve_name(const char *module, const char *name,
                             uint64_t *addr) {
-  if (procstat_.is_stale())
-    refresh();
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    if (attempt && !check_stale())
+      break;
+    std::shared_ptr<const Mappings> mappings = std::atomic_load(&mappings_);
+    for (const ModulePtr &mod : mappings->modules) {
+      if (mod->name_ == module)
+        return mod->find_name(name, addr);
+    }
+    if (mappings->perf_map && mappings->perf_map->name_ == module)
+      return mappings->perf_map->find_name(name, addr);
+  }
+  return false;
+}
+
+SymbolTable::SymbolTable()
+    : base_(0), count_(0), arena_p_(nullptr), arena_size_(0),
+      names_p_(nullptr), starts32_p_(nullptr), starts64_p_(nullptr),
+      sizes_p_(nullptr), flags_p_(nullptr), groups_p_(nullptr),
+      segments_p_(nullptr), nsegments_(0), map_(nullptr), map_size_(0) {}
+
+SymbolTable::~SymbolTable() {
+  if (map_)
+    munmap(map_, map_size_);
+}
+
+void SymbolTable::add(const char *name, uint64_t start, uint64_t size,
+                      int flags, const char *group) {
+  uint32_t group_off = 0;
+  if (group) {
+    auto it = pending_groups_.find(group);
+    if (it == pending_groups_.end()) {
+      it = pending_groups_.emplace(group, arena_.size() + 1).first;
+      arena_.insert(arena_.end(), group, group + strlen(group) + 1);
+    }
+    group_off = it->second;
+  }
+
+  size_t len = strlen(name);
+  pending_.push_back({(uint32_t)arena_.size(), start, size, flags, group_off});
+  arena_.insert(arena_.end(), name, name + len + 1);
+}
+
+void SymbolTable::finalize() {
+  std::sort(pending_.begin(), pending_.end());
+  size_t n = pending_.size();
+
+  names_.reserve(n);
+  sizes_.reserve(n);
+  flags_.reserve(n);
+  for (const Pending &p : pending_) {
+    names_.push_back(p.name);
+    sizes_.push_back(std::min<uint64_t>(p.size, UINT32_MAX));
+    flags_.push_back(p.flags);
+  }
+  if (!pending_groups_.empty()) {
+    groups_.reserve(n);
+    for (const Pending &p : pending_)
+      groups_.push_back(p.group);
+  }
+
+  if (n && pending_.back().start - pending_.front().start <= UINT32_MAX) {
+    base_ = pending_.front().start;
+    starts32_.reserve(n);
+    for (const Pending &p : pending_)
+      starts32_.push_back(p.start - base_);
+  } else {
+    starts64_.reserve(n);
+    for (const Pending &p : pending_)
+      starts64_.push_back(p.start);
+  }
+
+  std::vector<Pending>().swap(pending_);
+  pending_groups_.clear();
+  arena_.shrink_to_fit();
+
+  count_ = n;
+  arena_p_ = arena_.data();
+  arena_size_ = arena_.size();
+  names_p_ = names_.data();
+  starts32_p_ = starts32_.empty() ? nullptr : starts32_.data();
+  starts64_p_ = starts64_.empty() ? nullptr : starts64_.data();
+  sizes_p_ = sizes_.data();
+  flags_p_ = flags_.data();
+  groups_p_ = groups_.empty() ? nullptr : groups_.data();
+  segments_p_ = segments_.data();
+  nsegments_ = segments_.size();
+}
+
+void SymbolTable::add_segment(uint64_t offset, uint64_t vaddr, uint64_t size) {
+  segments_.push_back({offset, vaddr, size});
+}
+
+size_t SymbolTable::memory() const {
+  return arena_.capacity() + names_.capacity() * sizeof(uint32_t) +
+         starts32_.capacity() * sizeof(uint32_t) +
+         starts64_.capacity() * sizeof(uint64_t) +
+         sizes_.capacity() * sizeof(uint32_t) + flags_.capacity() +
+         groups_.capacity() * sizeof(uint32_t) +
+         segments_.capacity() * sizeof(Segment) +
+         name_index_.capacity() * sizeof(uint32_t) + map_size_;
+}
+
+// owned by the effective user and writable by nobody else
+static bool private_to_user(const struct stat &st) {
+  return st.st_uid == geteuid() && !(st.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+// Index file: a header, then the arrays of the table each 8 byte aligned.
+// The version changes whenever the layout does.
+struct SymbolIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t wide;
+  uint32_t grouped;
+  uint32_t nsegments;
+  uint64_t count;
+  uint64_t base;
+  uint64_t arena_size;
+};
+
+static const char SYMBOL_INDEX_MAGIC[8] = "BCCSYMS";
+static const uint32_t SYMBOL_INDEX_VERSION = 3;
+
+struct SymbolIndexLayout {
+  size_t segments, names, starts, sizes, flags, groups, arena, total;
+
+  SymbolIndexLayout(uint64_t count, bool wide, bool grouped,
+                    uint64_t nsegments, uint64_t arena_size,
+                    size_t segment_size) {
+    auto align = [](size_t off) { return (off + 7) & ~(size_t)7; };
+    segments = align(sizeof(SymbolIndexHeader));
+    names = align(segments + nsegments * segment_size);
+    starts = align(names + count * sizeof(uint32_t));
+    sizes = align(starts + count * (wide ? sizeof(uint64_t) : sizeof(uint32_t)));
+    flags = align(sizes + count * sizeof(uint32_t));
+    groups = align(flags + count);
+    arena = align(groups + (grouped ? count * sizeof(uint32_t) : 0));
+    total = arena + arena_size;
+  }
+};
+
+bool SymbolTable::save_index(const std::string &path) const {
+  bool wide = starts64_p_ != nullptr || count_ == 0;
+  SymbolIndexHeader hdr = {};
+  memcpy(hdr.magic, SYMBOL_INDEX_MAGIC, sizeof(hdr.magic));
+  hdr.version = SYMBOL_INDEX_VERSION;
+  hdr.wide = wide;
+  hdr.grouped = groups_p_ != nullptr;
+  hdr.nsegments = nsegments_;
+  hdr.count = count_;
+  hdr.base = base_;
+  hdr.arena_size = arena_size_;
+  SymbolIndexLayout layout(count_, wide, hdr.grouped, nsegments_, arena_size_,
+                           sizeof(Segment));
+
+  std::vector<char> buf(layout.total);
+  memcpy(&buf[0], &hdr, sizeof(hdr));
+  memcpy(&buf[layout.segments], segments_p_, nsegments_ * sizeof(Segment));
+  memcpy(&buf[layout.names], names_p_, count_ * sizeof(uint32_t));
+  if (wide)
+    memcpy(&buf[layout.starts], starts64_p_, count_ * sizeof(uint64_t));
+  else
+    memcpy(&buf[layout.starts], starts32_p_, count_ * sizeof(uint32_t));
+  memcpy(&buf[layout.sizes], sizes_p_, count_ * sizeof(uint32_t));
+  memcpy(&buf[layout.flags], flags_p_, count_);
+  if (hdr.grouped)
+    memcpy(&buf[layout.groups], groups_p_, count_ * sizeof(uint32_t));
+  memcpy(&buf[layout.arena], arena_p_, arena_size_);
+
+  // written aside and renamed, readers only ever see complete files
+  std::string tmp = tfm::format("%s.%d.tmp", path, getpid());
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+  if (fd < 0)
+    return false;
+  bool ok = write(fd, buf.data(), buf.size()) == (ssize_t)buf.size();
+  close(fd);
+  if (!ok || rename(tmp.c_str(), path.c_str()) < 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool SymbolTable::load_index(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && private_to_user(st) &&
+      (size_t)st.st_size >= sizeof(SymbolIndexHeader))
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return false;
+
+  const char *p = static_cast<const char *>(map);
+  const SymbolIndexHeader *hdr = reinterpret_cast<const SymbolIndexHeader *>(p);
+  bool ok = !memcmp(hdr->magic, SYMBOL_INDEX_MAGIC, sizeof(hdr->magic)) &&
+            hdr->version == SYMBOL_INDEX_VERSION && hdr->count <= UINT32_MAX &&
+            hdr->arena_size <= UINT32_MAX;
+  SymbolIndexLayout layout(ok ? hdr->count : 0, hdr->wide, hdr->grouped,
+                           ok ? hdr->nsegments : 0, ok ? hdr->arena_size : 0,
+                           sizeof(Segment));
+  ok = ok && layout.total == (size_t)st.st_size &&
+       (hdr->arena_size == 0 || p[layout.arena + hdr->arena_size - 1] == 0);
+
+  const uint32_t *names = reinterpret_cast<const uint32_t *>(p + layout.names);
+  const uint32_t *groups = reinterpret_cast<const uint32_t *>(p + layout.groups);
+  for (size_t i = 0; ok && i < hdr->count; ++i)
+    ok = names[i] < hdr->arena_size &&
+         (!hdr->grouped || groups[i] <= hdr->arena_size);
+  if (!ok) {
+    munmap(map, st.st_size);
+    return false;
+  }
+
+  map_ = map;
+  map_size_ = st.st_size;
+  count_ = hdr->count;
+  base_ = hdr->base;
+  arena_p_ = p + layout.arena;
+  arena_size_ = hdr->arena_size;
+  names_p_ = names;
+  if (hdr->wide)
+    starts64_p_ = reinterpret_cast<const uint64_t *>(p + layout.starts);
+  else
+    starts32_p_ = reinterpret_cast<const uint32_t *>(p + layout.starts);
+  sizes_p_ = reinterpret_cast<const uint32_t *>(p + layout.sizes);
+  flags_p_ = reinterpret_cast<const uint8_t *>(p + layout.flags);
+  groups_p_ = hdr->grouped ? groups : nullptr;
+  segments_p_ = reinterpret_cast<const Segment *>(p + layout.segments);
+  nsegments_ = hdr->nsegments;
+  return true;
+}
+
+ssize_t SymbolTable::find_preceding(uint64_t addr) const {
+  size_t lo = 0, hi = count();
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (start(mid) <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return (ssize_t)lo - 1;
+}
+
+ssize_t SymbolTable::find_preceding(uint64_t addr, size_t from) const {
+  if (from == 0)
+    return find_preceding(addr);
+  // gallop forward from the cursor, then search the last step
+  size_t lo = from, bound = from, step = 1;
+  while (bound < count() && start(bound) <= addr) {
+    lo = bound + 1;
+    bound += step;
+    step <<= 1;
+  }
+  size_t hi = std::min(bound, count());
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (start(mid) <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return (ssize_t)lo - 1;
+}
+
+ssize_t SymbolTable::find_addr(uint64_t addr) const {
+  ssize_t i = find_preceding(addr);
+  if (i >= 0 && addr < start(i) + size(i))
+    return i;
+  return -1;
+}
+
+static uint32_t hash_name(const char *name) {
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  for (; *name; ++name)
+    h = (h ^ (uint8_t)*name) * 16777619u;
+  return h;
+}
 
-  for (Module &mod : modules_) {
-    if (mod.name_ == module)
-      return mod.find_name(name, addr);
+void SymbolTable::build_name_index() const {
+  size_t buckets = 16;
+  while (buckets < count() * 2)
+    buckets <<= 1;
+  name_index_.assign(buckets, 0);
+
+  // in address order, so the first symbol of a name keeps its bucket
+  for (size_t i = 0; i < count(); ++i) {
+    size_t b = hash_name(name(i)) & (buckets - 1);
+    for (; name_index_[b]; b = (b + 1) & (buckets - 1))
+      if (!strcmp(name(name_index_[b] - 1), name(i)))
+        break;
+    if (!name_index_[b])
+      name_index_[b] = i + 1;
+  }
+}
+
+ssize_t SymbolTable::find_name(const char *symname) const {
+  std::call_once(name_index_once_, [this]() { build_name_index(); });
+
+  size_t mask = name_index_.size() - 1;
+  for (size_t b = hash_name(symname) & mask; name_index_[b]; b = (b + 1) & mask) {
+    if (!strcmp(name(name_index_[b] - 1), symname))
+      return name_index_[b] - 1;
+  }
+  return -1;
+}
+
+bool SymbolTable::file_vaddr(uint64_t offset, uint64_t *vaddr) const {
+  for (size_t i = 0; i < nsegments_; ++i) {
+    const Segment &seg = segments_p_[i];
+    if (offset >= seg.offset && offset - seg.offset < seg.size) {
+      *vaddr = seg.vaddr + (offset - seg.offset);
+      return true;
+    }
   }
   return false;
 }
 
-int ProcSyms::Module::_add_symbol(const char *symname, uint64_t start,
-                                  uint64_t end, int flags, void *p) {
-  Module *m = static_cast<Module *>(p);
-  auto res = m->symnames_.emplace(symname);
-  m->syms_.emplace_back(&*(res.first), start, end, flags);
+const LineTable *SymbolTable::lines(const std::string &path) const {
+  std::call_once(lines_once_, [&]() { lines_ = LineTable::load(path); });
+  return lines_.get();
+}
+
+const UnwindTable *SymbolTable::unwind(const std::string &path) const {
+  std::call_once(unwind_once_, [&]() { unwind_ = UnwindTable::load(path); });
+  return unwind_.get();
+}
+
+const char *SymbolTable::store_demangled(const char *name) const {
+  static const size_t BLOCK_SIZE = 64 * 1024;
+  size_t len = strlen(name) + 1;
+  if (len > demangle_block_left_) {
+    size_t size = std::max(len, BLOCK_SIZE);
+    demangle_blocks_.emplace_back(new char[size]);
+    demangle_block_left_ = size;
+    demangle_block_end_ = demangle_blocks_.back().get() + size;
+  }
+  char *dst = demangle_block_end_ - demangle_block_left_;
+  memcpy(dst, name, len);
+  demangle_block_left_ -= len;
+  return dst;
+}
+
+const char *SymbolTable::demangled(size_t i) const {
+  const char *mangled = name(i);
+  if (strncmp(mangled, "_Z", 2))
+    return mangled;
+
+  std::lock_guard<std::mutex> lock(demangle_mutex_);
+  if (demangled_.empty())
+    demangled_.resize(count());
+  if (!demangled_[i]) {
+    char *res = abi::__cxa_demangle(mangled, nullptr, nullptr, nullptr);
+    demangled_[i] = res ? store_demangled(res) : mangled;
+    free(res);
+  }
+  return demangled_[i];
+}
+
+int SymbolTable::_add_symbol(const char *symname, uint64_t start,
+                             uint64_t end, int flags, void *p) {
+  static_cast<SymbolTable *>(p)->add(symname, start, end, flags);
   return 0;
 }
 
-bool ProcSyms::Module::is_so() const {
-  return strstr(name_.c_str(), ".so") != nullptr;
+int SymbolTable::_add_segment(uint64_t offset, uint64_t vaddr, uint64_t size,
+                              void *p) {
+  static_cast<SymbolTable *>(p)->add_segment(offset, vaddr, size);
+  return 0;
 }
 
-bool ProcSyms::Module::is_perf_map() const {
-  return strstr(name_.c_str(), ".map") != nullptr;
+SymbolTableCache::SymbolTableCache() : capacity_(1024) {
+  const char *dir = getenv("BCC_SYMCACHE_DIR");
+  if (dir)
+    index_dir_ = dir;
 }
 
-void ProcSyms::Module::load_sym_table() {
-  if (syms_.size())
-    return;
+SymbolTableCache *SymbolTableCache::instance() {
+  static SymbolTableCache cache;
+  return &cache;
+}
 
-  if (is_perf_map())
-    bcc_perf_map_foreach_sym(name_.c_str(), _add_symbol, this);
-  else
-    bcc_elf_foreach_sym(name_.c_str(), _add_symbol, this);
+void SymbolTableCache::set_index_dir(const std::string &dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  index_dir_ = dir;
+}
 
-  std::sort(syms_.begin(), syms_.end());
+std::string SymbolTableCache::index_path(const std::string &name) {
+  std::string dir;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dir = index_dir_;
+  }
+  if (dir.empty())
+    return dir;
+
+  // create the missing components, private to the user
+  for (size_t pos = 1; pos != std::string::npos; ++pos) {
+    pos = dir.find('/', pos);
+    std::string component = dir.substr(0, pos);
+    if (mkdir(component.c_str(), 0700) < 0 && errno != EEXIST)
+      return std::string();
+    if (pos == std::string::npos)
+      break;
+  }
+  // whoever else can write to the directory could plant index files
+  struct stat st;
+  if (lstat(dir.c_str(), &st) < 0 || !S_ISDIR(st.st_mode) ||
+      !private_to_user(st))
+    return std::string();
+  return dir + "/" + name;
 }
 
-bool ProcSyms::Module::find_name(const char *symname, uint64_t *addr) {
-  load_sym_table();
+// Map the index saved for id if there is one, otherwise parse the ELF file
+// and save an index for the next time.
+std::shared_ptr<SymbolTable> SymbolTableCache::load(struct bcc_elf_file *elf,
+                                                   const std::string &id) {
+  auto table = std::make_shared<SymbolTable>();
+  std::string index;
+  if (!id.empty())
+    index = index_path(id + ".syms");
+  if (!index.empty() && table->load_index(index))
+    return table;
+
+  if (elf) {
+    bcc_elf_file_foreach_sym(elf, SymbolTable::_add_symbol, table.get());
+    bcc_elf_file_foreach_load_segment(elf, SymbolTable::_add_segment,
+                                      table.get());
+  }
+  table->finalize();
+  if (!index.empty() && table->count())
+    table->save_index(index);
+  return table;
+}
+
+std::shared_ptr<const SymbolTable> SymbolTableCache::get(const std::string &path) {
+  struct stat st;
+  bool have_key = stat(path.c_str(), &st) == 0;
+  FileKey key = {};
+  std::promise<std::shared_ptr<const SymbolTable>> loaded;
+  if (have_key) {
+    key = {st.st_dev, st.st_ino, st.st_mtime, st.st_size};
+    std::shared_future<std::shared_ptr<const SymbolTable>> pending;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = index_.find(key);
+      if (it != index_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return it->second->second;
+      }
+      auto lt = loading_.find(key);
+      if (lt != loading_.end())
+        pending = lt->second;
+      else
+        loading_.emplace(key, loaded.get_future().share());
+    }
+    // another thread is parsing the file
+    if (pending.valid())
+      return pending.get();
+  }
+
+  // the same library in another container or overlay is another file with
+  // the same build-id; a stripped file shares the build-id of the original,
+  // the size tells them apart
+  struct bcc_elf_file *elf = bcc_elf_open(path.c_str());
+  char buildid[128];
+  std::string id;
+  if (elf && have_key &&
+      bcc_elf_file_get_buildid(elf, buildid, sizeof(buildid)) == 0)
+    id = tfm::format("%s-%llx", buildid, (long long)st.st_size);
+
+  std::shared_ptr<const SymbolTable> table;
+  if (!id.empty()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = by_buildid_.find(id);
+    if (it != by_buildid_.end())
+      table = it->second.lock();
+  }
+  // parse without holding the lock, a copy of the file loaded meanwhile
+  // under another identity wins
+  if (!table)
+    table = load(elf, id);
+  bcc_elf_close(elf);
+  if (!have_key)
+    return table;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!id.empty()) {
+    auto &known = by_buildid_[id];
+    if (auto existing = known.lock())
+      table = existing;
+    else
+      known = table;
+  }
+  lru_.emplace_front(key, table);
+  index_[key] = lru_.begin();
+  loading_.erase(key);
+  loaded.set_value(table);
+  evict();
+  return table;
+}
 
-  for (Symbol &s : syms_) {
-    if (*(s.name) == symname) {
-      *addr = is_so() ? start_ + s.start : s.start;
+void SymbolTableCache::evict() {
+  while (lru_.size() > capacity_) {
+    index_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+  // tables still referenced by a module stay findable by build-id, forget
+  // the others once there are enough of them
+  if (by_buildid_.size() > 2 * capacity_ + 16) {
+    for (auto it = by_buildid_.begin(); it != by_buildid_.end();) {
+      if (it->second.expired())
+        it = by_buildid_.erase(it);
+      else
+        ++it;
+    }
+  }
+}
+
+void SymbolTableCache::set_capacity(size_t capacity) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  capacity_ = capacity;
+  evict();
+}
+
+size_t SymbolTableCache::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return lru_.size();
+}
+
+const char *PerfMapTable::store_name(const char *name) {
+  static const size_t BLOCK_SIZE = 64 * 1024;
+  size_t len = strlen(name) + 1;
+  if (len > name_block_left_) {
+    size_t size = std::max(len, BLOCK_SIZE);
+    name_blocks_.emplace_back(new char[size]);
+    name_bytes_ += size;
+    name_block_left_ = size;
+    name_block_end_ = name_blocks_.back().get() + size;
+  }
+  char *dst = name_block_end_ - name_block_left_;
+  memcpy(dst, name, len);
+  name_block_left_ -= len;
+  return dst;
+}
+
+size_t PerfMapTable::memory() const {
+  size_t bytes = name_bytes_ + pending_.capacity() * sizeof(Entry);
+  for (const Run &run : runs_)
+    bytes += run.capacity() * sizeof(Entry);
+  return bytes;
+}
+
+int PerfMapTable::_add_symbol(const char *symname, uint64_t start,
+                              uint64_t size, int flags, void *p) {
+  PerfMapTable *t = static_cast<PerfMapTable *>(p);
+  t->pending_.push_back({start, size, t->store_name(symname)});
+  return 0;
+}
+
+PerfMapTable::Run PerfMapTable::merge(const Run &newer, const Run &older) {
+  Run kept;
+  for (const Entry &e : older) {
+    auto it = std::lower_bound(newer.begin(), newer.end(), e);
+    if (it != newer.end() && it->start < e.start + e.size)
+      continue;
+    if (it != newer.begin() && (it - 1)->start + (it - 1)->size > e.start)
+      continue;
+    kept.push_back(e);
+  }
+
+  Run res;
+  res.reserve(newer.size() + kept.size());
+  std::merge(newer.begin(), newer.end(), kept.begin(), kept.end(),
+             std::back_inserter(res));
+  return res;
+}
+
+bool PerfMapTable::update(const std::string &path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0)
+    return false;
+  // rewritten rather than appended to, start over
+  if (st.st_ino != ino_ || (uint64_t)st.st_size < offset_) {
+    runs_.clear();
+    offset_ = 0;
+    ino_ = st.st_ino;
+  }
+  if ((uint64_t)st.st_size == offset_)
+    return false;
+
+  bcc_perf_map_foreach_sym_from(path.c_str(), &offset_, _add_symbol, this);
+  if (pending_.empty())
+    return false;
+
+  // later lines win over earlier ones for the same addresses: take them from
+  // the last and drop those overlapping one already taken
+  std::map<uint64_t, Entry> kept;
+  for (auto it = pending_.rbegin(); it != pending_.rend(); ++it) {
+    auto next = kept.lower_bound(it->start);
+    if (next != kept.end() && next->first < it->start + it->size)
+      continue;
+    if (next != kept.begin()) {
+      auto prev = std::prev(next);
+      if (prev->second.start + prev->second.size > it->start)
+        continue;
+    }
+    kept.emplace_hint(next, it->start, *it);
+  }
+  pending_.clear();
+
+  Run run;
+  run.reserve(kept.size());
+  for (auto &it : kept)
+    run.push_back(it.second);
+
+  runs_.push_back(std::move(run));
+  while (runs_.size() > 1 &&
+         runs_.back().size() * 2 >= runs_[runs_.size() - 2].size()) {
+    Run merged = merge(runs_.back(), runs_[runs_.size() - 2]);
+    runs_.pop_back();
+    runs_.back().swap(merged);
+  }
+  return true;
+}
+
+bool PerfMapTable::shadowed(size_t run, const Entry &e) const {
+  for (++run; run < runs_.size(); ++run) {
+    const Run &r = runs_[run];
+    auto it = std::lower_bound(r.begin(), r.end(), e);
+    if (it != r.end() && it->start < e.start + e.size)
+      return true;
+    if (it != r.begin() && (it - 1)->start + (it - 1)->size > e.start)
+      return true;
+  }
+  return false;
+}
+
+bool PerfMapTable::find_addr(uint64_t addr, const char **name,
+                             uint64_t *start) const {
+  for (size_t run = runs_.size(); run-- > 0;) {
+    const Run &r = runs_[run];
+    auto it = std::upper_bound(r.begin(), r.end(), Entry{addr, 0, nullptr});
+    if (it == r.begin())
+      continue;
+    --it;
+    if (addr < it->start + it->size && !shadowed(run, *it)) {
+      *name = it->name;
+      *start = it->start;
       return true;
     }
   }
   return false;
 }
 
-bool ProcSyms::Module::find_addr(uint64_t addr, struct bcc_symbol *sym) {
-  uint64_t offset = is_so() ? (addr - start_) : addr;
+bool PerfMapTable::find_name(const char *name, uint64_t *addr) const {
+  for (size_t run = runs_.size(); run-- > 0;) {
+    for (const Entry &e : runs_[run]) {
+      if (!strcmp(e.name, name) && !shadowed(run, e)) {
+        *addr = e.start;
+        return true;
+      }
+    }
+  }
+  return false;
+}
 
+bool ProcSyms::Module::is_perf_map() const {
+  return strstr(name_.c_str(), ".map") != nullptr;
+}
+
+bool ProcSyms::Module::same_mapping(const Module &rhs) const {
+  return start_ == rhs.start_ && end_ == rhs.end_ && offset_ == rhs.offset_ &&
+         inode_ == rhs.inode_ && name_ == rhs.name_;
+}
+
+void ProcSyms::Module::load_sym_table() {
+  std::call_once(load_once_, [this]() {
+    // perf maps belong to a single process and keep growing, keep them
+    // private
+    if (is_perf_map()) {
+      std::lock_guard<std::mutex> lock(perf_map_mutex_);
+      perf_map_table_.reset(new PerfMapTable());
+      perf_map_table_->update(name_);
+    } else {
+      table_ = SymbolTableCache::instance()->get(path_);
+      // the mapping starts at offset_ in the file, which the segment holding
+      // it links at vaddr; without segments assume the two are equal
+      uint64_t vaddr;
+      if (!table_->file_vaddr(offset_, &vaddr))
+        vaddr = offset_;
+      bias_ = start_ - vaddr;
+    }
+    loaded_ = true;
+  });
+}
+
+bool ProcSyms::Module::update_perf_map() {
+  if (!loaded_ || !is_perf_map())
+    return false;
+  std::lock_guard<std::mutex> lock(perf_map_mutex_);
+  return perf_map_table_->update(name_);
+}
+
+bool ProcSyms::Module::find_name(const char *symname, uint64_t *addr) {
   load_sym_table();
 
+  if (is_perf_map()) {
+    std::lock_guard<std::mutex> lock(perf_map_mutex_);
+    return perf_map_table_->find_name(symname, addr) ||
+           (perf_map_table_->update(name_) &&
+            perf_map_table_->find_name(symname, addr));
+  }
+
+  ssize_t i = table_->find_name(symname);
+  if (i < 0)
+    return false;
+  *addr = bias_ + table_->start(i);
+  return true;
+}
+
+bool ProcSyms::Module::find_addr(uint64_t addr, struct bcc_symbol *sym,
+                                 bool demangle, size_t *cursor, bool update) {
+  load_sym_table();
+  uint64_t offset = addr - bias_;
+
   sym->module = name_.c_str();
   sym->offset = offset;
 
-  auto it = std::upper_bound(syms_.begin(), syms_.end(), Symbol(nullptr, offset, 0));
-  if (it != syms_.begin())
-    --it;
-  else
-    it = syms_.end();
-
-  if (it != syms_.end()
-      && offset >= it->start && offset < it->start + it->size) {
-    sym->name = it->name->c_str();
-    sym->offset = (offset - it->start);
+  if (is_perf_map()) {
+    std::lock_guard<std::mutex> lock(perf_map_mutex_);
+    const char *name;
+    uint64_t start;
+    // a miss may be code jitted since the last read
+    if (!perf_map_table_->find_addr(offset, &name, &start) &&
+        !(update && perf_map_table_->update(name_) &&
+          perf_map_table_->find_addr(offset, &name, &start)))
+      return false;
+    sym->name = sym->demangle_name = name;
+    sym->offset = offset - start;
     return true;
   }
 
-  return false;
+  ssize_t i = cursor ? table_->find_preceding(offset, *cursor)
+                     : table_->find_preceding(offset);
+  if (i < 0)
+    return false;
+  if (cursor)
+    *cursor = i;
+  if (offset >= table_->start(i) + table_->size(i))
+    return false;
+
+  sym->name = table_->name(i);
+  sym->demangle_name = demangle ? table_->demangled(i) : sym->name;
+  sym->offset = (offset - table_->start(i));
+  return true;
+}
+
+size_t ProcSyms::Module::find_source(uint64_t addr,
+                                     std::vector<LineTable::Frame> *frames,
+                                     bool demangle) {
+  load_sym_table();
+  if (!table_)
+    return 0;
+  const LineTable *lines = table_->lines(path_);
+  uint64_t offset = addr - bias_;
+  if (!lines || !lines->lookup(offset, frames))
+    return 0;
+
+  // the outermost frame is the function the ELF symbol names
+  ssize_t i = table_->find_addr(offset);
+  if (i >= 0)
+    frames->back().function = demangle ? table_->demangled(i) : table_->name(i);
+  return frames->size();
+}
+
+size_t ProcSyms::Module::memory() const {
+  size_t bytes = name_.capacity() + path_.capacity();
+  // what another thread is loading is not counted yet
+  if (!loaded_)
+    return bytes;
+  if (is_perf_map()) {
+    std::lock_guard<std::mutex> lock(perf_map_mutex_);
+    bytes += perf_map_table_->memory();
+  }
+  // the shared cache holds one of the references
+  if (table_)
+    bytes += table_->memory() / std::max(1L, table_.use_count() - 1);
+  return bytes;
+}
+
+const UnwindTable *ProcSyms::Module::unwind_table() {
+  load_sym_table();
+  return table_ ? table_->unwind(path_) : nullptr;
 }
 
 extern "C" {
@@ -225,27 +1457,77 @@ int bcc_symcache_resolve(void *resolver, uint64_t addr,
   return cache->resolve_addr(addr, sym) ? 0 : -1;
 }
 
+int bcc_symcache_resolve_batch(void *resolver, const uint64_t *addrs, size_t n,
+                               struct bcc_symbol *out) {
+  SymbolCache *cache = static_cast<SymbolCache *>(resolver);
+  return cache->resolve_batch(addrs, n, out);
+}
+
+int bcc_symcache_resolve_source(void *resolver, uint64_t addr,
+                                struct bcc_source_frame *frames, int max) {
+  SymbolCache *cache = static_cast<SymbolCache *>(resolver);
+  std::vector<LineTable::Frame> found;
+  cache->resolve_source(addr, &found);
+  int n = std::min((int)found.size(), max);
+  for (int i = 0; i < n; ++i) {
+    frames[i].function = found[i].function;
+    frames[i].file = found[i].file;
+    frames[i].line = found[i].line;
+  }
+  return n;
+}
+
+int bcc_symcache_unwind(void *resolver, const struct bcc_user_regs *regs,
+                        const void *stack, size_t size, uint64_t *ips,
+                        int max) {
+  SymbolCache *cache = static_cast<SymbolCache *>(resolver);
+  return max > 0 ? cache->unwind(regs, stack, size, ips, max) : 0;
+}
+
+size_t bcc_symcache_memory(void *resolver) {
+  SymbolCache *cache = static_cast<SymbolCache *>(resolver);
+  return cache->memory();
+}
+
 int bcc_symcache_resolve_name(void *resolver, const char *name,
                               uint64_t *addr) {
   SymbolCache *cache = static_cast<SymbolCache *>(resolver);
   return cache->resolve_name(nullptr, name, addr) ? 0 : -1;
 }
 
+void bcc_symcache_prefetch(void *resolver) {
+  SymbolCache *cache = static_cast<SymbolCache *>(resolver);
+  cache->prefetch();
+}
+
 void bcc_symcache_refresh(void *resolver) {
   SymbolCache *cache = static_cast<SymbolCache *>(resolver);
   cache->refresh();
 }
 
+void bcc_symcache_set_demangle(void *resolver, int demangle) {
+  SymbolCache *cache = static_cast<SymbolCache *>(resolver);
+  cache->set_demangle(demangle);
+}
+
+void bcc_symcache_set_shared_capacity(size_t tables) {
+  SymbolTableCache::instance()->set_capacity(tables);
+}
+
+void bcc_symcache_set_index_dir(const char *dir) {
+  SymbolTableCache::instance()->set_index_dir(dir ? dir : "");
+}
+
 struct mod_st {
   const char *name;
   uint64_t start;
 };
 
-static int _find_module(const char *modname, uint64_t start, uint64_t end,
-                        void *p) {
+// the lowest mapping of a shared object holds its start, which it links at 0
+static int _find_module(const struct bcc_mapping *map, void *p) {
   struct mod_st *mod = (struct mod_st *)p;
-  if (!strcmp(modname, mod->name)) {
-    mod->start = start;
+  if (!strcmp(map->path, mod->name)) {
+    mod->start = map->start - map->offset;
     return -1;
   }
   return 0;
@@ -254,7 +1536,7 @@ static int _find_module(const char *modname, uint64_t start, uint64_t end,
 int bcc_resolve_global_addr(int pid, const char *module, const uint64_t address,
                             uint64_t *global) {
   struct mod_st mod = {module, 0x0};
-  if (bcc_procutils_each_module(pid, _find_module, &mod) < 0 ||
+  if (bcc_procutils_each_mapping(pid, _find_module, &mod) < 0 ||
       mod.start == 0x0)
     return -1;
 
@@ -303,6 +1585,49 @@ int bcc_foreach_symbol(const char *module, SYM_CB cb) {
   return bcc_elf_foreach_sym(module, _list_sym, (void *)cb);
 }
 
+int bcc_foreach_symbol_match(const char *module, const char **patterns,
+                             int npatterns, int flags, SYM_MATCH_CB cb,
+                             void *payload) {
+  if (module == 0 || cb == 0 || npatterns < 0 || access(module, R_OK) < 0)
+    return -1;
+
+  std::vector<regex_t> regs;
+  if (flags & BCC_SYM_MATCH_REGEX) {
+    regs.resize(npatterns);
+    for (int i = 0; i < npatterns; ++i) {
+      if (regcomp(&regs[i], patterns[i], REG_EXTENDED | REG_NOSUB)) {
+        fprintf(stderr, "invalid symbol regex: %s\n", patterns[i]);
+        regs.resize(i);
+        for (regex_t &r : regs)
+          regfree(&r);
+        return -1;
+      }
+    }
+  }
+
+  std::shared_ptr<const SymbolTable> table =
+      SymbolTableCache::instance()->get(module);
+  int rc = 0;
+  for (size_t s = 0; s < table->count(); ++s) {
+    if (!ELF_TYPE_IS_FUNCTION(table->flags(s)) || table->start(s) == 0)
+      continue;
+    const char *name = table->name(s);
+    for (int i = 0; i < npatterns && rc == 0; ++i) {
+      bool match = (flags & BCC_SYM_MATCH_REGEX)
+                       ? regexec(&regs[i], name, 0, NULL, 0) == 0
+                       : fnmatch(patterns[i], name, 0) == 0;
+      if (match)
+        rc = cb(name, table->start(s), i, payload);
+    }
+    if (rc)
+      break;
+  }
+
+  for (regex_t &r : regs)
+    regfree(&r);
+  return rc < 0 ? rc : 0;
+}
+
 int bcc_resolve_symname(const char *module, const char *symname,
                         const uint64_t addr, struct bcc_symbol *sym) {
   uint64_t load_addr;
@@ -323,7 +1648,9 @@ int bcc_resolve_symname(const char *module, const char *symname,
   if (sym->module == NULL)
     return -1;
 
-  if (bcc_elf_loadaddr(sym->module, &load_addr) < 0) {
+  struct bcc_elf_file *elf = bcc_elf_open(sym->module);
+  if (!elf || bcc_elf_file_loadaddr(elf, &load_addr) < 0) {
+    bcc_elf_close(elf);
     sym->module = NULL;
     return -1;
   }
@@ -331,12 +1658,12 @@ int bcc_resolve_symname(const char *module, const char *symname,
   sym->name = symname;
   sym->offset = addr;
 
-  if (sym->name && sym->offset == 0x0) {
-    if (bcc_find_symbol_addr(sym) < 0)
-      return -1;
-  }
+  int res = 0;
+  if (sym->name && sym->offset == 0x0)
+    res = bcc_elf_file_foreach_sym(elf, _find_sym, sym);
+  bcc_elf_close(elf);
 
-  if (sym->offset == 0x0)
+  if (res < 0 || sym->offset == 0x0)
     return -1;
 
   sym->offset = (sym->offset - load_addr);
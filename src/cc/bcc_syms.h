@@ -20,6 +20,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 struct bcc_symbol {
@@ -29,18 +30,81 @@ struct bcc_symbol {
   uint64_t offset;
 };
 
+// one frame of the source of an address; function is NULL where no symbol
+// names it, file is NULL and line 0 where the line is unknown
+struct bcc_source_frame {
+  const char *function;
+  const char *file;
+  int line;
+};
+
+// registers a user stack is unwound from, as a struct bpf_user_stack of the
+// BPF program holds them
+struct bcc_user_regs {
+  uint64_t ip;
+  uint64_t sp;
+  uint64_t bp;
+};
+
 typedef int(* SYM_CB)(const char *symname, uint64_t addr);
+// pattern is the index of the pattern that matched symname
+typedef int(* SYM_MATCH_CB)(const char *symname, uint64_t addr, int pattern,
+                            void *payload);
+
+// patterns of bcc_foreach_symbol_match are shell globs unless REGEX is set,
+// in which case they are POSIX extended regexes matching anywhere in the name
+#define BCC_SYM_MATCH_REGEX 0x1
 
+// A symcache can be used from several threads at once. A lookup may reload
+// the mappings, which invalidates the names of earlier results in mappings
+// that went away.
 void *bcc_symcache_new(int pid);
 void bcc_free_symcache(void *symcache, int pid);
 
 int bcc_symcache_resolve(void *symcache, uint64_t addr, struct bcc_symbol *sym);
+// resolve n addresses into out[0..n), an unresolved entry has a NULL name;
+// returns the number of addresses resolved
+int bcc_symcache_resolve_batch(void *symcache, const uint64_t *addrs, size_t n,
+                               struct bcc_symbol *out);
+// source frames of addr from the DWARF of its module, innermost inlined call
+// first; returns the number written to frames, at most max, 0 without debug
+// info
+int bcc_symcache_resolve_source(void *symcache, uint64_t addr,
+                                struct bcc_source_frame *frames, int max);
+// Unwind a user stack sampled without frame pointers, from its registers and
+// a copy of size bytes of the stack from regs->sp up, with the .eh_frame and
+// .debug_frame of the modules of the process. Writes at most max return
+// addresses to ips, innermost first, and returns how many; they resolve like
+// the addresses of a stack trace map.
+int bcc_symcache_unwind(void *symcache, const struct bcc_user_regs *regs,
+                        const void *stack, size_t size, uint64_t *ips,
+                        int max);
 int bcc_symcache_resolve_name(void *resolver, const char *name, uint64_t *addr);
+// load the symbol tables of every module of the process in parallel, instead
+// of one at a time as lookups first reach them
+void bcc_symcache_prefetch(void *resolver);
 void bcc_symcache_refresh(void *resolver);
+// resolve returns C++ names demangled, on by default
+void bcc_symcache_set_demangle(void *resolver, int demangle);
+// bytes held by symcache, counting the symbol tables it shares with other
+// symcaches for their share
+size_t bcc_symcache_memory(void *resolver);
+// max number of ELF symbol tables kept in the cache shared by all symcaches
+void bcc_symcache_set_shared_capacity(size_t tables);
+// directory where parsed symbol tables are saved to be mapped on later runs,
+// NULL or "" to neither read nor write them; $BCC_SYMCACHE_DIR by default,
+// none if unset. Ignored unless it belongs to the effective user and nobody
+// else can write to it
+void bcc_symcache_set_index_dir(const char *dir);
 
 int bcc_resolve_global_addr(int pid, const char *module, const uint64_t address,
                             uint64_t *global);
 int bcc_foreach_symbol(const char *module, SYM_CB cb);
+// walk the function symbols of module once, calling cb for each pattern that
+// matches; a non-zero return from cb stops the walk
+int bcc_foreach_symbol_match(const char *module, const char **patterns,
+                             int npatterns, int flags, SYM_MATCH_CB cb,
+                             void *payload);
 int bcc_find_symbol_addr(struct bcc_symbol *sym);
 int bcc_resolve_symname(const char *module, const char *symname,
                         const uint64_t addr, struct bcc_symbol *sym);
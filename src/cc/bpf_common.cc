@@ -86,6 +86,26 @@ size_t bpf_function_size_id(void *program, size_t id) {
   return mod->function_size(id);
 }
 
+int bpf_function_load_parts(void *program, const char *name, int prog_type,
+                            char *log_buf, unsigned log_buf_size) {
+  auto mod = static_cast<ebpf::BPFModule *>(program);
+  if (!mod) return -1;
+  return mod->load_function_parts(name, prog_type, log_buf, log_buf_size);
+}
+
+void bpf_function_unload_parts(void *program, const char *name) {
+  auto mod = static_cast<ebpf::BPFModule *>(program);
+  if (!mod) return;
+  mod->unload_function_parts(name);
+}
+
+int bpf_function_stats(void *program, const char *name, int prog_fd,
+                       uint64_t *run_cnt, uint64_t *run_time_ns) {
+  auto mod = static_cast<ebpf::BPFModule *>(program);
+  if (!mod) return -1;
+  return mod->function_stats(name, prog_fd, run_cnt, run_time_ns);
+}
+
 char * bpf_module_license(void *program) {
   auto mod = static_cast<ebpf::BPFModule *>(program);
   if (!mod) return nullptr;
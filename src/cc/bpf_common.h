@@ -36,6 +36,12 @@ void * bpf_function_start_id(void *program, size_t id);
 void * bpf_function_start(void *program, const char *name);
 size_t bpf_function_size_id(void *program, size_t id);
 size_t bpf_function_size(void *program, const char *name);
+int bpf_function_load_parts(void *program, const char *name, int prog_type,
+                            char *log_buf, unsigned log_buf_size);
+// release the parts loaded for name, when loading its first part failed
+void bpf_function_unload_parts(void *program, const char *name);
+int bpf_function_stats(void *program, const char *name, int prog_fd,
+                       uint64_t *run_cnt, uint64_t *run_time_ns);
 size_t bpf_num_tables(void *program);
 size_t bpf_table_id(void *program, const char *table_name);
 int bpf_table_fd(void *program, const char *table_name);
@@ -14,10 +14,13 @@
  * limitations under the License.
  */
 #include <algorithm>
+#include <errno.h>
 #include <fcntl.h>
 #include <ftw.h>
 #include <map>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <sys/stat.h>
 #include <sys/utsname.h>
@@ -53,6 +56,7 @@
 #include "kbuild_helper.h"
 #include "shared_table.h"
 #include "libbpf.h"
+#include "prog_split.h"
 
 namespace ebpf {
 
@@ -113,6 +117,11 @@ BPFModule::BPFModule(unsigned flags)
 }
 
 BPFModule::~BPFModule() {
+  for (auto &it : split_functions_) {
+    for (int fd : it.second.fds)
+      close(fd);
+    close(it.second.prog_array_fd);
+  }
   engine_.reset();
   rw_engine_.reset();
   ctx_.reset();
@@ -325,7 +334,7 @@ unique_ptr<ExecutionEngine> BPFModule::finalize_rw(unique_ptr<Module> m) {
 // load an entire c file as a module
 int BPFModule::load_cfile(const string &file, bool in_memory, const char *cflags[], int ncflags) {
   clang_loader_ = make_unique<ClangLoader>(&*ctx_, flags_);
-  if (clang_loader_->parse(&mod_, &tables_, file, in_memory, cflags, ncflags))
+  if (clang_loader_->parse(&mod_, &tables_, &stats_slots_, file, in_memory, cflags, ncflags))
     return -1;
   return 0;
 }
@@ -337,7 +346,7 @@ int BPFModule::load_cfile(const string &file, bool in_memory, const char *cflags
 // build an ExecutionEngine.
 int BPFModule::load_includes(const string &text) {
   clang_loader_ = make_unique<ClangLoader>(&*ctx_, flags_);
-  if (clang_loader_->parse(&mod_, &tables_, text, true, nullptr, 0))
+  if (clang_loader_->parse(&mod_, &tables_, &stats_slots_, text, true, nullptr, 0))
     return -1;
   return 0;
 }
@@ -442,6 +451,49 @@ int BPFModule::finalize() {
     if (!strncmp(FN_PREFIX.c_str(), section.first.c_str(), FN_PREFIX.size()))
       function_names_.push_back(section.first);
 
+  return split_functions();
+}
+
+// Functions over BPF_MAXINSNS are cut into parts chained through a prog array.
+// The section of the function is pointed at the first part, the remaining
+// parts are loaded by load_function_parts() before the first one.
+// The kernel follows at most MAX_TAIL_CALL_CNT tail calls in a row and then
+// falls through, so a longer chain would run truncated.
+static const size_t MAX_TAIL_CALL_CNT = 32;
+
+int BPFModule::split_functions() {
+  for (auto &name : function_names_) {
+    auto &section = sections_[name];
+    size_t insn_cnt = get<1>(section) / sizeof(struct bpf_insn);
+    if (insn_cnt <= BPF_MAXINSNS)
+      continue;
+
+    ProgSplitter splitter((const struct bpf_insn *)get<0>(section), insn_cnt, BPF_MAXINSNS);
+    // loaded whole, the function would only fail later in the verifier
+    if (!splitter.find_cuts()) {
+      fprintf(stderr, "%s: %zu insns, over the limit of %d, and no safe point "
+              "to split it at\n", name.c_str() + FN_PREFIX.size(), insn_cnt,
+              BPF_MAXINSNS);
+      return -1;
+    }
+    if (splitter.num_parts() > MAX_TAIL_CALL_CNT + 1) {
+      fprintf(stderr, "%s: %zu insns split into %zu parts, more than the %zu "
+              "the kernel chains with tail calls\n", name.c_str() + FN_PREFIX.size(),
+              insn_cnt, splitter.num_parts(), MAX_TAIL_CALL_CNT + 1);
+      return -1;
+    }
+    int fd = bpf_create_map(BPF_MAP_TYPE_PROG_ARRAY, sizeof(int), sizeof(int), splitter.num_parts());
+    if (fd < 0) {
+      fprintf(stderr, "%s: could not create prog array for split: %s\n",
+              name.c_str() + FN_PREFIX.size(), strerror(errno));
+      return -1;
+    }
+    FunctionParts &fp = split_functions_[name];
+    fp.prog_array_fd = fd;
+    splitter.build(fd, &fp.parts);
+    section = make_tuple((uint8_t *)fp.parts[0].data(),
+                         fp.parts[0].size() * sizeof(struct bpf_insn));
+  }
   return 0;
 }
 
@@ -481,6 +533,103 @@ size_t BPFModule::function_size(size_t id) const {
   return get<1>(section->second);
 }
 
+int BPFModule::load_function_parts(const string &name, int prog_type, char *log_buf,
+                                   unsigned log_buf_size) {
+  auto it = split_functions_.find(FN_PREFIX + name);
+  if (it == split_functions_.end())
+    return 0;
+  FunctionParts &fp = it->second;
+  if (!fp.fds.empty())
+    return 0;
+
+  for (size_t k = 1; k < fp.parts.size(); ++k) {
+    int fd = bpf_prog_load((enum bpf_prog_type)prog_type, fp.parts[k].data(),
+                           fp.parts[k].size() * sizeof(struct bpf_insn), license(),
+                           kern_version(), log_buf, log_buf_size);
+    if (fd < 0)
+      goto error;
+    fp.fds.push_back(fd);
+    int key = k;
+    if (bpf_update_elem(fp.prog_array_fd, &key, &fd, 0) < 0)
+      goto error;
+  }
+  return 0;
+
+error:
+  unload_function_parts(name);
+  return -1;
+}
+
+// the prog array holds a reference to each part, drop both
+void BPFModule::unload_function_parts(const string &name) {
+  auto it = split_functions_.find(FN_PREFIX + name);
+  if (it == split_functions_.end())
+    return;
+  FunctionParts &fp = it->second;
+  for (size_t k = 1; k <= fp.fds.size(); ++k) {
+    int key = k;
+    bpf_delete_elem(fp.prog_array_fd, &key);
+    close(fp.fds[k - 1]);
+  }
+  fp.fds.clear();
+}
+
+static int num_possible_cpus() {
+  char buf[256];
+  FILE *f = fopen("/sys/devices/system/cpu/possible", "r");
+  if (!f)
+    return -1;
+  if (!fgets(buf, sizeof(buf), f)) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  // ranges like 0-3,5,7-8
+  int n = 0;
+  for (char *p = buf; *p && *p != '\n';) {
+    char *end;
+    long lo = strtol(p, &end, 10), hi = lo;
+    if (end == p)
+      return -1;
+    if (*end == '-')
+      hi = strtol(end + 1, &end, 10);
+    n += hi - lo + 1;
+    p = *end == ',' ? end + 1 : end;
+  }
+  return n;
+}
+
+// Prefer the kernel's own accounting, fall back to the bcc_prog_stats table of
+// a module built with DEBUG_PROG_STATS, in the slot the rewriter gave the
+// function.
+int BPFModule::function_stats(const string &name, int prog_fd, uint64_t *run_cnt,
+                              uint64_t *run_time_ns) {
+  if (prog_fd >= 0 && bpf_prog_get_stats(prog_fd, run_cnt, run_time_ns) == 0)
+    return 0;
+
+  if (!stats_slots_)
+    return -1;
+  auto slot = stats_slots_->find(name);
+  auto table = table_names_.find("bcc_prog_stats");
+  if (slot == stats_slots_->end() || table == table_names_.end())
+    return -1;
+  int ncpus = num_possible_cpus();
+  if (ncpus <= 0)
+    return -1;
+
+  int key = slot->second;
+  vector<uint64_t> leaves(2 * ncpus);
+  if (bpf_lookup_elem((*tables_)[table->second].fd, &key, leaves.data()) < 0)
+    return -1;
+  *run_cnt = *run_time_ns = 0;
+  for (int i = 0; i < ncpus; ++i) {
+    *run_cnt += leaves[2 * i];
+    *run_time_ns += leaves[2 * i + 1];
+  }
+  return 0;
+}
+
 size_t BPFModule::function_size(const string &name) const {
   auto section = sections_.find(FN_PREFIX + name);
   if (section == sections_.end())
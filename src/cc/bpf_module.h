@@ -22,6 +22,8 @@
 #include <string>
 #include <vector>
 
+struct bpf_insn;
+
 namespace llvm {
 class ExecutionEngine;
 class Function;
@@ -51,6 +53,7 @@ class BPFModule {
   int load_cfile(const std::string &file, bool in_memory, const char *cflags[], int ncflags);
   int kbuild_flags(const char *uname_release, std::vector<std::string> *cflags);
   int run_pass_manager(llvm::Module &mod);
+  int split_functions();
  public:
   BPFModule(unsigned flags);
   ~BPFModule();
@@ -63,6 +66,11 @@ class BPFModule {
   const char * function_name(size_t id) const;
   size_t function_size(size_t id) const;
   size_t function_size(const std::string &name) const;
+  int load_function_parts(const std::string &name, int prog_type, char *log_buf,
+                          unsigned log_buf_size);
+  void unload_function_parts(const std::string &name);
+  int function_stats(const std::string &name, int prog_fd, uint64_t *run_cnt,
+                     uint64_t *run_time_ns);
   size_t num_tables() const;
   size_t table_id(const std::string &name) const;
   int table_fd(size_t id) const;
@@ -100,8 +108,17 @@ class BPFModule {
   std::unique_ptr<std::vector<TableDesc>> tables_;
   std::map<std::string, size_t> table_names_;
   std::vector<std::string> function_names_;
+  // bcc_prog_stats slot of each instrumented function
+  std::unique_ptr<std::map<std::string, int>> stats_slots_;
   std::map<llvm::Type *, llvm::Function *> readers_;
   std::map<llvm::Type *, llvm::Function *> writers_;
+  // functions too large for a single program, chained with tail calls
+  struct FunctionParts {
+    int prog_array_fd;
+    std::vector<std::vector<struct bpf_insn>> parts;
+    std::vector<int> fds;
+  };
+  std::map<std::string, FunctionParts> split_functions_;
 };
 
 }  // namespace ebpf
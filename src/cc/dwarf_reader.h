@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Cursor over little endian DWARF data. Reads past the end return 0 and clear
+// ok(), so a parser can read a whole record and check once.
+class DwarfReader {
+  const uint8_t *begin_;
+  const uint8_t *p_;
+  const uint8_t *end_;
+  bool ok_;
+
+  template <typename T> T fixed() {
+    T v = 0;
+    if ((size_t)(end_ - p_) < sizeof(T)) {
+      ok_ = false;
+      p_ = end_;
+      return 0;
+    }
+    memcpy(&v, p_, sizeof(T));
+    p_ += sizeof(T);
+    return v;
+  }
+
+public:
+  DwarfReader() : begin_(nullptr), p_(nullptr), end_(nullptr), ok_(false) {}
+  DwarfReader(const void *data, size_t size)
+      : begin_(static_cast<const uint8_t *>(data)), p_(begin_),
+        end_(begin_ + size), ok_(data != nullptr) {}
+
+  bool ok() const { return ok_; }
+  bool done() const { return p_ >= end_; }
+  size_t offset() const { return p_ - begin_; }
+  size_t left() const { return end_ - p_; }
+  const uint8_t *data() const { return p_; }
+
+  void seek(size_t off) {
+    if (off > (size_t)(end_ - begin_)) {
+      ok_ = false;
+      off = end_ - begin_;
+    }
+    p_ = begin_ + off;
+  }
+  void skip(uint64_t n) {
+    if (n > (uint64_t)(end_ - p_)) {
+      ok_ = false;
+      n = end_ - p_;
+    }
+    p_ += n;
+  }
+  // a reader over the next n bytes, which this one skips
+  DwarfReader sub(uint64_t n) {
+    if (n > (uint64_t)(end_ - p_)) {
+      ok_ = false;
+      n = end_ - p_;
+    }
+    DwarfReader r(p_, n);
+    p_ += n;
+    return r;
+  }
+
+  uint8_t u8() { return fixed<uint8_t>(); }
+  uint16_t u16() { return fixed<uint16_t>(); }
+  uint32_t u24() {
+    uint32_t lo = u16();
+    return lo | (uint32_t)u8() << 16;
+  }
+  uint32_t u32() { return fixed<uint32_t>(); }
+  uint64_t u64() { return fixed<uint64_t>(); }
+  uint64_t sized(size_t size) {
+    switch (size) {
+    case 1: return u8();
+    case 2: return u16();
+    case 4: return u32();
+    case 8: return u64();
+    }
+    ok_ = false;
+    return 0;
+  }
+  // a section offset, 8 bytes in 64-bit DWARF
+  uint64_t offset(bool dwarf64) { return dwarf64 ? u64() : u32(); }
+
+  uint64_t uleb() {
+    uint64_t v = 0;
+    for (unsigned shift = 0; p_ < end_; shift += 7) {
+      uint8_t b = *p_++;
+      if (shift < 64)
+        v |= (uint64_t)(b & 0x7f) << shift;
+      if (!(b & 0x80))
+        return v;
+    }
+    ok_ = false;
+    return v;
+  }
+  int64_t sleb() {
+    uint64_t v = 0;
+    unsigned shift = 0;
+    while (p_ < end_) {
+      uint8_t b = *p_++;
+      if (shift < 64)
+        v |= (uint64_t)(b & 0x7f) << shift;
+      shift += 7;
+      if (!(b & 0x80)) {
+        if (shift < 64 && (b & 0x40))
+          v |= ~(uint64_t)0 << shift;
+        return (int64_t)v;
+      }
+    }
+    ok_ = false;
+    return (int64_t)v;
+  }
+  const char *cstr() {
+    const uint8_t *nul =
+        static_cast<const uint8_t *>(memchr(p_, 0, end_ - p_));
+    if (!nul) {
+      ok_ = false;
+      p_ = end_;
+      return "";
+    }
+    const char *s = reinterpret_cast<const char *>(p_);
+    p_ = nul + 1;
+    return s;
+  }
+
+  // the unit length that starts DWARF units and CIEs, which also tells 32
+  // from 64-bit DWARF
+  uint64_t initial_length(bool *dwarf64) {
+    uint64_t len = u32();
+    *dwarf64 = len == 0xffffffff;
+    if (*dwarf64)
+      len = u64();
+    return len;
+  }
+};
@@ -438,6 +438,7 @@ int bpf_usdt_readarg_p(int argc, struct pt_regs *ctx, void *buf, u64 len) asm("l
 #define PT_REGS_RC(ctx)		((ctx)->gpr[3])
 #define PT_REGS_IP(ctx)		((ctx)->nip)
 #define PT_REGS_SP(ctx)		((ctx)->sp)
+#define PT_REGS_FP(ctx)		((ctx)->gpr[31])
 #elif defined(__x86_64__)
 #define PT_REGS_PARM1(ctx)	((ctx)->di)
 #define PT_REGS_PARM2(ctx)	((ctx)->si)
@@ -448,10 +449,70 @@ int bpf_usdt_readarg_p(int argc, struct pt_regs *ctx, void *buf, u64 len) asm("l
 #define PT_REGS_RC(ctx)		((ctx)->ax)
 #define PT_REGS_IP(ctx)		((ctx)->ip)
 #define PT_REGS_SP(ctx)		((ctx)->sp)
+#define PT_REGS_FP(ctx)		((ctx)->bp)
 #else
 #error "bcc does not support this platform yet"
 #endif
 
+/* A user stack sampled for unwinding in user space, for code built without
+ * frame pointers, where get_stackid(ctx, BPF_F_USER_STACK) stops after a
+ * frame or two: the registers and up to BPF_USER_STACK_SIZE bytes of the
+ * stack from sp up, which BPF.unwind_user_stack() turns into a stack with the
+ * .eh_frame and .debug_frame of the binaries. Too large for the BPF stack,
+ * it is filled in a per-cpu array and submitted to a BPF_PERF_OUTPUT:
+ *
+ *   BPF_TABLE("percpu_array", int, struct bpf_user_stack, scratch, 1);
+ *   BPF_PERF_OUTPUT(stacks);
+ *   int on_sample(struct pt_regs *ctx) {
+ *     int zero = 0;
+ *     struct bpf_user_stack *s = scratch.lookup(&zero);
+ *     if (s && bpf_user_stack_sample(s, ctx) > 0)
+ *       stacks.perf_submit(ctx, s, sizeof(*s));
+ *     return 0;
+ *   }
+ */
+#ifndef BPF_USER_STACK_SIZE
+#define BPF_USER_STACK_SIZE 4096
+#endif
+#define BPF_USER_STACK_CHUNK 512
+
+struct bpf_user_stack {
+  u32 pid;
+  // bytes of stack copied, a multiple of BPF_USER_STACK_CHUNK
+  u32 size;
+  u64 ip;
+  u64 sp;
+  u64 bp;
+  u8 stack[BPF_USER_STACK_SIZE];
+};
+
+/* Fill s from user registers, see bpf_user_stack_sample(). The stack is
+ * copied a chunk at a time up to the first that cannot be read, past the top
+ * of the stack. Returns the number of bytes of the stack copied.
+ */
+static inline __attribute__((always_inline))
+int bpf_user_stack_read(struct bpf_user_stack *s, u64 ip, u64 sp, u64 bp) {
+  s->pid = bpf_get_current_pid_tgid() >> 32;
+  s->ip = ip;
+  s->sp = sp;
+  s->bp = bp;
+  s->size = 0;
+#pragma unroll
+  for (int i = 0; i < BPF_USER_STACK_SIZE / BPF_USER_STACK_CHUNK; ++i) {
+    if (bpf_probe_read(s->stack + i * BPF_USER_STACK_CHUNK,
+                       BPF_USER_STACK_CHUNK,
+                       (void *)(sp + i * BPF_USER_STACK_CHUNK)) < 0)
+      break;
+    s->size += BPF_USER_STACK_CHUNK;
+  }
+  return s->size;
+}
+
+/* regs must be user registers, as those of a uprobe or of a perf event that
+ * interrupted user code */
+#define bpf_user_stack_sample(s, regs) \
+  bpf_user_stack_read(s, PT_REGS_IP(regs), PT_REGS_SP(regs), PT_REGS_FP(regs))
+
 #define lock_xadd(ptr, val) ((void)__sync_fetch_and_add(ptr, val))
 
 #define TRACEPOINT_PROBE(category, event) \
@@ -13,6 +13,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <linux/bpf.h>
 #include <linux/version.h>
 #include <sys/utsname.h>
@@ -257,16 +258,26 @@ DiagnosticBuilder ProbeVisitor::error(SourceLocation loc, const char (&fmt)[N])
 }
 
 
-BTypeVisitor::BTypeVisitor(ASTContext &C, Rewriter &rewriter, vector<TableDesc> &tables)
-    : C(C), diag_(C.getDiagnostics()), rewriter_(rewriter), out_(llvm::errs()), tables_(tables) {
+BTypeVisitor::BTypeVisitor(ASTContext &C, Rewriter &rewriter, vector<TableDesc> &tables,
+                           map<string, int> *stats_slots)
+    : C(C), diag_(C.getDiagnostics()), rewriter_(rewriter), out_(llvm::errs()), tables_(tables),
+      stats_slots_(stats_slots), stats_fn_(false) {
 }
 
 bool BTypeVisitor::VisitFunctionDecl(FunctionDecl *D) {
   // put each non-static non-inline function decl in its own section, to be
   // extracted by the MemoryManager
   auto real_start_loc = rewriter_.getSourceMgr().getFileLoc(D->getLocStart());
+  bool in_main_file = rewriter_.getSourceMgr().getFileID(real_start_loc)
+      == rewriter_.getSourceMgr().getMainFileID();
+  stats_fn_ = false;
   if (D->isExternallyVisible() && D->hasBody()) {
     current_fn_ = D->getName();
+    if (in_main_file)
+      fn_names_.push_back(current_fn_);
+    // a void function can not be loaded anyway, so only returns with a value
+    // need to be accounted
+    stats_fn_ = stats_slots_ && in_main_file && !D->getReturnType()->isVoidType();
     string attr = string("__attribute__((section(\"") + BPF_FN_PREFIX + D->getName().str() + "\")))\n";
     rewriter_.InsertText(real_start_loc, attr);
     if (D->param_size() > MAX_CALLING_CONV_REGS + 1) {
@@ -277,6 +288,8 @@ bool BTypeVisitor::VisitFunctionDecl(FunctionDecl *D) {
     // remember the arg names of the current function...first one is the ctx
     fn_args_.clear();
     string preamble = "{";
+    if (stats_fn_)
+      preamble += " u64 __bcc_ts = bpf_ktime_get_ns();";
     for (auto arg_it = D->param_begin(); arg_it != D->param_end(); arg_it++) {
       auto arg = *arg_it;
       if (arg->getName() == "") {
@@ -306,15 +319,74 @@ bool BTypeVisitor::VisitFunctionDecl(FunctionDecl *D) {
     // for each trace argument, convert the variable from ptregs to something on stack
     if (CompoundStmt *S = dyn_cast<CompoundStmt>(D->getBody()))
       rewriter_.ReplaceText(S->getLBracLoc(), 1, preamble);
-  } else if (D->hasBody() &&
-             rewriter_.getSourceMgr().getFileID(real_start_loc)
-               == rewriter_.getSourceMgr().getMainFileID()) {
+  } else if (D->hasBody() && in_main_file) {
     // rewritable functions that are static should be always treated as helper
     rewriter_.InsertText(real_start_loc, "__attribute__((always_inline))\n");
   }
   return true;
 }
 
+// With DEBUG_PROG_STATS, account the time since entry on each return:
+//  return x;
+// to:
+//  return ({ int __bcc_ret = (x); __bcc_prog_stats_record(slot, __bcc_ts); __bcc_ret; });
+bool BTypeVisitor::VisitReturnStmt(ReturnStmt *R) {
+  if (!stats_fn_ || !R->getRetValue())
+    return true;
+  Expr *E = R->getRetValue();
+  if (!rewriter_.isRewritable(E->getLocStart()) || !rewriter_.isRewritable(E->getLocEnd()))
+    return true;
+  string type = E->getType().getUnqualifiedType().getAsString();
+  rewriter_.InsertTextBefore(E->getLocStart(), "({ " + type + " __bcc_ret = (");
+  rewriter_.InsertTextAfterToken(E->getLocEnd(), "); __bcc_prog_stats_record(__bcc_stats_slot_" +
+                                 current_fn_ + ", __bcc_ts); __bcc_ret; })");
+  return true;
+}
+
+// Create the per-cpu table of run counts and times for DEBUG_PROG_STATS, and
+// define the recording helper at the top of the main file. Slots follow the
+// sorted function names and are handed to BPFModule by name.
+bool BTypeVisitor::finish_prog_stats() {
+  if (!stats_slots_ || fn_names_.empty())
+    return true;
+  SourceManager &SM = rewriter_.getSourceMgr();
+  SourceLocation main_start = SM.getLocForStartOfFile(SM.getMainFileID());
+
+  TableDesc table = {};
+  table.name = "bcc_prog_stats";
+  table.type = BPF_MAP_TYPE_PERCPU_ARRAY;
+  table.key_size = sizeof(int);
+  table.leaf_size = 2 * sizeof(uint64_t);
+  table.max_entries = fn_names_.size();
+  table.key_desc = "\"int\"";
+  table.leaf_desc = "[\"bcc_prog_stats\", [[\"run_cnt\", \"unsigned long long\"], "
+                    "[\"run_time_ns\", \"unsigned long long\"]], \"struct\"]";
+  table.fd = bpf_create_map(BPF_MAP_TYPE_PERCPU_ARRAY, table.key_size, table.leaf_size,
+                            table.max_entries);
+  if (table.fd < 0) {
+    error(main_start, "could not open bpf map: %0\nis percpu_array map type enabled in your kernel?") <<
+        strerror(errno);
+    return false;
+  }
+
+  std::sort(fn_names_.begin(), fn_names_.end());
+  string txt = "struct bcc_prog_stats { u64 run_cnt; u64 run_time_ns; };\n";
+  for (size_t i = 0; i < fn_names_.size(); ++i) {
+    txt += "#define __bcc_stats_slot_" + fn_names_[i] + " " + to_string(i) + "\n";
+    (*stats_slots_)[fn_names_[i]] = i;
+  }
+  txt += "static inline __attribute__((always_inline))\n";
+  txt += "void __bcc_prog_stats_record(int slot, u64 ts) {\n";
+  txt += "  struct bcc_prog_stats *s = bpf_map_lookup_elem((void *)bpf_pseudo_fd(1, " +
+         to_string(table.fd) + "), &slot);\n";
+  txt += "  if (s) { s->run_cnt++; s->run_time_ns += bpf_ktime_get_ns() - ts; }\n";
+  txt += "}\n";
+  rewriter_.InsertText(main_start, txt);
+
+  tables_.push_back(std::move(table));
+  return true;
+}
+
 // Reverse the order of call traversal so that parameters inside of
 // function calls will get rewritten before the call itself, otherwise
 // text mangling will result.
@@ -712,8 +784,9 @@ bool BTypeVisitor::VisitVarDecl(VarDecl *Decl) {
   return true;
 }
 
-BTypeConsumer::BTypeConsumer(ASTContext &C, Rewriter &rewriter, vector<TableDesc> &tables)
-    : visitor_(C, rewriter, tables) {
+BTypeConsumer::BTypeConsumer(ASTContext &C, Rewriter &rewriter, vector<TableDesc> &tables,
+                             map<string, int> *stats_slots)
+    : visitor_(C, rewriter, tables, stats_slots) {
 }
 
 bool BTypeConsumer::HandleTopLevelDecl(DeclGroupRef Group) {
@@ -722,6 +795,10 @@ bool BTypeConsumer::HandleTopLevelDecl(DeclGroupRef Group) {
   return true;
 }
 
+void BTypeConsumer::HandleTranslationUnit(ASTContext &Context) {
+  visitor_.finish_prog_stats();
+}
+
 ProbeConsumer::ProbeConsumer(ASTContext &C, Rewriter &rewriter)
     : visitor_(C, rewriter) {}
 
@@ -741,7 +818,8 @@ bool ProbeConsumer::HandleTopLevelDecl(DeclGroupRef Group) {
 }
 
 BFrontendAction::BFrontendAction(llvm::raw_ostream &os, unsigned flags)
-    : os_(os), flags_(flags), rewriter_(new Rewriter), tables_(new vector<TableDesc>) {
+    : os_(os), flags_(flags), rewriter_(new Rewriter), tables_(new vector<TableDesc>),
+      stats_slots_(new map<string, int>) {
 }
 
 void BFrontendAction::EndSourceFileAction() {
@@ -755,7 +833,9 @@ unique_ptr<ASTConsumer> BFrontendAction::CreateASTConsumer(CompilerInstance &Com
   rewriter_->setSourceMgr(Compiler.getSourceManager(), Compiler.getLangOpts());
   vector<unique_ptr<ASTConsumer>> consumers;
   consumers.push_back(unique_ptr<ASTConsumer>(new ProbeConsumer(Compiler.getASTContext(), *rewriter_)));
-  consumers.push_back(unique_ptr<ASTConsumer>(new BTypeConsumer(Compiler.getASTContext(), *rewriter_, *tables_)));
+  consumers.push_back(unique_ptr<ASTConsumer>(new BTypeConsumer(
+      Compiler.getASTContext(), *rewriter_, *tables_,
+      flags_ & DEBUG_PROG_STATS ? &*stats_slots_ : nullptr)));
   return unique_ptr<ASTConsumer>(new MultiplexConsumer(move(consumers)));
 }
 
@@ -27,6 +27,7 @@
 #include "table_desc.h"
 
 #define DEBUG_PREPROCESSOR 0x4
+#define DEBUG_PROG_STATS 0x8
 
 namespace clang {
 class ASTConsumer;
@@ -64,13 +65,16 @@ class BMapDeclVisitor : public clang::RecursiveASTVisitor<BMapDeclVisitor> {
 class BTypeVisitor : public clang::RecursiveASTVisitor<BTypeVisitor> {
  public:
   explicit BTypeVisitor(clang::ASTContext &C, clang::Rewriter &rewriter,
-                        std::vector<TableDesc> &tables);
+                        std::vector<TableDesc> &tables,
+                        std::map<std::string, int> *stats_slots);
   bool TraverseCallExpr(clang::CallExpr *Call);
   bool VisitFunctionDecl(clang::FunctionDecl *D);
+  bool VisitReturnStmt(clang::ReturnStmt *R);
   bool VisitCallExpr(clang::CallExpr *Call);
   bool VisitVarDecl(clang::VarDecl *Decl);
   bool VisitBinaryOperator(clang::BinaryOperator *E);
   bool VisitImplicitCastExpr(clang::ImplicitCastExpr *E);
+  bool finish_prog_stats();
 
  private:
   template <unsigned N>
@@ -84,6 +88,11 @@ class BTypeVisitor : public clang::RecursiveASTVisitor<BTypeVisitor> {
   std::vector<clang::ParmVarDecl *> fn_args_;
   std::set<clang::Expr *> visited_;
   std::string current_fn_;
+  /// wrap the entry functions with run time accounting, each recording into
+  /// its slot of bcc_prog_stats; null unless DEBUG_PROG_STATS
+  std::map<std::string, int> *stats_slots_;
+  bool stats_fn_;  /// current_fn_ is being instrumented
+  std::vector<std::string> fn_names_;  /// entry functions in the main file
 };
 
 // Do a depth-first search to rewrite all pointers that need to be probed
@@ -111,8 +120,10 @@ class ProbeVisitor : public clang::RecursiveASTVisitor<ProbeVisitor> {
 class BTypeConsumer : public clang::ASTConsumer {
  public:
   explicit BTypeConsumer(clang::ASTContext &C, clang::Rewriter &rewriter,
-                         std::vector<TableDesc> &tables);
+                         std::vector<TableDesc> &tables,
+                         std::map<std::string, int> *stats_slots);
   bool HandleTopLevelDecl(clang::DeclGroupRef Group) override;
+  void HandleTranslationUnit(clang::ASTContext &Context) override;
  private:
   BTypeVisitor visitor_;
 };
@@ -144,11 +155,14 @@ class BFrontendAction : public clang::ASTFrontendAction {
 
   // take ownership of the table-to-fd mapping data structure
   std::unique_ptr<std::vector<TableDesc>> take_tables() { return move(tables_); }
+  // take ownership of the function-to-stats-slot mapping
+  std::unique_ptr<std::map<std::string, int>> take_stats_slots() { return move(stats_slots_); }
  private:
   llvm::raw_ostream &os_;
   unsigned flags_;
   std::unique_ptr<clang::Rewriter> rewriter_;
   std::unique_ptr<std::vector<TableDesc>> tables_;
+  std::unique_ptr<std::map<std::string, int>> stats_slots_;
 };
 
 }  // namespace visitor
@@ -75,7 +75,8 @@ ClangLoader::ClangLoader(llvm::LLVMContext *ctx, unsigned flags)
 ClangLoader::~ClangLoader() {}
 
 int ClangLoader::parse(unique_ptr<llvm::Module> *mod, unique_ptr<vector<TableDesc>> *tables,
-                       const string &file, bool in_memory, const char *cflags[], int ncflags) {
+                       unique_ptr<map<string, int>> *stats_slots, const string &file,
+                       bool in_memory, const char *cflags[], int ncflags) {
   using namespace clang;
 
   string main_path = "/virtual/main.c";
@@ -229,6 +230,7 @@ int ClangLoader::parse(unique_ptr<llvm::Module> *mod, unique_ptr<vector<TableDes
   unique_ptr<llvm::MemoryBuffer> out_buf1 = llvm::MemoryBuffer::getMemBuffer(out_str1);
   // this contains the open FDs
   *tables = bact.take_tables();
+  *stats_slots = bact.take_stats_slots();
 
   // second pass, clear input and take rewrite buffer
   auto invocation2 = make_unique<CompilerInvocation>();
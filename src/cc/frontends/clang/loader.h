@@ -40,6 +40,7 @@ class ClangLoader {
   explicit ClangLoader(llvm::LLVMContext *ctx, unsigned flags);
   ~ClangLoader();
   int parse(std::unique_ptr<llvm::Module> *mod, std::unique_ptr<std::vector<TableDesc>> *tables,
+            std::unique_ptr<std::map<std::string, int>> *stats_slots,
             const std::string &file, bool in_memory, const char *cflags[], int ncflags);
  private:
   static std::map<std::string, std::unique_ptr<llvm::MemoryBuffer>> remapped_files_;
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <alloca.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -28,11 +29,13 @@
 #include <linux/bpf_common.h>
 #include <net/ethernet.h>
 #include <net/if.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <stdbool.h>
 
@@ -134,6 +137,42 @@ int bpf_get_next_key(int fd, void *key, void *next_key)
   return syscall(__NR_bpf, BPF_MAP_GET_NEXT_KEY, &attr, sizeof(attr));
 }
 
+int bpf_get_first_key(int fd, void *key, size_t key_size)
+{
+  static const unsigned char starts[] = {0, 0xff, 0x55};
+  unsigned char *start, *found;
+  int i, j, ok[3];
+
+  if (bpf_get_next_key(fd, NULL, key) == 0)
+    return 0;
+
+  // older kernels take no NULL key but start over from a key that is not in
+  // the map; of three start keys at most one is likely to be, so the first
+  // key is where two of them lead
+  start = alloca(key_size);
+  found = alloca(3 * key_size);
+  for (i = 0; i < 3; ++i) {
+    memset(start, starts[i], key_size);
+    ok[i] = bpf_get_next_key(fd, start, found + i * key_size) == 0;
+  }
+  for (i = 0; i < 3; ++i) {
+    for (j = i + 1; j < 3; ++j) {
+      if (ok[i] && ok[j] &&
+          !memcmp(found + i * key_size, found + j * key_size, key_size)) {
+        memcpy(key, found + i * key_size, key_size);
+        return 0;
+      }
+    }
+  }
+  for (i = 0; i < 3; ++i) {
+    if (ok[i]) {
+      memcpy(key, found + i * key_size, key_size);
+      return 0;
+    }
+  }
+  return -1;
+}
+
 #define ROUND_UP(x, n) (((x) + (n) - 1u) & ~((n) - 1u))
 
 int bpf_prog_load(enum bpf_prog_type prog_type,
@@ -247,6 +286,61 @@ int bpf_open_raw_sock(const char *name)
   return sock;
 }
 
+// BPF_OBJ_GET_INFO_BY_FD and the run time fields of bpf_prog_info are newer
+// than the bundled uapi header, so the layout up to run_cnt is spelled out.
+#define BPF_OBJ_GET_INFO_BY_FD_CMD 15
+#define BPF_PROG_INFO_RUN_TIME_OFF 192
+
+struct bpf_prog_info_stats {
+  uint8_t head[BPF_PROG_INFO_RUN_TIME_OFF];
+  uint64_t run_time_ns;
+  uint64_t run_cnt;
+};
+
+static int bpf_stats_enabled(void)
+{
+  char buf[8] = {};
+  int fd = open("/proc/sys/kernel/bpf_stats_enabled", O_RDONLY);
+  if (fd < 0)
+    return 0;
+  if (read(fd, buf, sizeof(buf) - 1) < 0)
+    buf[0] = 0;
+  close(fd);
+  return buf[0] == '1';
+}
+
+int bpf_prog_get_stats(int prog_fd, uint64_t *run_cnt, uint64_t *run_time_ns)
+{
+  struct {
+    uint32_t bpf_fd;
+    uint32_t info_len;
+    uint64_t info;
+  } attr;
+  struct bpf_prog_info_stats info;
+
+  if (!bpf_stats_enabled()) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  memset(&info, 0, sizeof(info));
+  memset(&attr, 0, sizeof(attr));
+  attr.bpf_fd = prog_fd;
+  attr.info_len = sizeof(info);
+  attr.info = ptr_to_u64(&info);
+  if (syscall(__NR_bpf, BPF_OBJ_GET_INFO_BY_FD_CMD, &attr, sizeof(attr)) < 0)
+    return -1;
+  // older kernels fill in less than asked for
+  if (attr.info_len < sizeof(info)) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  *run_cnt = info.run_cnt;
+  *run_time_ns = info.run_time_ns;
+  return 0;
+}
+
 int bpf_attach_socket(int sock, int prog) {
   return setsockopt(sock, SOL_SOCKET, SO_ATTACH_BPF, &prog, sizeof(prog));
 }
@@ -308,6 +402,13 @@ static void * bpf_attach_probe(int progfd, const char *event,
   char buf[256];
   struct perf_reader *reader = NULL;
 
+  // the kernel would cut a longer name, and with it the owner tag
+  if (strlen(event) >= BPF_PROBE_EVENT_NAME_MAX) {
+    fprintf(stderr, "%s: event name over %d characters\n", event,
+            BPF_PROBE_EVENT_NAME_MAX - 1);
+    return NULL;
+  }
+
   reader = perf_reader_new(cb, NULL, cb_cookie);
   if (!reader)
     goto error;
@@ -627,3 +728,306 @@ int bpf_detach_perf_event(uint32_t ev_type, uint32_t ev_config) {
   // callers to detach anything they attach.
   return 0;
 }
+
+#define TRACEFS_WRITE_MAX 4096
+
+struct bpf_attach_entry {
+  int type;       // -1 while the slot is unused
+  char *ev_name;
+  void *reader;
+  int fd;
+  int next_free;
+};
+
+struct bpf_attach_registry {
+  struct bpf_attach_entry *entries;
+  int num_entries;
+  int capacity;
+  int free_head;
+};
+
+static const char *probe_event_type(int type) {
+  switch (type) {
+  case BPF_ATTACH_KPROBE: return "kprobe";
+  case BPF_ATTACH_UPROBE: return "uprobe";
+  }
+  return NULL;
+}
+
+// Remove a list of dynamic probe events of one type. The tracefs control file
+// is opened once and the "-:group/name" commands are batched into as few
+// writes as the kernel accepts; a batch that fails is retried line by line so
+// that one bad entry does not keep the others around.
+static int bpf_remove_probe_events(const char *event_type, char **names, int n) {
+  char path[256], line[256], buf[TRACEFS_WRITE_MAX];
+  size_t len = 0;
+  int kfd, i, batch_start = 0, ret = 0;
+
+  if (n == 0)
+    return 0;
+
+  snprintf(path, sizeof(path), "/sys/kernel/debug/tracing/%s_events", event_type);
+  kfd = open(path, O_WRONLY | O_APPEND, 0);
+  if (kfd < 0) {
+    fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  for (i = 0; i <= n; ++i) {
+    int line_len = 0;
+
+    if (i < n) {
+      line_len = snprintf(line, sizeof(line), "-:%ss/%s\n", event_type, names[i]);
+      if (line_len <= 0 || line_len >= (int)sizeof(line))
+        continue;
+    }
+
+    if (i == n || len + line_len > sizeof(buf)) {
+      if (len && write(kfd, buf, len) < 0) {
+        int j;
+        for (j = batch_start; j < i; ++j) {
+          int l = snprintf(line, sizeof(line), "-:%ss/%s\n", event_type, names[j]);
+          if (write(kfd, line, l) < 0 && errno != ENOENT) {
+            fprintf(stderr, "write(%s, \"-:%ss/%s\"): %s\n", path, event_type,
+                    names[j], strerror(errno));
+            ret = -1;
+          }
+        }
+      }
+      len = 0;
+      batch_start = i;
+      if (i == n)
+        break;
+    }
+
+    memcpy(buf + len, line, line_len);
+    len += line_len;
+  }
+
+  close(kfd);
+  return ret;
+}
+
+void * bpf_attach_registry_new(void) {
+  struct bpf_attach_registry *reg = calloc(1, sizeof(*reg));
+  if (!reg)
+    return NULL;
+  reg->free_head = -1;
+  return reg;
+}
+
+int bpf_attach_registry_add(void *registry, int type, const char *ev_name,
+                            void *reader, int fd) {
+  struct bpf_attach_registry *reg = registry;
+  struct bpf_attach_entry *entry;
+  int handle;
+
+  if (!reg)
+    return -1;
+
+  if (reg->free_head >= 0) {
+    handle = reg->free_head;
+    reg->free_head = reg->entries[handle].next_free;
+  } else {
+    if (reg->num_entries == reg->capacity) {
+      int capacity = reg->capacity ? reg->capacity * 2 : 64;
+      struct bpf_attach_entry *entries =
+          realloc(reg->entries, capacity * sizeof(*entries));
+      if (!entries)
+        return -1;
+      reg->entries = entries;
+      reg->capacity = capacity;
+    }
+    handle = reg->num_entries++;
+  }
+
+  entry = &reg->entries[handle];
+  entry->type = type;
+  entry->ev_name = ev_name ? strdup(ev_name) : NULL;
+  entry->reader = reader;
+  entry->fd = fd;
+  entry->next_free = -1;
+  return handle;
+}
+
+static void release_entry(struct bpf_attach_registry *reg, int handle) {
+  struct bpf_attach_entry *entry = &reg->entries[handle];
+
+  free(entry->ev_name);
+  entry->ev_name = NULL;
+  entry->type = -1;
+  entry->next_free = reg->free_head;
+  reg->free_head = handle;
+}
+
+static void close_entry(struct bpf_attach_entry *entry) {
+  if (entry->reader) {
+    perf_reader_free(entry->reader);
+    entry->reader = NULL;
+  } else if (entry->fd >= 0) {
+    close(entry->fd);
+  }
+  entry->fd = -1;
+}
+
+int bpf_attach_registry_detach(void *registry, int handle) {
+  struct bpf_attach_registry *reg = registry;
+  struct bpf_attach_entry *entry;
+  const char *event_type;
+  int ret = 0;
+
+  if (!reg || handle < 0 || handle >= reg->num_entries ||
+      reg->entries[handle].type < 0)
+    return -1;
+
+  entry = &reg->entries[handle];
+  close_entry(entry);
+
+  event_type = probe_event_type(entry->type);
+  if (event_type && entry->ev_name)
+    ret = bpf_remove_probe_events(event_type, &entry->ev_name, 1);
+
+  release_entry(reg, handle);
+  return ret;
+}
+
+int bpf_attach_registry_detach_all(void *registry) {
+  struct bpf_attach_registry *reg = registry;
+  char **kprobes, **uprobes;
+  int i, nkprobes = 0, nuprobes = 0, ret = 0;
+
+  if (!reg || !reg->num_entries)
+    return 0;
+
+  kprobes = calloc(reg->num_entries, sizeof(char *));
+  uprobes = calloc(reg->num_entries, sizeof(char *));
+  if (!kprobes || !uprobes) {
+    free(kprobes);
+    free(uprobes);
+    return -1;
+  }
+
+  // every perf fd must be gone before the kernel lets go of the probe events
+  for (i = 0; i < reg->num_entries; ++i) {
+    struct bpf_attach_entry *entry = &reg->entries[i];
+    if (entry->type < 0)
+      continue;
+    close_entry(entry);
+    if (!entry->ev_name)
+      continue;
+    if (entry->type == BPF_ATTACH_KPROBE)
+      kprobes[nkprobes++] = entry->ev_name;
+    else if (entry->type == BPF_ATTACH_UPROBE)
+      uprobes[nuprobes++] = entry->ev_name;
+  }
+
+  if (bpf_remove_probe_events("kprobe", kprobes, nkprobes) < 0)
+    ret = -1;
+  if (bpf_remove_probe_events("uprobe", uprobes, nuprobes) < 0)
+    ret = -1;
+
+  for (i = 0; i < reg->num_entries; ++i)
+    free(reg->entries[i].ev_name);
+  free(kprobes);
+  free(uprobes);
+
+  reg->num_entries = 0;
+  reg->free_head = -1;
+  return ret;
+}
+
+void bpf_attach_registry_free(void *registry) {
+  struct bpf_attach_registry *reg = registry;
+  if (!reg)
+    return;
+  bpf_attach_registry_detach_all(reg);
+  free(reg->entries);
+  free(reg);
+}
+
+// inode of the pid namespace of this process, 0 if the kernel has no
+// namespace files
+static unsigned long pid_ns_inode(void) {
+  struct stat st;
+  if (stat("/proc/self/ns/pid", &st) < 0)
+    return 0;
+  return st.st_ino;
+}
+
+// Probe events named "..._bcc_<ns>_<pid>" belong to the bcc process <pid> of
+// the pid namespace of inode <ns>; if that process is gone, nobody will ever
+// remove them. tracefs is shared by all namespaces, and the pid of an event of
+// another namespace says nothing here, so only events of our own are stale.
+static bool is_stale_probe_event(const char *name, unsigned long own_ns) {
+  const char *tag = NULL, *p = name;
+  char *end;
+  unsigned long ns;
+  long pid;
+
+  while ((p = strstr(p, BPF_PROBE_OWNER_TAG)) != NULL)
+    tag = p++;
+  if (!tag)
+    return false;
+
+  ns = strtoul(tag + strlen(BPF_PROBE_OWNER_TAG), &end, 10);
+  if (*end != '_' || ns != own_ns)
+    return false;
+  pid = strtol(end + 1, &end, 10);
+  if (pid <= 0 || *end != '\0')
+    return false;
+
+  return kill((pid_t)pid, 0) < 0 && errno == ESRCH;
+}
+
+static int remove_stale_events(const char *event_type) {
+  char path[256], line[1024];
+  char **names = NULL;
+  int n = 0, capacity = 0, i, ret;
+  unsigned long own_ns = pid_ns_inode();
+  FILE *events;
+
+  snprintf(path, sizeof(path), "/sys/kernel/debug/tracing/%s_events", event_type);
+  events = fopen(path, "r");
+  if (!events)
+    return -1;
+
+  while (fgets(line, sizeof(line), events)) {
+    // "p:kprobes/p_do_sys_open_bcc_4026531836_1234 do_sys_open"
+    char *name = strchr(line, '/'), *end;
+    if (!name)
+      continue;
+    name++;
+    end = name;
+    while (*end && *end != ' ' && *end != '\n') end++;
+    *end = '\0';
+
+    if (!is_stale_probe_event(name, own_ns))
+      continue;
+
+    if (n == capacity) {
+      char **grown;
+      capacity = capacity ? capacity * 2 : 64;
+      grown = realloc(names, capacity * sizeof(char *));
+      if (!grown)
+        break;
+      names = grown;
+    }
+    names[n++] = strdup(name);
+  }
+  fclose(events);
+
+  ret = bpf_remove_probe_events(event_type, names, n);
+  for (i = 0; i < n; ++i)
+    free(names[i]);
+  free(names);
+  return ret;
+}
+
+int bpf_remove_stale_probes(void) {
+  int ret = 0;
+  if (remove_stale_events("kprobe") < 0)
+    ret = -1;
+  if (remove_stale_events("uprobe") < 0)
+    ret = -1;
+  return ret;
+}
@@ -30,6 +30,8 @@ int bpf_update_elem(int fd, void *key, void *value, unsigned long long flags);
 int bpf_lookup_elem(int fd, void *key, void *value);
 int bpf_delete_elem(int fd, void *key);
 int bpf_get_next_key(int fd, void *key, void *next_key);
+/* first key of a hash map into key, -1 if the map is empty */
+int bpf_get_first_key(int fd, void *key, size_t key_size);
 
 int bpf_prog_load(enum bpf_prog_type prog_type,
 		  const struct bpf_insn *insns, int insn_len,
@@ -37,6 +39,9 @@ int bpf_prog_load(enum bpf_prog_type prog_type,
 		  char *log_buf, unsigned log_buf_size);
 int bpf_attach_socket(int sockfd, int progfd);
 
+/* run count and time of a program from kernel bpf_stats, -1 if unavailable */
+int bpf_prog_get_stats(int prog_fd, uint64_t *run_cnt, uint64_t *run_time_ns);
+
 /* create RAW socket and bind to interface 'name' */
 int bpf_open_raw_sock(const char *name);
 
@@ -71,6 +76,38 @@ int bpf_attach_perf_event(int progfd, uint32_t ev_type, uint32_t ev_config,
                           pid_t pid, int cpu, int group_fd);
 int bpf_detach_perf_event(uint32_t ev_type, uint32_t ev_config);
 
+// Probe events created by a frontend end with this tag followed by
+// "<ns>_<pid>": the inode of the pid namespace of the owning process, as
+// /proc/self/ns/pid has it, and its pid there. Events left behind by a
+// crashed process of our own namespace are then recognized and removed by
+// bpf_remove_stale_probes. Event names must stay below
+// BPF_PROBE_EVENT_NAME_MAX characters, tag included.
+#define BPF_PROBE_OWNER_TAG "_bcc_"
+#define BPF_PROBE_EVENT_NAME_MAX 64
+
+enum bpf_attach_kind {
+  BPF_ATTACH_KPROBE = 0,
+  BPF_ATTACH_UPROBE,
+  BPF_ATTACH_TRACEPOINT,
+  BPF_ATTACH_PERF_EVENT,
+};
+
+// A registry owns everything attached on behalf of one module: perf readers,
+// raw perf event fds and the dynamic kprobe/uprobe events. Entries are
+// identified by the handle returned from bpf_attach_registry_add. Tearing the
+// whole registry down closes all fds first and then removes the dynamic events
+// with one pass over each tracefs control file.
+void * bpf_attach_registry_new(void);
+int bpf_attach_registry_add(void *registry, int kind, const char *ev_name,
+                            void *reader, int fd);
+int bpf_attach_registry_detach(void *registry, int handle);
+int bpf_attach_registry_detach_all(void *registry);
+void bpf_attach_registry_free(void *registry);
+
+// remove the kprobe/uprobe events of our pid namespace whose owning bcc
+// process no longer exists
+int bpf_remove_stale_probes(void);
+
 #define LOG_BUF_SIZE 65536
 
 // Put non-static/inline functions in their own section with this prefix +
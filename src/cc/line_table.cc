@@ -0,0 +1,1035 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <cxxabi.h>
+#include <limits.h>
+#include <set>
+#include <unordered_map>
+#include <stdlib.h>
+
+#include "bcc_elf.h"
+#include "dwarf_reader.h"
+#include "line_table.h"
+
+namespace {
+
+enum {
+  DW_TAG_inlined_subroutine = 0x1d,
+  DW_TAG_subprogram = 0x2e,
+
+  DW_AT_name = 0x03,
+  DW_AT_stmt_list = 0x10,
+  DW_AT_low_pc = 0x11,
+  DW_AT_high_pc = 0x12,
+  DW_AT_comp_dir = 0x1b,
+  DW_AT_abstract_origin = 0x31,
+  DW_AT_specification = 0x47,
+  DW_AT_ranges = 0x55,
+  DW_AT_call_file = 0x58,
+  DW_AT_call_line = 0x59,
+  DW_AT_linkage_name = 0x6e,
+  DW_AT_str_offsets_base = 0x72,
+  DW_AT_addr_base = 0x73,
+  DW_AT_rnglists_base = 0x74,
+  DW_AT_MIPS_linkage_name = 0x2007,
+  DW_AT_GNU_addr_base = 0x2133,
+
+  DW_FORM_addr = 0x01,
+  DW_FORM_block2 = 0x03,
+  DW_FORM_block4 = 0x04,
+  DW_FORM_data2 = 0x05,
+  DW_FORM_data4 = 0x06,
+  DW_FORM_data8 = 0x07,
+  DW_FORM_string = 0x08,
+  DW_FORM_block = 0x09,
+  DW_FORM_block1 = 0x0a,
+  DW_FORM_data1 = 0x0b,
+  DW_FORM_flag = 0x0c,
+  DW_FORM_sdata = 0x0d,
+  DW_FORM_strp = 0x0e,
+  DW_FORM_udata = 0x0f,
+  DW_FORM_ref_addr = 0x10,
+  DW_FORM_ref1 = 0x11,
+  DW_FORM_ref2 = 0x12,
+  DW_FORM_ref4 = 0x13,
+  DW_FORM_ref8 = 0x14,
+  DW_FORM_ref_udata = 0x15,
+  DW_FORM_indirect = 0x16,
+  DW_FORM_sec_offset = 0x17,
+  DW_FORM_exprloc = 0x18,
+  DW_FORM_flag_present = 0x19,
+  DW_FORM_strx = 0x1a,
+  DW_FORM_addrx = 0x1b,
+  DW_FORM_ref_sup4 = 0x1c,
+  DW_FORM_strp_sup = 0x1d,
+  DW_FORM_data16 = 0x1e,
+  DW_FORM_line_strp = 0x1f,
+  DW_FORM_ref_sig8 = 0x20,
+  DW_FORM_implicit_const = 0x21,
+  DW_FORM_loclistx = 0x22,
+  DW_FORM_rnglistx = 0x23,
+  DW_FORM_ref_sup8 = 0x24,
+  DW_FORM_strx1 = 0x25,
+  DW_FORM_strx2 = 0x26,
+  DW_FORM_strx3 = 0x27,
+  DW_FORM_strx4 = 0x28,
+  DW_FORM_addrx1 = 0x29,
+  DW_FORM_addrx2 = 0x2a,
+  DW_FORM_addrx3 = 0x2b,
+  DW_FORM_addrx4 = 0x2c,
+  DW_FORM_GNU_addr_index = 0x1f01,
+  DW_FORM_GNU_str_index = 0x1f02,
+  DW_FORM_GNU_ref_alt = 0x1f20,
+  DW_FORM_GNU_strp_alt = 0x1f21,
+
+  DW_UT_compile = 0x01,
+  DW_UT_partial = 0x03,
+
+  DW_LNS_copy = 1,
+  DW_LNS_advance_pc = 2,
+  DW_LNS_advance_line = 3,
+  DW_LNS_set_file = 4,
+  DW_LNS_const_add_pc = 8,
+  DW_LNS_fixed_advance_pc = 9,
+  DW_LNE_end_sequence = 1,
+  DW_LNE_set_address = 2,
+  DW_LNE_define_file = 3,
+  DW_LNCT_path = 1,
+  DW_LNCT_directory_index = 2,
+
+  DW_RLE_end_of_list = 0,
+  DW_RLE_base_addressx = 1,
+  DW_RLE_startx_endx = 2,
+  DW_RLE_startx_length = 3,
+  DW_RLE_offset_pair = 4,
+  DW_RLE_base_address = 5,
+  DW_RLE_start_end = 6,
+  DW_RLE_start_length = 7,
+};
+
+// gc'ed code keeps its debug info with its address set to 0 or -1
+bool is_tombstone(uint64_t addr) { return addr == 0 || addr == ~0ull; }
+
+// references to a DIE of this file's .debug_info; others point into a type
+// unit, the supplementary file or the alternate file of dwz, whose offsets
+// mean nothing here
+bool is_local_ref(uint64_t form) {
+  switch (form) {
+  case DW_FORM_ref1:
+  case DW_FORM_ref2:
+  case DW_FORM_ref4:
+  case DW_FORM_ref8:
+  case DW_FORM_ref_udata:
+  case DW_FORM_ref_addr:
+    return true;
+  default:
+    return false;
+  }
+}
+
+}  // namespace
+
+class LineTable::Builder {
+  struct Section {
+    const void *data = nullptr;
+    size_t size = 0;
+  };
+  struct Value {
+    uint64_t form;
+    uint64_t u;
+    const char *s;
+  };
+  struct AttrSpec {
+    uint64_t at;
+    uint64_t form;
+    int64_t implicit;
+  };
+  struct Abbrev {
+    uint64_t tag;
+    bool children;
+    std::vector<AttrSpec> attrs;
+  };
+  typedef std::vector<Abbrev> AbbrevTable;
+  struct Unit {
+    uint64_t offset;
+    uint16_t version;
+    bool dwarf64;
+    uint8_t addr_size;
+    uint64_t low_pc;
+    uint64_t str_offsets_base;
+    uint64_t addr_base;
+    uint64_t rnglists_base;
+    const char *comp_dir;
+    // global file index + 1 of each file of the line table, 0 for none
+    std::vector<uint32_t> files;
+  };
+  struct Row {
+    uint64_t addr;
+    uint32_t file;
+    uint32_t line;
+  };
+  // DIE offset of a subprogram to the names found on it
+  struct Named {
+    const char *name;
+    const char *linkage;
+    uint64_t origin;
+  };
+  struct PendingInline {
+    uint64_t origin;
+    uint32_t call_file;
+    uint32_t call_line;
+    uint32_t parent;
+  };
+  struct Range {
+    uint64_t lo;
+    uint64_t hi;
+    uint32_t inl;
+    uint32_t depth;
+  };
+
+  LineTable *t_;
+  Section info_, abbrev_, line_, str_, line_str_, str_offsets_, addr_,
+      ranges_, rnglists_;
+  std::unordered_map<uint64_t, AbbrevTable> abbrevs_;
+  std::unordered_map<std::string, uint32_t> interned_;
+  std::unordered_map<std::string, uint32_t> file_ids_;
+  std::vector<Row> rows_;
+  std::unordered_map<uint64_t, Named> named_;
+  std::vector<PendingInline> inlines_;
+  std::vector<Range> ranges_list_;
+
+  static Section section(struct bcc_elf_file *elf, const char *name) {
+    Section s;
+    s.data = bcc_elf_file_section(elf, name, &s.size);
+    return s;
+  }
+  static DwarfReader reader(const Section &s) {
+    return DwarfReader(s.data, s.size);
+  }
+
+  uint32_t intern(const std::string &s) {
+    auto it = interned_.find(s);
+    if (it != interned_.end())
+      return it->second;
+    uint32_t off = t_->strings_.size();
+    t_->strings_.insert(t_->strings_.end(), s.begin(), s.end());
+    t_->strings_.push_back('\0');
+    interned_.emplace(s, off);
+    return off;
+  }
+
+  uint32_t file_id(const std::string &path) {
+    auto it = file_ids_.find(path);
+    if (it != file_ids_.end())
+      return it->second;
+    t_->files_.push_back(intern(path));
+    uint32_t id = t_->files_.size();
+    file_ids_.emplace(path, id);
+    return id;
+  }
+
+  const AbbrevTable *abbrevs(uint64_t off);
+  bool read_value(DwarfReader &r, const Unit &u, uint64_t form,
+                  int64_t implicit, Value *v);
+  const char *string(const Unit &u, const Value &v);
+  uint64_t address(const Unit &u, const Value &v);
+  void read_ranges(const Unit &u, const Value &v, uint32_t inl,
+                   uint32_t depth);
+  void read_lines(Unit &u, uint64_t off);
+  void read_unit(DwarfReader &r, uint64_t offset);
+  const char *function_name(uint64_t die, std::string *demangled);
+  void finish();
+
+public:
+  explicit Builder(LineTable *t) : t_(t) {}
+  bool build(struct bcc_elf_file *elf);
+};
+
+const LineTable::Builder::AbbrevTable *
+LineTable::Builder::abbrevs(uint64_t off) {
+  auto it = abbrevs_.find(off);
+  if (it != abbrevs_.end())
+    return &it->second;
+
+  AbbrevTable &table = abbrevs_[off];
+  DwarfReader r = reader(abbrev_);
+  r.seek(off);
+  while (r.ok()) {
+    uint64_t code = r.uleb();
+    if (!code)
+      break;
+    Abbrev a;
+    a.tag = r.uleb();
+    a.children = r.u8() != 0;
+    while (r.ok()) {
+      AttrSpec spec;
+      spec.at = r.uleb();
+      spec.form = r.uleb();
+      spec.implicit = spec.form == DW_FORM_implicit_const ? r.sleb() : 0;
+      if (!spec.at && !spec.form)
+        break;
+      a.attrs.push_back(spec);
+    }
+    // codes are small and usually dense
+    if (code > 1000000)
+      break;
+    if (table.size() <= code)
+      table.resize(code + 1);
+    table[code] = std::move(a);
+  }
+  return &table;
+}
+
+bool LineTable::Builder::read_value(DwarfReader &r, const Unit &u,
+                                    uint64_t form, int64_t implicit,
+                                    Value *v) {
+  v->form = form;
+  v->u = 0;
+  v->s = nullptr;
+  switch (form) {
+  case DW_FORM_addr:
+    v->u = r.sized(u.addr_size);
+    break;
+  case DW_FORM_data1:
+  case DW_FORM_flag:
+  case DW_FORM_strx1:
+  case DW_FORM_addrx1:
+    v->u = r.u8();
+    break;
+  case DW_FORM_data2:
+  case DW_FORM_strx2:
+  case DW_FORM_addrx2:
+    v->u = r.u16();
+    break;
+  case DW_FORM_strx3:
+  case DW_FORM_addrx3:
+    v->u = r.u24();
+    break;
+  case DW_FORM_data4:
+  case DW_FORM_strx4:
+  case DW_FORM_addrx4:
+  case DW_FORM_ref_sup4:
+    v->u = r.u32();
+    break;
+  case DW_FORM_data8:
+  case DW_FORM_ref_sig8:
+  case DW_FORM_ref_sup8:
+    v->u = r.u64();
+    break;
+  case DW_FORM_data16:
+    r.skip(16);
+    break;
+  case DW_FORM_sdata:
+    v->u = r.sleb();
+    break;
+  case DW_FORM_udata:
+  case DW_FORM_strx:
+  case DW_FORM_addrx:
+  case DW_FORM_loclistx:
+  case DW_FORM_rnglistx:
+  case DW_FORM_GNU_addr_index:
+  case DW_FORM_GNU_str_index:
+    v->u = r.uleb();
+    break;
+  case DW_FORM_string:
+    v->s = r.cstr();
+    break;
+  case DW_FORM_strp:
+  case DW_FORM_line_strp:
+  case DW_FORM_sec_offset:
+  case DW_FORM_strp_sup:
+  case DW_FORM_GNU_strp_alt:
+  case DW_FORM_GNU_ref_alt:
+    v->u = r.offset(u.dwarf64);
+    break;
+  case DW_FORM_ref_addr:
+    v->u = u.version <= 2 ? r.sized(u.addr_size) : r.offset(u.dwarf64);
+    break;
+  // unit relative references are kept as section offsets
+  case DW_FORM_ref1:
+    v->u = u.offset + r.u8();
+    break;
+  case DW_FORM_ref2:
+    v->u = u.offset + r.u16();
+    break;
+  case DW_FORM_ref4:
+    v->u = u.offset + r.u32();
+    break;
+  case DW_FORM_ref8:
+    v->u = u.offset + r.u64();
+    break;
+  case DW_FORM_ref_udata:
+    v->u = u.offset + r.uleb();
+    break;
+  case DW_FORM_exprloc:
+  case DW_FORM_block:
+    r.skip(r.uleb());
+    break;
+  case DW_FORM_block1:
+    r.skip(r.u8());
+    break;
+  case DW_FORM_block2:
+    r.skip(r.u16());
+    break;
+  case DW_FORM_block4:
+    r.skip(r.u32());
+    break;
+  case DW_FORM_flag_present:
+    v->u = 1;
+    break;
+  case DW_FORM_implicit_const:
+    v->u = implicit;
+    break;
+  case DW_FORM_indirect:
+    return read_value(r, u, r.uleb(), implicit, v);
+  default:
+    return false;
+  }
+  return r.ok();
+}
+
+const char *LineTable::Builder::string(const Unit &u, const Value &v) {
+  DwarfReader r;
+  switch (v.form) {
+  case DW_FORM_string:
+    return v.s;
+  case DW_FORM_strp:
+    r = reader(str_);
+    r.seek(v.u);
+    break;
+  case DW_FORM_line_strp:
+    r = reader(line_str_);
+    r.seek(v.u);
+    break;
+  case DW_FORM_strx:
+  case DW_FORM_strx1:
+  case DW_FORM_strx2:
+  case DW_FORM_strx3:
+  case DW_FORM_strx4:
+  case DW_FORM_GNU_str_index: {
+    DwarfReader offsets = reader(str_offsets_);
+    offsets.seek(u.str_offsets_base + v.u * (u.dwarf64 ? 8 : 4));
+    uint64_t off = offsets.offset(u.dwarf64);
+    if (!offsets.ok())
+      return nullptr;
+    r = reader(str_);
+    r.seek(off);
+    break;
+  }
+  default:
+    return nullptr;
+  }
+  const char *s = r.cstr();
+  return r.ok() ? s : nullptr;
+}
+
+uint64_t LineTable::Builder::address(const Unit &u, const Value &v) {
+  switch (v.form) {
+  case DW_FORM_addr:
+    return v.u;
+  case DW_FORM_addrx:
+  case DW_FORM_addrx1:
+  case DW_FORM_addrx2:
+  case DW_FORM_addrx3:
+  case DW_FORM_addrx4:
+  case DW_FORM_GNU_addr_index: {
+    DwarfReader r = reader(addr_);
+    r.seek(u.addr_base + v.u * u.addr_size);
+    uint64_t addr = r.sized(u.addr_size);
+    return r.ok() ? addr : 0;
+  }
+  }
+  return 0;
+}
+
+void LineTable::Builder::read_ranges(const Unit &u, const Value &v,
+                                     uint32_t inl, uint32_t depth) {
+  auto add = [&](uint64_t lo, uint64_t hi) {
+    if (!is_tombstone(lo) && lo < hi)
+      ranges_list_.push_back({lo, hi, inl, depth});
+  };
+
+  uint64_t base = u.low_pc;
+  if (u.version < 5) {
+    DwarfReader r = reader(ranges_);
+    r.seek(v.u);
+    uint64_t max = u.addr_size == 4 ? 0xffffffffull : ~0ull;
+    while (r.ok()) {
+      uint64_t lo = r.sized(u.addr_size), hi = r.sized(u.addr_size);
+      if (!r.ok() || (!lo && !hi))
+        break;
+      if (lo == max)
+        base = hi;
+      else
+        add(base + lo, base + hi);
+    }
+    return;
+  }
+
+  DwarfReader r = reader(rnglists_);
+  uint64_t off = v.u;
+  if (v.form == DW_FORM_rnglistx) {
+    DwarfReader offsets = reader(rnglists_);
+    offsets.seek(u.rnglists_base + v.u * (u.dwarf64 ? 8 : 4));
+    off = u.rnglists_base + offsets.offset(u.dwarf64);
+    if (!offsets.ok())
+      return;
+  }
+  r.seek(off);
+  while (r.ok()) {
+    Value a = {DW_FORM_addrx, 0, nullptr};
+    uint64_t lo, hi;
+    switch (r.u8()) {
+    case DW_RLE_end_of_list:
+      return;
+    case DW_RLE_base_addressx:
+      a.u = r.uleb();
+      base = address(u, a);
+      break;
+    case DW_RLE_startx_endx:
+      a.u = r.uleb();
+      lo = address(u, a);
+      a.u = r.uleb();
+      add(lo, address(u, a));
+      break;
+    case DW_RLE_startx_length:
+      a.u = r.uleb();
+      lo = address(u, a);
+      add(lo, lo + r.uleb());
+      break;
+    case DW_RLE_offset_pair:
+      lo = r.uleb();
+      hi = r.uleb();
+      add(base + lo, base + hi);
+      break;
+    case DW_RLE_base_address:
+      base = r.sized(u.addr_size);
+      break;
+    case DW_RLE_start_end:
+      lo = r.sized(u.addr_size);
+      add(lo, r.sized(u.addr_size));
+      break;
+    case DW_RLE_start_length:
+      lo = r.sized(u.addr_size);
+      add(lo, lo + r.uleb());
+      break;
+    default:
+      return;
+    }
+  }
+}
+
+void LineTable::Builder::read_lines(Unit &u, uint64_t off) {
+  DwarfReader r = reader(line_);
+  r.seek(off);
+  bool dwarf64;
+  uint64_t len = r.initial_length(&dwarf64);
+  DwarfReader prog = r.sub(len);
+  if (!r.ok())
+    return;
+
+  Unit lu = u;
+  lu.dwarf64 = dwarf64;
+  lu.version = prog.u16();
+  if (lu.version < 2 || lu.version > 5)
+    return;
+  if (lu.version >= 5) {
+    lu.addr_size = prog.u8();
+    prog.u8();  // segment selector size
+  }
+  uint64_t header_len = prog.offset(dwarf64);
+  size_t program_start = prog.offset() + header_len;
+  uint8_t min_inst_len = prog.u8();
+  if (lu.version >= 4)
+    prog.u8();  // max ops per instruction, only for VLIW
+  bool default_is_stmt = prog.u8() != 0;
+  (void)default_is_stmt;
+  int8_t line_base = (int8_t)prog.u8();
+  uint8_t line_range = prog.u8();
+  uint8_t opcode_base = prog.u8();
+  std::vector<uint8_t> opcode_lengths(opcode_base ? opcode_base - 1 : 0);
+  for (auto &l : opcode_lengths)
+    l = prog.u8();
+  if (!prog.ok() || !line_range)
+    return;
+
+  std::vector<std::string> dirs;
+  std::string comp_dir = u.comp_dir ? u.comp_dir : "";
+  auto join = [&](const std::string &dir, const char *name) {
+    std::string path;
+    if (name[0] == '/' || dir.empty())
+      path = name;
+    else
+      path = dir + "/" + name;
+    if (!path.empty() && path[0] != '/' && !comp_dir.empty())
+      path = comp_dir + "/" + path;
+    return path;
+  };
+  auto add_file = [&](const char *name, uint64_t dir) {
+    std::string d = dir < dirs.size() ? dirs[dir] : "";
+    u.files.push_back(name && name[0] ? file_id(join(d, name)) : 0);
+  };
+
+  u.files.clear();
+  if (lu.version < 5) {
+    dirs.push_back(comp_dir);
+    while (prog.ok()) {
+      const char *dir = prog.cstr();
+      if (!dir[0])
+        break;
+      dirs.push_back(dir);
+    }
+    // file numbers start at 1
+    u.files.push_back(0);
+    while (prog.ok()) {
+      const char *name = prog.cstr();
+      if (!name[0])
+        break;
+      uint64_t dir = prog.uleb();
+      prog.uleb();  // mtime
+      prog.uleb();  // length
+      add_file(name, dir);
+    }
+  } else {
+    for (int pass = 0; pass < 2 && prog.ok(); ++pass) {
+      std::vector<std::pair<uint64_t, uint64_t>> format(prog.u8());
+      for (auto &f : format) {
+        f.first = prog.uleb();
+        f.second = prog.uleb();
+      }
+      uint64_t count = prog.uleb();
+      for (uint64_t i = 0; i < count && prog.ok(); ++i) {
+        const char *name = nullptr;
+        uint64_t dir = 0;
+        for (auto &f : format) {
+          Value v;
+          if (!read_value(prog, lu, f.second, 0, &v))
+            return;
+          if (f.first == DW_LNCT_path)
+            name = string(lu, v);
+          else if (f.first == DW_LNCT_directory_index)
+            dir = v.u;
+        }
+        if (pass == 0)
+          dirs.push_back(name ? join("", name) : comp_dir);
+        else
+          add_file(name, dir);
+      }
+    }
+  }
+  if (!prog.ok())
+    return;
+
+  prog.seek(program_start);
+  std::vector<Row> seq;
+  uint64_t addr = 0;
+  uint64_t file = 1;
+  int64_t line = 1;
+  auto emit = [&]() {
+    uint32_t id = file < u.files.size() ? u.files[file] : 0;
+    seq.push_back({addr, id, (uint32_t)line});
+  };
+
+  while (prog.ok() && !prog.done()) {
+    uint8_t op = prog.u8();
+    if (op >= opcode_base) {
+      uint8_t adj = op - opcode_base;
+      addr += (uint64_t)(adj / line_range) * min_inst_len;
+      line += line_base + adj % line_range;
+      emit();
+      continue;
+    }
+    switch (op) {
+    case 0: {
+      DwarfReader ext = prog.sub(prog.uleb());
+      switch (ext.u8()) {
+      case DW_LNE_end_sequence:
+        // the end row closes the last range of the sequence
+        if (!seq.empty() && !is_tombstone(seq.front().addr)) {
+          rows_.insert(rows_.end(), seq.begin(), seq.end());
+          rows_.push_back({addr, 0, 0});
+        }
+        seq.clear();
+        addr = 0;
+        file = 1;
+        line = 1;
+        break;
+      case DW_LNE_set_address:
+        addr = ext.sized(ext.left());
+        break;
+      case DW_LNE_define_file: {
+        const char *name = ext.cstr();
+        uint64_t dir = ext.uleb();
+        add_file(name, dir);
+        break;
+      }
+      }
+      break;
+    }
+    case DW_LNS_copy:
+      emit();
+      break;
+    case DW_LNS_advance_pc:
+      addr += prog.uleb() * min_inst_len;
+      break;
+    case DW_LNS_advance_line:
+      line += prog.sleb();
+      break;
+    case DW_LNS_set_file:
+      file = prog.uleb();
+      break;
+    case DW_LNS_const_add_pc:
+      addr += (uint64_t)((255 - opcode_base) / line_range) * min_inst_len;
+      break;
+    case DW_LNS_fixed_advance_pc:
+      addr += prog.u16();
+      break;
+    default:
+      // set_column, negate_stmt and the like do not matter here
+      for (uint8_t i = 0; i < opcode_lengths[op - 1]; ++i)
+        prog.uleb();
+      break;
+    }
+  }
+}
+
+void LineTable::Builder::read_unit(DwarfReader &r, uint64_t offset) {
+  bool dwarf64;
+  uint64_t len = r.initial_length(&dwarf64);
+  DwarfReader unit = r.sub(len);
+  if (!r.ok())
+    return;
+
+  Unit u = {};
+  u.offset = offset;
+  u.dwarf64 = dwarf64;
+  u.version = unit.u16();
+  uint64_t abbrev_off;
+  if (u.version >= 5) {
+    uint8_t type = unit.u8();
+    u.addr_size = unit.u8();
+    abbrev_off = unit.offset(dwarf64);
+    // type units and split units have nothing to add
+    if (type != DW_UT_compile && type != DW_UT_partial)
+      return;
+  } else if (u.version >= 2) {
+    abbrev_off = unit.offset(dwarf64);
+    u.addr_size = unit.u8();
+  } else {
+    return;
+  }
+  if (!unit.ok() || (u.addr_size != 4 && u.addr_size != 8))
+    return;
+  const AbbrevTable *table = abbrevs(abbrev_off);
+
+  std::vector<std::pair<uint64_t, Value>> attrs;
+  // innermost inlined call around the DIEs at each depth
+  std::vector<uint32_t> parents;
+  bool first = true;
+  while (unit.ok() && !unit.done()) {
+    uint64_t die = offset + (dwarf64 ? 12 : 4) + unit.offset();
+    uint64_t code = unit.uleb();
+    if (!code) {
+      if (parents.empty())
+        break;
+      parents.pop_back();
+      continue;
+    }
+    if (code >= table->size() || !(*table)[code].tag)
+      return;
+    const Abbrev &a = (*table)[code];
+
+    attrs.clear();
+    for (const AttrSpec &spec : a.attrs) {
+      Value v;
+      if (!read_value(unit, u, spec.form, spec.implicit, &v))
+        return;
+      attrs.emplace_back(spec.at, v);
+    }
+
+    if (first) {
+      // the bases apply to the other attributes of the unit DIE as well
+      first = false;
+      uint64_t stmt_list = ~0ull;
+      Value low_pc = {0, 0, nullptr}, comp_dir = {0, 0, nullptr};
+      for (auto &at : attrs) {
+        switch (at.first) {
+        case DW_AT_stmt_list:
+          stmt_list = at.second.u;
+          break;
+        case DW_AT_low_pc:
+          low_pc = at.second;
+          break;
+        case DW_AT_comp_dir:
+          comp_dir = at.second;
+          break;
+        case DW_AT_str_offsets_base:
+          u.str_offsets_base = at.second.u;
+          break;
+        case DW_AT_addr_base:
+        case DW_AT_GNU_addr_base:
+          u.addr_base = at.second.u;
+          break;
+        case DW_AT_rnglists_base:
+          u.rnglists_base = at.second.u;
+          break;
+        }
+      }
+      u.low_pc = address(u, low_pc);
+      u.comp_dir = comp_dir.form ? string(u, comp_dir) : nullptr;
+      if (stmt_list != ~0ull)
+        read_lines(u, stmt_list);
+      if (a.children)
+        parents.push_back(0);
+      continue;
+    }
+
+    uint32_t parent = parents.empty() ? 0 : parents.back();
+    if (a.tag == DW_TAG_subprogram) {
+      Named n = {nullptr, nullptr, ~0ull};
+      for (auto &at : attrs) {
+        if (at.first == DW_AT_name)
+          n.name = string(u, at.second);
+        else if (at.first == DW_AT_linkage_name ||
+                 at.first == DW_AT_MIPS_linkage_name)
+          n.linkage = string(u, at.second);
+        else if ((at.first == DW_AT_specification ||
+                  at.first == DW_AT_abstract_origin) &&
+                 is_local_ref(at.second.form))
+          n.origin = at.second.u;
+      }
+      named_[die] = n;
+      // an out of line function starts a new chain
+      parent = 0;
+    } else if (a.tag == DW_TAG_inlined_subroutine) {
+      PendingInline inl = {~0ull, 0, 0, parent};
+      Value low = {0, 0, nullptr}, high = {0, 0, nullptr},
+            ranges = {0, 0, nullptr};
+      for (auto &at : attrs) {
+        switch (at.first) {
+        case DW_AT_abstract_origin:
+          // left unknown if the name is in another file
+          if (is_local_ref(at.second.form))
+            inl.origin = at.second.u;
+          break;
+        case DW_AT_call_file:
+          inl.call_file =
+              at.second.u < u.files.size() ? u.files[at.second.u] : 0;
+          break;
+        case DW_AT_call_line:
+          inl.call_line = at.second.u;
+          break;
+        case DW_AT_low_pc:
+          low = at.second;
+          break;
+        case DW_AT_high_pc:
+          high = at.second;
+          break;
+        case DW_AT_ranges:
+          ranges = at.second;
+          break;
+        }
+      }
+      inlines_.push_back(inl);
+      uint32_t idx = inlines_.size();
+      uint32_t depth = parents.size();
+      if (ranges.form) {
+        read_ranges(u, ranges, idx, depth);
+      } else if (low.form) {
+        uint64_t lo = address(u, low);
+        uint64_t hi = high.form == DW_FORM_addr || high.form == DW_FORM_addrx
+                          ? address(u, high)
+                          : lo + high.u;
+        if (!is_tombstone(lo) && lo < hi)
+          ranges_list_.push_back({lo, hi, idx, depth});
+      }
+      parent = idx;
+    }
+    if (a.children)
+      parents.push_back(parent);
+  }
+}
+
+// the name of the function a DIE is an instance of, following its abstract
+// origin or specification to the DIE that has it
+const char *LineTable::Builder::function_name(uint64_t die,
+                                              std::string *demangled) {
+  const char *name = nullptr;
+  for (int hops = 0; hops < 8; ++hops) {
+    auto it = named_.find(die);
+    if (it == named_.end())
+      break;
+    const Named &n = it->second;
+    if (n.linkage) {
+      int status;
+      char *d = abi::__cxa_demangle(n.linkage, nullptr, nullptr, &status);
+      *demangled = d ? d : n.linkage;
+      free(d);
+      return demangled->c_str();
+    }
+    if (!name)
+      name = n.name;
+    die = n.origin;
+  }
+  return name;
+}
+
+void LineTable::Builder::finish() {
+  // rows of one address: a sequence end goes before a sequence starting
+  // there, and of several rows the last one applies
+  std::stable_sort(rows_.begin(), rows_.end(), [](const Row &a, const Row &b) {
+    return a.addr < b.addr || (a.addr == b.addr && !a.file && b.file);
+  });
+  for (size_t i = 0; i < rows_.size(); ++i) {
+    const Row &row = rows_[i];
+    if (i + 1 < rows_.size() && rows_[i + 1].addr == row.addr)
+      continue;
+    if (!t_->line_starts_.empty() && t_->line_files_.back() == row.file &&
+        t_->lines_.back() == row.line)
+      continue;
+    t_->line_starts_.push_back(row.addr);
+    t_->line_files_.push_back(row.file);
+    t_->lines_.push_back(row.line);
+  }
+  std::vector<Row>().swap(rows_);
+
+  std::string demangled;
+  t_->inlines_.reserve(inlines_.size());
+  for (const PendingInline &p : inlines_) {
+    const char *name = function_name(p.origin, &demangled);
+    t_->inlines_.push_back({intern(name ? name : "[unknown]"), p.call_file,
+                            p.call_line, p.parent});
+  }
+
+  // cut the address space where the innermost inlined call changes
+  std::vector<std::pair<uint64_t, int64_t>> events;
+  events.reserve(ranges_list_.size() * 2);
+  for (size_t i = 0; i < ranges_list_.size(); ++i) {
+    events.emplace_back(ranges_list_[i].lo, (int64_t)i + 1);
+    events.emplace_back(ranges_list_[i].hi, -(int64_t)i - 1);
+  }
+  std::sort(events.begin(), events.end());
+  std::set<std::pair<uint32_t, uint32_t>> active;
+  for (size_t i = 0; i < events.size();) {
+    uint64_t at = events[i].first;
+    for (; i < events.size() && events[i].first == at; ++i) {
+      int64_t e = events[i].second;
+      const Range &r = ranges_list_[(e > 0 ? e : -e) - 1];
+      if (e > 0)
+        active.emplace(r.depth, r.inl);
+      else
+        active.erase(std::make_pair(r.depth, r.inl));
+    }
+    uint32_t leaf = active.empty() ? 0 : active.rbegin()->second;
+    if (t_->inline_leaves_.empty() ? leaf != 0
+                                   : t_->inline_leaves_.back() != leaf) {
+      t_->inline_starts_.push_back(at);
+      t_->inline_leaves_.push_back(leaf);
+    }
+  }
+}
+
+bool LineTable::Builder::build(struct bcc_elf_file *elf) {
+  info_ = section(elf, ".debug_info");
+  line_ = section(elf, ".debug_line");
+  if (!line_.data)
+    return false;
+  abbrev_ = section(elf, ".debug_abbrev");
+  str_ = section(elf, ".debug_str");
+  line_str_ = section(elf, ".debug_line_str");
+  str_offsets_ = section(elf, ".debug_str_offsets");
+  addr_ = section(elf, ".debug_addr");
+  ranges_ = section(elf, ".debug_ranges");
+  rnglists_ = section(elf, ".debug_rnglists");
+
+  DwarfReader r = reader(info_);
+  while (r.ok() && !r.done())
+    read_unit(r, r.offset());
+  finish();
+  return !t_->line_starts_.empty() || !t_->inline_starts_.empty();
+}
+
+std::unique_ptr<LineTable> LineTable::load(const std::string &path) {
+  char debug_path[PATH_MAX];
+  struct bcc_elf_file *elf = bcc_elf_open(path.c_str());
+  if (!elf)
+    return nullptr;
+  if (bcc_elf_file_find_debug_file(elf, debug_path, sizeof(debug_path)) < 0) {
+    bcc_elf_close(elf);
+    return nullptr;
+  }
+  if (path != debug_path) {
+    bcc_elf_close(elf);
+    elf = bcc_elf_open(debug_path);
+    if (!elf)
+      return nullptr;
+  }
+
+  std::unique_ptr<LineTable> table(new LineTable());
+  bool ok = Builder(table.get()).build(elf);
+  bcc_elf_close(elf);
+  if (!ok)
+    return nullptr;
+  table->strings_.shrink_to_fit();
+  return table;
+}
+
+size_t LineTable::lookup(uint64_t addr, std::vector<Frame> *frames) const {
+  frames->clear();
+
+  const char *file = nullptr;
+  uint32_t line = 0;
+  auto it = std::upper_bound(line_starts_.begin(), line_starts_.end(), addr);
+  if (it != line_starts_.begin()) {
+    size_t i = it - line_starts_.begin() - 1;
+    if (line_files_[i]) {
+      file = str(files_[line_files_[i] - 1]);
+      line = lines_[i];
+    }
+  }
+
+  uint32_t leaf = 0;
+  auto jt = std::upper_bound(inline_starts_.begin(), inline_starts_.end(), addr);
+  if (jt != inline_starts_.begin())
+    leaf = inline_leaves_[jt - inline_starts_.begin() - 1];
+  if (!file && !leaf)
+    return 0;
+
+  frames->push_back({leaf ? str(inlines_[leaf - 1].function) : nullptr, file,
+                     line});
+  // each inlined call is at a line of the function it was inlined into
+  for (uint32_t cur = leaf; cur; cur = inlines_[cur - 1].parent) {
+    const Inline &inl = inlines_[cur - 1];
+    frames->push_back(
+        {inl.parent ? str(inlines_[inl.parent - 1].function) : nullptr,
+         inl.call_file ? str(files_[inl.call_file - 1]) : nullptr,
+         inl.call_line});
+    // a malformed chain must not loop
+    if (frames->size() > inlines_.size() + 1)
+      break;
+  }
+  return frames->size();
+}
+
+size_t LineTable::memory() const {
+  return line_starts_.capacity() * sizeof(uint64_t) +
+         line_files_.capacity() * sizeof(uint32_t) +
+         lines_.capacity() * sizeof(uint32_t) +
+         inline_starts_.capacity() * sizeof(uint64_t) +
+         inline_leaves_.capacity() * sizeof(uint32_t) +
+         inlines_.capacity() * sizeof(Inline) + strings_.capacity() +
+         files_.capacity() * sizeof(uint32_t);
+}
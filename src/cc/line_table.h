@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+// Source lines and inlined calls of one ELF file, read from the DWARF
+// .debug_line and .debug_info of the file or of its separate debug file.
+// Both are flattened into address ranges sorted by start, kept in parallel
+// arrays: one of file and line per range, and one of the innermost inlined
+// call per range, whose callers are reached through parent links. A lookup
+// is a binary search in each.
+class LineTable {
+public:
+  struct Frame {
+    // NULL for the function the code was inlined into, which the ELF symbol
+    // names
+    const char *function;
+    // NULL when the line is unknown
+    const char *file;
+    uint32_t line;
+  };
+
+private:
+  struct Inline {
+    uint32_t function;
+    uint32_t call_file;
+    uint32_t call_line;
+    // index + 1 of the inlined call this one is part of, 0 for none
+    uint32_t parent;
+  };
+
+  std::vector<uint64_t> line_starts_;
+  // file index + 1, 0 for the gaps between sequences
+  std::vector<uint32_t> line_files_;
+  std::vector<uint32_t> lines_;
+
+  std::vector<uint64_t> inline_starts_;
+  // index + 1 of the innermost inlined call, 0 for none
+  std::vector<uint32_t> inline_leaves_;
+  std::vector<Inline> inlines_;
+
+  // file paths and function names
+  std::vector<char> strings_;
+  std::vector<uint32_t> files_;
+
+  class Builder;
+  const char *str(uint32_t off) const { return &strings_[off]; }
+
+public:
+  // NULL if path, or its debug file, has no line information
+  static std::unique_ptr<LineTable> load(const std::string &path);
+
+  // frames of the code at the link time address addr, from the innermost
+  // inlined call out to the function it is all part of; returns how many
+  size_t lookup(uint64_t addr, std::vector<Frame> *frames) const;
+  size_t memory() const;
+};
@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <linux/bpf.h>
+
+#include "prog_split.h"
+
+namespace ebpf {
+
+using std::vector;
+
+// mov r1, ctx; r2 = prog_array; r3 = slot; call tail_call; r0 = 0; exit
+static const size_t STUB_LEN = 7;
+static const int FP_REG = 10;
+
+static struct bpf_insn make_insn(uint8_t code, uint8_t dst, uint8_t src,
+                                 int16_t off, int32_t imm) {
+  struct bpf_insn insn = {};
+  insn.code = code;
+  insn.dst_reg = dst;
+  insn.src_reg = src;
+  insn.off = off;
+  insn.imm = imm;
+  return insn;
+}
+
+static bool is_ld_imm64(const struct bpf_insn &insn) {
+  return insn.code == (BPF_LD | BPF_DW | BPF_IMM);
+}
+
+static int mem_size(const struct bpf_insn &insn) {
+  switch (BPF_SIZE(insn.code)) {
+  case BPF_B: return 1;
+  case BPF_H: return 2;
+  case BPF_W: return 4;
+  }
+  return 8;
+}
+
+// successors of insn i, returns the count
+static int successors(const struct bpf_insn *insns, size_t i, size_t succ[2]) {
+  const struct bpf_insn &insn = insns[i];
+  if (is_ld_imm64(insn)) {
+    succ[0] = i + 2;
+    return 1;
+  }
+  if (BPF_CLASS(insn.code) != BPF_JMP) {
+    succ[0] = i + 1;
+    return 1;
+  }
+  switch (BPF_OP(insn.code)) {
+  case BPF_EXIT:
+    return 0;
+  case BPF_CALL:
+    succ[0] = i + 1;
+    return 1;
+  case BPF_JA:
+    succ[0] = i + 1 + insn.off;
+    return 1;
+  }
+  succ[0] = i + 1;
+  succ[1] = i + 1 + insn.off;
+  return 2;
+}
+
+static void uses_defs(const struct bpf_insn &insn, unsigned *use, unsigned *def) {
+  unsigned dst = 1u << insn.dst_reg, src = 1u << insn.src_reg;
+  bool x = BPF_SRC(insn.code) == BPF_X;
+  *use = *def = 0;
+  switch (BPF_CLASS(insn.code)) {
+  case BPF_ALU:
+  case BPF_ALU64:
+    if (BPF_OP(insn.code) != BPF_MOV)
+      *use |= dst;
+    if (x && BPF_OP(insn.code) != BPF_NEG && BPF_OP(insn.code) != BPF_END)
+      *use |= src;
+    *def = dst;
+    break;
+  case BPF_LDX:
+    *use = src;
+    *def = dst;
+    break;
+  case BPF_ST:
+    *use = dst;
+    break;
+  case BPF_STX:
+    *use = dst | src;
+    break;
+  case BPF_LD:
+    if (BPF_MODE(insn.code) == BPF_IMM) {
+      *def = dst;
+    } else {
+      // packet loads implicitly use the skb in r6 and clobber r0-r5
+      *use = (1u << 6) | (BPF_MODE(insn.code) == BPF_IND ? src : 0);
+      *def = 0x3f;
+    }
+    break;
+  case BPF_JMP:
+    switch (BPF_OP(insn.code)) {
+    case BPF_CALL: *use = 0x3e; *def = 0x3f; break;
+    case BPF_EXIT: *use = 1; break;
+    case BPF_JA: break;
+    default: *use = dst | (x ? src : 0);
+    }
+    break;
+  }
+}
+
+ProgSplitter::ProgSplitter(const struct bpf_insn *insns, size_t insn_cnt,
+                           size_t max_insns)
+    : insns_(insns), insn_cnt_(insn_cnt), max_insns_(max_insns) {}
+
+void ProgSplitter::compute_liveness() {
+  live_.assign(insn_cnt_ + 2, 0);
+  max_reach_.assign(insn_cnt_ + 1, 0);
+  mid_insn_.assign(insn_cnt_ + 1, false);
+
+  // jumps only go forward, so a single backward pass is enough
+  for (size_t i = insn_cnt_; i-- > 0;) {
+    if (i > 0 && is_ld_imm64(insns_[i - 1]) && !mid_insn_[i - 1])
+      mid_insn_[i] = true;
+  }
+  for (size_t i = insn_cnt_; i-- > 0;) {
+    if (mid_insn_[i])
+      continue;
+    size_t succ[2];
+    unsigned use, def, out = 0;
+    int n = successors(insns_, i, succ);
+    for (int k = 0; k < n; ++k)
+      if (succ[k] <= insn_cnt_)
+        out |= live_[succ[k]];
+    uses_defs(insns_[i], &use, &def);
+    live_[i] = use | (out & ~def);
+  }
+
+  size_t reach = 0;
+  for (size_t i = 0; i < insn_cnt_; ++i) {
+    max_reach_[i] = reach;
+    if (mid_insn_[i] || is_ld_imm64(insns_[i]))
+      continue;
+    if (BPF_CLASS(insns_[i].code) == BPF_JMP) {
+      size_t succ[2];
+      int n = successors(insns_, i, succ);
+      if (BPF_OP(insns_[i].code) == BPF_JA || n == 2)
+        reach = std::max(reach, succ[n - 1]);
+    }
+  }
+  max_reach_[insn_cnt_] = reach;
+}
+
+static bool stack_range(int off, int size, int *lo, int *hi) {
+  if (off >= 0 || off < -512)
+    return false;
+  *lo = -off - std::min(size, -off);
+  *hi = -off - 1;
+  return true;
+}
+
+size_t ProgSplitter::scan(size_t start, const vector<int> &ctx_regs, bool must,
+                          vector<State> *states) const {
+  typedef RegState R;
+  vector<State> &st = *states;
+  st.assign(insn_cnt_ + 1, State());
+
+  State &init = st[start];
+  init.reached = true;
+  for (int r : ctx_regs)
+    init.regs[r].kind = R::CTX;
+  init.regs[FP_REG].kind = R::STACK;
+
+  size_t first_bad = insn_cnt_;
+  auto bad = [&](size_t i) {
+    if (must && first_bad == insn_cnt_)
+      first_bad = i;
+  };
+  // a byte that is not known to be written in this part is only a problem if
+  // it may have been written by an earlier part
+  auto check_read = [&](size_t i, const State &s, int off, int size) {
+    int lo, hi;
+    if (!must || !stack_range(off, size, &lo, &hi))
+      return;
+    for (int b = lo; b <= hi; ++b)
+      if (!s.written[b] && may_states_[i].written[b])
+        return bad(i);
+  };
+  auto mark = [](State &s, int off, int size) {
+    int lo, hi;
+    if (stack_range(off, size, &lo, &hi))
+      for (int b = lo; b <= hi; ++b)
+        s.written[b] = true;
+  };
+
+  for (size_t i = start; i < insn_cnt_; ++i) {
+    if (!st[i].reached || mid_insn_[i])
+      continue;
+    State s = st[i];
+    const struct bpf_insn &insn = insns_[i];
+    R &dst = s.regs[insn.dst_reg];
+    const R src = s.regs[insn.src_reg];
+
+    switch (BPF_CLASS(insn.code)) {
+    case BPF_LDX:
+      if (src.kind == R::TAINT)
+        bad(i);
+      else if (src.kind == R::STACK)
+        check_read(i, s, src.off + insn.off, mem_size(insn));
+      dst = R();
+      break;
+    case BPF_ST:
+    case BPF_STX:
+      if (dst.kind == R::TAINT) {
+        bad(i);
+      } else if (dst.kind == R::STACK) {
+        if (BPF_MODE(insn.code) == BPF_XADD)
+          check_read(i, s, dst.off + insn.off, mem_size(insn));
+        mark(s, dst.off + insn.off, mem_size(insn));
+      }
+      // spilled stack pointers can not be followed
+      if (BPF_CLASS(insn.code) == BPF_STX &&
+          (src.kind == R::STACK || src.kind == R::TAINT))
+        bad(i);
+      break;
+    case BPF_ALU:
+    case BPF_ALU64: {
+      bool x = BPF_SRC(insn.code) == BPF_X;
+      bool alu64 = BPF_CLASS(insn.code) == BPF_ALU64;
+      bool ptr_src = x && (src.kind == R::STACK || src.kind == R::TAINT);
+      if (BPF_OP(insn.code) == BPF_MOV) {
+        if (!x)
+          dst = R();
+        else if (alu64)
+          dst = src;
+        else
+          dst.kind = ptr_src ? R::TAINT : R::NONE;
+      } else if (alu64 && !x && dst.kind == R::STACK &&
+                 (BPF_OP(insn.code) == BPF_ADD || BPF_OP(insn.code) == BPF_SUB)) {
+        dst.off += BPF_OP(insn.code) == BPF_ADD ? insn.imm : -insn.imm;
+      } else if (ptr_src || dst.kind == R::STACK || dst.kind == R::TAINT) {
+        dst.kind = R::TAINT;
+      } else {
+        dst = R();
+      }
+      break;
+    }
+    case BPF_LD:
+      if (BPF_MODE(insn.code) == BPF_IMM)
+        dst = R();
+      else
+        for (int r = 0; r <= 5; ++r)
+          s.regs[r] = R();
+      break;
+    case BPF_JMP:
+      if (BPF_OP(insn.code) == BPF_CALL) {
+        for (int r = 1; r <= 5; ++r) {
+          const R &arg = s.regs[r];
+          if (arg.kind == R::TAINT) {
+            bad(i);
+          } else if (arg.kind == R::STACK) {
+            // the helper may read and fill the object; the size is not known
+            // here, so its first byte stands in for the whole object
+            check_read(i, s, arg.off, 1);
+            if (must)
+              mark(s, arg.off, 8);
+            else
+              mark(s, arg.off, -arg.off);
+          }
+        }
+        for (int r = 0; r <= 5; ++r)
+          s.regs[r] = R();
+      }
+      break;
+    }
+
+    size_t succ[2];
+    int n = successors(insns_, i, succ);
+    for (int k = 0; k < n; ++k) {
+      if (succ[k] >= insn_cnt_)
+        continue;
+      State &next = st[succ[k]];
+      if (!next.reached) {
+        next = s;
+        continue;
+      }
+      for (int r = 0; r < 11; ++r) {
+        R &a = next.regs[r];
+        const R &b = s.regs[r];
+        if (a == b)
+          continue;
+        bool ptr = a.kind == R::STACK || a.kind == R::TAINT ||
+                   b.kind == R::STACK || b.kind == R::TAINT;
+        a = R();
+        if (ptr)
+          a.kind = R::TAINT;
+      }
+      if (must)
+        next.written &= s.written;
+      else
+        next.written |= s.written;
+    }
+  }
+  return first_bad;
+}
+
+bool ProgSplitter::cut_ok(size_t c, const State &st, vector<int> *ctx_regs,
+                          int *ctx_src) const {
+  if (mid_insn_[c] || max_reach_[c] > c || !st.reached)
+    return false;
+
+  ctx_regs->clear();
+  *ctx_src = -1;
+  for (int r = 0; r < FP_REG; ++r) {
+    bool is_ctx = st.regs[r].kind == RegState::CTX;
+    if (is_ctx && (*ctx_src < 0 || r == 1))
+      *ctx_src = r;
+    if (!(live_[c] & (1u << r)))
+      continue;
+    if (!is_ctx)
+      return false;
+    ctx_regs->push_back(r);
+  }
+  return *ctx_src >= 0;
+}
+
+bool ProgSplitter::find_cuts() {
+  cuts_.clear();
+  cut_ctx_regs_.clear();
+  cut_ctx_src_.clear();
+  if (insn_cnt_ <= max_insns_)
+    return true;
+  if (max_insns_ <= STUB_LEN + 11)
+    return false;
+
+  compute_liveness();
+  scan(0, {1}, false, &may_states_);
+
+  size_t start = 0;
+  vector<int> ctx_regs = {1};
+  vector<State> states;
+  while (true) {
+    // parts after the first copy the context from r1 into the live registers
+    size_t prefix = 0;
+    for (int r : ctx_regs)
+      prefix += r != 1;
+
+    size_t first_bad = scan(start, ctx_regs, true, &states);
+    if (first_bad == insn_cnt_ && prefix + insn_cnt_ - start <= max_insns_)
+      return true;
+
+    size_t limit = std::min(first_bad, start + max_insns_ - prefix - STUB_LEN);
+    size_t c;
+    vector<int> next_regs;
+    int ctx_src = -1;
+    for (c = limit; c > start; --c)
+      if (cut_ok(c, states[c], &next_regs, &ctx_src))
+        break;
+    if (c == start)
+      return false;
+
+    cuts_.push_back(c);
+    cut_ctx_src_.push_back(ctx_src);
+    cut_ctx_regs_.push_back(next_regs);
+    start = c;
+    next_regs.push_back(1);
+    std::sort(next_regs.begin(), next_regs.end());
+    next_regs.erase(std::unique(next_regs.begin(), next_regs.end()), next_regs.end());
+    ctx_regs = next_regs;
+  }
+}
+
+void ProgSplitter::build(int prog_array_fd, vector<vector<struct bpf_insn>> *parts) const {
+  parts->clear();
+  size_t start = 0;
+  for (size_t k = 0; k <= cuts_.size(); ++k) {
+    size_t end = k < cuts_.size() ? cuts_[k] : insn_cnt_;
+    vector<struct bpf_insn> part;
+    if (k > 0)
+      for (int r : cut_ctx_regs_[k - 1])
+        if (r != 1)
+          part.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_X, r, 1, 0, 0));
+    part.insert(part.end(), insns_ + start, insns_ + end);
+    if (k < cuts_.size()) {
+      part.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_X, 1, cut_ctx_src_[k], 0, 0));
+      part.push_back(make_insn(BPF_LD | BPF_DW | BPF_IMM, 2, BPF_PSEUDO_MAP_FD, 0,
+                               prog_array_fd));
+      part.push_back(make_insn(0, 0, 0, 0, 0));
+      part.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, k + 1));
+      part.push_back(make_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_tail_call));
+      part.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, 0));
+      part.push_back(make_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+    }
+    parts->push_back(part);
+    start = end;
+  }
+}
+
+}  // namespace ebpf
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <bitset>
+#include <vector>
+
+struct bpf_insn;
+
+namespace ebpf {
+
+// Splitting of programs that exceed BPF_MAXINSNS into a chain of programs
+// connected with bpf_tail_call through a BPF_MAP_TYPE_PROG_ARRAY.
+//
+// A program can be cut in front of instruction i when no jump crosses i, the
+// only live registers at i hold the context pointer, and the code after i does
+// not read stack memory written before i. Part k ends with a tail call into
+// slot k + 1 of the prog array; parts after the first start by restoring the
+// context register from r1.
+class ProgSplitter {
+ public:
+  ProgSplitter(const struct bpf_insn *insns, size_t insn_cnt, size_t max_insns);
+
+  // compute the cut points, returns false if the program cannot be split
+  bool find_cuts();
+  size_t num_parts() const { return cuts_.size() + 1; }
+  // emit the parts, the stubs refer to prog_array_fd
+  void build(int prog_array_fd, std::vector<std::vector<struct bpf_insn>> *parts) const;
+
+ private:
+  struct RegState {
+    enum Kind { NONE = 0, CTX, STACK, TAINT };
+    Kind kind = NONE;
+    int off = 0;
+    bool operator==(const RegState &o) const { return kind == o.kind && off == o.off; }
+  };
+  struct State {
+    bool reached = false;
+    RegState regs[11];
+    std::bitset<512> written;  // stack bytes written, indexed by -offset - 1
+  };
+
+  void compute_liveness();
+  // Propagate register and stack state forward from start. With must set,
+  // joins intersect the written stack bytes and the index of the first
+  // instruction that reads stack written before start is returned.
+  size_t scan(size_t start, const std::vector<int> &ctx_regs, bool must,
+              std::vector<State> *states) const;
+  bool cut_ok(size_t c, const State &st, std::vector<int> *ctx_regs,
+              int *ctx_src) const;
+
+  const struct bpf_insn *insns_;
+  size_t insn_cnt_;
+  size_t max_insns_;
+  std::vector<unsigned> live_;      // bitmask of registers live before insn i
+  std::vector<size_t> max_reach_;   // furthest jump target from [0, i)
+  std::vector<bool> mid_insn_;      // second half of a ld_imm64
+  std::vector<State> may_states_;   // stack possibly written before insn i
+  std::vector<size_t> cuts_;
+  std::vector<std::vector<int>> cut_ctx_regs_;
+  std::vector<int> cut_ctx_src_;
+};
+
+}  // namespace ebpf
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "bcc_stacks.h"
+#include "syms.h"
+
+// Counted stacks of a profile, as a counts map and a stack trace map hold
+// them, turned into a report. Stacks are read once per stack id and
+// addresses symbolized once per process and address, in batches.
+class StackReport {
+public:
+  struct Sample {
+    uint32_t pid;
+    std::string comm;
+    // negative when there is none, as from get_stackid
+    int user_stack;
+    int kernel_stack;
+    uint64_t kernel_ip;
+    uint64_t count;
+  };
+
+private:
+  struct Frame {
+    uint64_t addr;
+    const char *name;
+    bool kernel;
+  };
+
+  int flags_;
+  std::vector<Sample> samples_;
+  std::unordered_map<int, std::vector<uint64_t>> stacks_;
+  size_t missing_;
+  size_t out_of_room_;
+
+  std::unique_ptr<KSyms> ksyms_;
+  std::unordered_map<uint32_t, std::unique_ptr<ProcSyms>> procs_;
+  std::unordered_map<uint64_t, const char *> kernel_names_;
+  std::unordered_map<uint32_t, std::unordered_map<uint64_t, const char *>>
+      user_names_;
+
+  void symbolize();
+  // frames of a sample from the root down, user then kernel
+  void frames(const Sample &s, std::vector<Frame> *out);
+
+public:
+  explicit StackReport(int flags = 0)
+      : flags_(flags), missing_(0), out_of_room_(0) {}
+
+  // append the samples of a counts map
+  static bool read_samples(int counts_fd, const struct bcc_stack_key &key,
+                           std::vector<Sample> *samples);
+  // read the counts and the stacks their keys refer to
+  bool read(int counts_fd, int stacks_fd, const struct bcc_stack_key &key);
+  void add_sample(const Sample &sample) { samples_.push_back(sample); }
+  // ips of a stack, innermost first
+  void add_stack(int id, const std::vector<uint64_t> &ips) { stacks_[id] = ips; }
+  // samples whose stacks could not be read
+  size_t missing() const { return missing_; }
+  // samples with a stack the stack trace map had no room for, -ENOMEM
+  size_t out_of_room() const { return out_of_room_; }
+
+  // one "comm;root;...;leaf count" line per distinct stack
+  std::string folded();
+  // an uncompressed pprof profile.proto
+  std::string pprof();
+};
+
+// Deletes the stacks of a stack trace map that no counts map refers to any
+// more, so that long running tools keep room for new stacks. A stack is only
+// deleted once it was unreferenced at two consecutive passes: one that was
+// just stored may not be counted yet.
+class StackReclaimer {
+  int stacks_fd_;
+  int max_entries_;
+  // ids that were in the map and unreferenced at the last pass
+  std::unordered_set<uint32_t> unreferenced_;
+
+public:
+  StackReclaimer(int stacks_fd, int max_entries)
+      : stacks_fd_(stacks_fd), max_entries_(max_entries) {}
+
+  // ids in a stack trace map, false if they cannot be listed
+  static bool stack_ids(int stacks_fd, int max_entries,
+                        std::vector<uint32_t> *ids);
+  // the number of stacks deleted, -1 on error
+  int reclaim(const int *counts_fds, const struct bcc_stack_key *keys, int n);
+};
@@ -16,13 +16,24 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 #include <sys/types.h>
 
+#include "line_table.h"
+#include "unwind_table.h"
+
+struct bcc_elf_file;
+struct bcc_user_regs;
+
 class ProcStat {
   std::string procfs_;
   ino_t inode_;
@@ -34,80 +45,431 @@ public:
   void reset() { inode_ = getinode_(); }
 };
 
+// Caches can be used from several threads at once. The names of a result
+// stay valid for as long as the module it is in: a miss may reload the
+// modules, which drops those whose mappings went away, all of them once the
+// process exec'ed, and for KSyms all kernel modules when they changed.
 class SymbolCache {
+protected:
+  bool demangle_ = true;
+
 public:
+  // caches check for changes only after a lookup misses, and then at most
+  // once per interval
+  static const uint64_t DEFAULT_CHECK_INTERVAL_MS = 1000;
+
   virtual ~SymbolCache() = default;
 
+  // when off, bcc_symbol.demangle_name is the raw symbol name
+  void set_demangle(bool demangle) { demangle_ = demangle; }
+
   virtual void refresh() = 0;
+  // load ahead whatever lookups would otherwise load on first use
+  virtual void prefetch() {}
   virtual bool resolve_addr(uint64_t addr, struct bcc_symbol *sym) = 0;
   virtual bool resolve_name(const char *module, const char *name,
                             uint64_t *addr) = 0;
+  // resolves addrs in address order, each distinct address once; returns the
+  // number of addresses that resolved
+  virtual size_t resolve_batch(const uint64_t *addrs, size_t n,
+                               struct bcc_symbol *out);
+  // source frames of addr, innermost inlined call first, from the DWARF of
+  // its module; returns how many, 0 where there is no debug info
+  virtual size_t resolve_source(uint64_t addr,
+                                std::vector<LineTable::Frame> *frames) {
+    frames->clear();
+    return 0;
+  }
+  // return addresses of a sampled user stack, innermost first, unwound from
+  // regs and a copy of size bytes of the stack from regs->sp up, with the
+  // call frame information of the modules; returns how many, at most max
+  virtual size_t unwind(const struct bcc_user_regs *regs, const void *stack,
+                        size_t size, uint64_t *ips, size_t max) {
+    return 0;
+  }
+  // bytes the cache holds, with the symbol tables it shares with other caches
+  // counted for their share
+  virtual size_t memory() const { return 0; }
+};
+
+// Symbols of one ELF file, perf map or kallsyms, sorted by start address and
+// kept as parallel arrays: names in a single string arena, starts relative to
+// the lowest one when the table spans less than 4GB, and 32-bit sizes. Symbols
+// are added and then finalized, after which the table does not change. A
+// finalized table can be saved to an index file and mapped back later.
+class SymbolTable {
+  struct Pending {
+    uint32_t name;
+    uint64_t start;
+    uint64_t size;
+    int flags;
+    uint32_t group;
+
+    bool operator<(const Pending &rhs) const { return start < rhs.start; }
+  };
+  struct Segment {
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t size;
+  };
+
+  std::vector<Pending> pending_;
+  std::vector<char> arena_;
+  std::vector<uint32_t> names_;
+  uint64_t base_;
+  std::vector<uint32_t> starts32_;
+  std::vector<uint64_t> starts64_;
+  std::vector<uint32_t> sizes_;
+  std::vector<uint8_t> flags_;
+  // arena offset + 1 of the group name of each symbol, 0 for none
+  std::vector<uint32_t> groups_;
+  std::unordered_map<std::string, uint32_t> pending_groups_;
+  // loadable segments of the ELF file, to place the symbols of a mapping
+  std::vector<Segment> segments_;
+
+  // the arrays, pointing into the vectors above or into a mapped index
+  size_t count_;
+  const char *arena_p_;
+  size_t arena_size_;
+  const uint32_t *names_p_;
+  const uint32_t *starts32_p_;
+  const uint64_t *starts64_p_;
+  const uint32_t *sizes_p_;
+  const uint8_t *flags_p_;
+  const uint32_t *groups_p_;
+  const Segment *segments_p_;
+  size_t nsegments_;
+  void *map_;
+  size_t map_size_;
+
+  // open addressed, holds symbol index + 1; built on the first find_name
+  // since most tables are only used by address
+  mutable std::once_flag name_index_once_;
+  mutable std::vector<uint32_t> name_index_;
+  void build_name_index() const;
+
+  // demangled names, filled in on request and kept in blocks that never move
+  mutable std::mutex demangle_mutex_;
+  mutable std::vector<const char *> demangled_;
+  mutable std::vector<std::unique_ptr<char[]>> demangle_blocks_;
+  mutable char *demangle_block_end_ = nullptr;
+  mutable size_t demangle_block_left_ = 0;
+  const char *store_demangled(const char *name) const;
+
+  // read from the DWARF of the file on first use, as few callers want it
+  mutable std::once_flag lines_once_;
+  mutable std::unique_ptr<LineTable> lines_;
+  mutable std::once_flag unwind_once_;
+  mutable std::unique_ptr<UnwindTable> unwind_;
+
+public:
+  SymbolTable();
+  ~SymbolTable();
+
+  // group names a set of symbols within the table, such as a kernel module
+  void add(const char *name, uint64_t start, uint64_t size, int flags,
+           const char *group = nullptr);
+  void add_segment(uint64_t offset, uint64_t vaddr, uint64_t size);
+  void finalize();
+
+  // write a finalized table to path, replacing it atomically
+  bool save_index(const std::string &path) const;
+  // map a table written by save_index into this empty table
+  bool load_index(const std::string &path);
+
+  size_t count() const { return count_; }
+  const char *name(size_t i) const { return arena_p_ + names_p_[i]; }
+  uint64_t start(size_t i) const {
+    return starts64_p_ ? starts64_p_[i] : base_ + starts32_p_[i];
+  }
+  uint64_t size(size_t i) const { return sizes_p_[i]; }
+  int flags(size_t i) const { return flags_p_[i]; }
+  const char *group(size_t i) const {
+    return groups_p_ && groups_p_[i] ? arena_p_ + groups_p_[i] - 1 : nullptr;
+  }
+  // C++ name of symbol i, or its raw name if it is not mangled
+  const char *demangled(size_t i) const;
+  // bytes held by the table
+  size_t memory() const;
+
+  // last symbol starting at or below addr, or -1
+  ssize_t find_preceding(uint64_t addr) const;
+  // the same, searching forward from symbol from, which starts at or below
+  // addr, so that a walk over ascending addresses stays close to the cursor
+  ssize_t find_preceding(uint64_t addr, size_t from) const;
+  // symbol whose [start, start + size) holds addr, or -1
+  ssize_t find_addr(uint64_t addr) const;
+  // lowest addressed symbol called name, or -1
+  ssize_t find_name(const char *name) const;
+  // virtual address that file offset is loaded at, false if no segment has it
+  bool file_vaddr(uint64_t offset, uint64_t *vaddr) const;
+  // source lines of path, the file the table was read from, or NULL
+  const LineTable *lines(const std::string &path) const;
+  // call frame information of path, or NULL
+  const UnwindTable *unwind(const std::string &path) const;
+
+  static int _add_symbol(const char *symname, uint64_t start, uint64_t end,
+                         int flags, void *p);
+  static int _add_segment(uint64_t offset, uint64_t vaddr, uint64_t size,
+                          void *p);
 };
 
-class KSyms : SymbolCache {
-  struct Symbol {
-    Symbol(const char *name, uint64_t addr) : name(name), addr(addr) {}
-    std::string name;
-    uint64_t addr;
+// Symbols of a /tmp/perf-PID.map, which JIT runtimes keep appending to.
+// update() reads the lines added since the last call into a new run sorted by
+// address. Lookups go from the newest run to the oldest and skip entries that
+// newer ones overlap, so code cache addresses reused by the runtime resolve to
+// their latest symbol. Runs of similar sizes are merged as they come in,
+// keeping their number logarithmic.
+// Names live in blocks that are never moved or freed.
+class PerfMapTable {
+  struct Entry {
+    uint64_t start;
+    uint64_t size;
+    const char *name;
 
-    bool operator<(const Symbol &rhs) const { return addr < rhs.addr; }
+    bool operator<(const Entry &rhs) const { return start < rhs.start; }
   };
+  typedef std::vector<Entry> Run;
 
-  std::vector<Symbol> syms_;
-  std::unordered_map<std::string, uint64_t> symnames_;
-  static void _add_symbol(const char *, uint64_t, void *);
+  std::vector<Run> runs_;
+  uint64_t offset_;
+  ino_t ino_;
+  std::vector<Entry> pending_;
+  std::vector<std::unique_ptr<char[]>> name_blocks_;
+  char *name_block_end_;
+  size_t name_block_left_;
+  size_t name_bytes_;
+
+  const char *store_name(const char *name);
+  // merges the entries of an older run that newer ones do not cover
+  static Run merge(const Run &newer, const Run &older);
+  // whether a run newer than run overlaps e, which then no longer applies
+  bool shadowed(size_t run, const Entry &e) const;
+  static int _add_symbol(const char *symname, uint64_t start, uint64_t size,
+                         int flags, void *p);
 
 public:
+  PerfMapTable()
+      : offset_(0), ino_(0), name_block_end_(nullptr), name_block_left_(0),
+        name_bytes_(0) {}
+
+  // read the lines appended to path since the last update, true if any
+  bool update(const std::string &path);
+  bool find_addr(uint64_t addr, const char **name, uint64_t *start) const;
+  bool find_name(const char *name, uint64_t *addr) const;
+  size_t memory() const;
+};
+
+// Kernel symbols. Those of the kernel image are loaded once; those of
+// modules and bpf programs are reloaded when /proc/modules changes, checked
+// at most once per interval when an address resolves outside of the image.
+class KSyms : public SymbolCache {
+  SymbolTable kernel_;
+  std::unique_ptr<SymbolTable> modules_;
+  // groups that are not modules, like [bpf], change without /proc/modules
+  // changing and are never saved to an index
+  std::unique_ptr<SymbolTable> live_;
+  std::set<std::string> module_names_;
+  std::string modules_key_;
+  bool loaded_;
+  std::atomic<uint64_t> check_interval_ms_;
+  uint64_t last_check_ms_;
+  // lookups are short, one at a time is enough
+  mutable std::mutex mutex_;
+
+  struct LoadState {
+    SymbolTable *kernel;
+    SymbolTable *modules;
+    SymbolTable *live;
+    const std::set<std::string> *module_names;
+  };
+  struct Cursors {
+    size_t kernel, modules, live;
+  };
+  static void _add_symbol(const char *, uint64_t, char, const char *, void *);
+  void load(bool reload_modules);
+  bool load_live();
+  bool check_modules();
+  // lookup searching forward from a symbol cursor in each table; outside is
+  // set for addresses beyond the image, which a module loaded since may hold
+  bool find_addr(uint64_t addr, struct bcc_symbol *sym, Cursors *cursors,
+                 bool *outside);
+
+public:
+  KSyms();
+  void set_check_interval(uint64_t ms) { check_interval_ms_ = ms; }
   virtual bool resolve_addr(uint64_t addr, struct bcc_symbol *sym);
+  virtual size_t resolve_batch(const uint64_t *addrs, size_t n,
+                               struct bcc_symbol *out);
   virtual bool resolve_name(const char *unused, const char *name,
                             uint64_t *addr);
   virtual void refresh();
+  virtual size_t memory() const;
 };
 
-class ProcSyms : SymbolCache {
-  struct Symbol {
-    Symbol(const std::string *name, uint64_t start, uint64_t size, int flags = 0)
-        : name(name), start(start), size(size), flags(flags) {}
-    const std::string *name;
-    uint64_t start;
-    uint64_t size;
-    int flags;
+// Process-wide cache of ELF symbol tables keyed by file identity and by
+// build-id, so that a library mapped by many processes, or present in many
+// containers, is parsed only once, even when several threads ask for it at
+// the same time. Past the capacity the
+// least recently used tables are dropped from the cache; modules that still
+// reference one keep it alive.
+class SymbolTableCache {
+  struct FileKey {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    off_t size;
 
-    bool operator<(const struct Symbol& rhs) const {
-      return start < rhs.start;
+    bool operator==(const FileKey &rhs) const {
+      return dev == rhs.dev && ino == rhs.ino && mtime == rhs.mtime &&
+             size == rhs.size;
+    }
+  };
+  struct FileKeyHash {
+    size_t operator()(const FileKey &k) const {
+      return std::hash<uint64_t>()(((uint64_t)k.dev << 32) ^ k.ino ^
+                                   ((uint64_t)k.mtime << 16));
     }
   };
+  typedef std::list<std::pair<FileKey, std::shared_ptr<const SymbolTable>>>
+      LruList;
+
+  std::mutex mutex_;
+  size_t capacity_;
+  LruList lru_;
+  std::unordered_map<FileKey, LruList::iterator, FileKeyHash> index_;
+  // files being parsed, other threads wanting them wait for the result
+  std::unordered_map<FileKey,
+                     std::shared_future<std::shared_ptr<const SymbolTable>>,
+                     FileKeyHash>
+      loading_;
+  // "<build-id>-<size>" of the loaded tables, an identical file found under
+  // another identity shares the table
+  std::unordered_map<std::string, std::weak_ptr<const SymbolTable>> by_buildid_;
+  std::string index_dir_;
+
+  SymbolTableCache();
+  void evict();
+  std::shared_ptr<SymbolTable> load(struct bcc_elf_file *elf,
+                                    const std::string &id);
+
+public:
+  static SymbolTableCache *instance();
+  // parse the symbols of path, or return the table of an identical file
+  std::shared_ptr<const SymbolTable> get(const std::string &path);
+  void set_capacity(size_t capacity);
+  size_t size();
 
+  // Directory of the symbol index files, keyed by build-id for ELF files
+  // and by boot for kallsyms. $BCC_SYMCACHE_DIR, and none if unset; an
+  // empty directory disables the index files. The directory and the files in
+  // it are only used if they belong to the effective user and nobody else
+  // can write to them.
+  void set_index_dir(const std::string &dir);
+  // path of the index file called name, empty if they are disabled
+  std::string index_path(const std::string &name);
+};
+
+struct bcc_mapping;
+
+class ProcSyms : public SymbolCache {
   struct Module {
-    Module(const char *name, uint64_t start, uint64_t end)
-        : name_(name), start_(start), end_(end) {}
+    Module(const char *name, const std::string &path, uint64_t start,
+           uint64_t end, uint64_t offset, uint64_t inode)
+        : name_(name), path_(path), start_(start), end_(end), offset_(offset),
+          inode_(inode), bias_(0), loaded_(false) {}
     std::string name_;
+    // where the file is read from, which differs from name_ once it is
+    // deleted or when pid is in another mount namespace
+    std::string path_;
     uint64_t start_;
     uint64_t end_;
-    std::unordered_set<std::string> symnames_;
-    std::vector<Symbol> syms_;
+    uint64_t offset_;
+    uint64_t inode_;
+    // runtime address minus link time address, known once the table is
+    uint64_t bias_;
+    std::shared_ptr<const SymbolTable> table_;
+    // the table is loaded once, by whichever thread needs it first
+    std::once_flag load_once_;
+    std::atomic<bool> loaded_;
+    // a perf map keeps growing while it is read
+    mutable std::mutex perf_map_mutex_;
+    std::unique_ptr<PerfMapTable> perf_map_table_;
 
     void load_sym_table();
-    bool find_addr(uint64_t addr, struct bcc_symbol *sym);
+    // read what was appended to a loaded perf map, true if anything was
+    bool update_perf_map();
+    // cursor is a symbol of the table at or below addr to search from, left
+    // at the symbol found; a perf map is read again on a miss if update is set
+    bool find_addr(uint64_t addr, struct bcc_symbol *sym, bool demangle,
+                   size_t *cursor = nullptr, bool update = true);
     bool find_name(const char *symname, uint64_t *addr);
-    bool is_so() const;
+    size_t find_source(uint64_t addr, std::vector<LineTable::Frame> *frames,
+                       bool demangle);
+    const UnwindTable *unwind_table();
     bool is_perf_map() const;
-
-    static int _add_symbol(const char *symname, uint64_t start, uint64_t end,
-                           int flags, void *p);
+    // the same file mapped at the same place
+    bool same_mapping(const Module &rhs) const;
+    size_t memory() const;
+  };
+  typedef std::shared_ptr<Module> ModulePtr;
+  struct Mappings {
+    // executable mappings sorted by start address, they do not overlap; a
+    // module stays the same for as long as its mapping does
+    std::vector<ModulePtr> modules;
+    // /tmp/perf-PID.map covers whatever no mapping does
+    ModulePtr perf_map;
+  };
+  struct LoadState {
+    ProcSyms *ps;
+    Mappings *mappings;
   };
 
   int pid_;
-  std::vector<Module> modules_;
+  // prefix of the paths of pid as seen from here, see bcc_procutils_mount_root
+  std::string root_;
+  // lookups take a snapshot through std::atomic_load, which a reload
+  // replaces
+  std::shared_ptr<const Mappings> mappings_;
+  // consecutive frames of a stack are usually in the same module
+  std::atomic<size_t> last_hit_;
+  // one reload at a time
+  std::mutex reload_mutex_;
   ProcStat procstat_;
+  std::atomic<uint64_t> check_interval_ms_;
+  std::atomic<uint64_t> last_check_ms_;
 
-  static int _add_module(const char *, uint64_t, uint64_t, void *);
-  bool load_modules();
+  static const unsigned MAX_PREFETCH_THREADS = 8;
+  static int _add_module(const struct bcc_mapping *map, void *payload);
+  bool load_modules(Mappings *mappings);
+  void reload_modules();
+  Module *find_module(const Mappings &mappings, uint64_t addr);
+  bool check_stale();
+  // one walk over the modules and their tables for the addresses at order,
+  // sorted by address; those that miss are appended to missed
+  size_t resolve_sorted(const Mappings &mappings, const uint64_t *addrs,
+                        const std::vector<size_t> &order,
+                        struct bcc_symbol *out, std::vector<size_t> *missed);
 
 public:
-  ProcSyms(int pid);
+  ProcSyms(int pid, bool prefetch = false);
+  void set_check_interval(uint64_t ms) { check_interval_ms_ = ms; }
   virtual void refresh();
+  // load the symbol tables of all modules on a few threads and return once
+  // they are loaded
+  virtual void prefetch();
   virtual bool resolve_addr(uint64_t addr, struct bcc_symbol *sym);
+  // misses read the perf maps again and check the mappings at most once
+  // per batch
+  virtual size_t resolve_batch(const uint64_t *addrs, size_t n,
+                               struct bcc_symbol *out);
   virtual bool resolve_name(const char *module, const char *name,
                             uint64_t *addr);
+  virtual size_t resolve_source(uint64_t addr,
+                                std::vector<LineTable::Frame> *frames);
+  // code without call frame information, such as JIT code, is unwound
+  // through its frame pointer if it keeps one
+  virtual size_t unwind(const struct bcc_user_regs *regs, const void *stack,
+                        size_t size, uint64_t *ips, size_t max);
+  virtual size_t memory() const;
 };
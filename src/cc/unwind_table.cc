@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <limits.h>
+#include <unordered_map>
+
+#include "bcc_elf.h"
+#include "dwarf_reader.h"
+#include "unwind_table.h"
+
+namespace {
+
+enum {
+  DW_CFA_nop = 0x00,
+  DW_CFA_set_loc = 0x01,
+  DW_CFA_advance_loc1 = 0x02,
+  DW_CFA_advance_loc2 = 0x03,
+  DW_CFA_advance_loc4 = 0x04,
+  DW_CFA_offset_extended = 0x05,
+  DW_CFA_restore_extended = 0x06,
+  DW_CFA_undefined = 0x07,
+  DW_CFA_same_value = 0x08,
+  DW_CFA_register = 0x09,
+  DW_CFA_remember_state = 0x0a,
+  DW_CFA_restore_state = 0x0b,
+  DW_CFA_def_cfa = 0x0c,
+  DW_CFA_def_cfa_register = 0x0d,
+  DW_CFA_def_cfa_offset = 0x0e,
+  DW_CFA_def_cfa_expression = 0x0f,
+  DW_CFA_expression = 0x10,
+  DW_CFA_offset_extended_sf = 0x11,
+  DW_CFA_def_cfa_sf = 0x12,
+  DW_CFA_def_cfa_offset_sf = 0x13,
+  DW_CFA_val_offset = 0x14,
+  DW_CFA_val_offset_sf = 0x15,
+  DW_CFA_val_expression = 0x16,
+  DW_CFA_GNU_args_size = 0x2e,
+  DW_CFA_GNU_negative_offset_extended = 0x2f,
+  // the high two bits of these carry the opcode, the low six an operand
+  DW_CFA_advance_loc = 0x40,
+  DW_CFA_offset = 0x80,
+  DW_CFA_restore = 0xc0,
+
+  DW_EH_PE_absptr = 0x00,
+  DW_EH_PE_uleb128 = 0x01,
+  DW_EH_PE_udata2 = 0x02,
+  DW_EH_PE_udata4 = 0x03,
+  DW_EH_PE_udata8 = 0x04,
+  DW_EH_PE_sleb128 = 0x09,
+  DW_EH_PE_sdata2 = 0x0a,
+  DW_EH_PE_sdata4 = 0x0b,
+  DW_EH_PE_sdata8 = 0x0c,
+  DW_EH_PE_pcrel = 0x10,
+  DW_EH_PE_omit = 0xff,
+
+  // x86-64 DWARF register numbers
+  REG_BP = 6,
+  REG_SP = 7,
+};
+
+}  // namespace
+
+class UnwindTable::Builder {
+  struct Rules {
+    Cfa cfa;
+    // the CFA is neither sp nor bp plus an offset, or a register that matters
+    // is saved where a row cannot say
+    bool unknown;
+    int32_t cfa_offset;
+    Rule ra;
+    int32_t ra_offset;
+    Rule bp;
+    int32_t bp_offset;
+  };
+  struct Cie {
+    bool ok;
+    uint64_t code_align;
+    int64_t data_align;
+    uint64_t ra_reg;
+    uint8_t fde_encoding;
+    bool augmented;
+    DwarfReader initial;
+  };
+  struct Range {
+    uint64_t start;
+    uint64_t end;
+
+    bool operator<(const Range &rhs) const { return start < rhs.start; }
+  };
+
+  UnwindTable *table_;
+  // the section being read, to place pc relative pointers
+  const uint8_t *section_;
+  uint64_t section_addr_;
+  bool eh_;
+  std::unordered_map<uint64_t, Cie> cies_;
+  // code the .eh_frame covers, which the .debug_frame then leaves alone
+  std::vector<Range> covered_;
+
+  bool read_encoded(DwarfReader &r, uint8_t encoding, uint64_t *value);
+  const Cie &cie(uint64_t offset, size_t size);
+  void set_reg(Rules *rules, const Cie &cie, uint64_t reg, Rule rule,
+               int64_t offset);
+  bool run(DwarfReader r, const Cie &cie, const Rules &initial, Rules *rules,
+           uint64_t *loc, uint64_t end, bool record);
+  void emit(uint64_t loc, const Rules &rules, size_t first);
+  void fde(DwarfReader r, const Cie &cie);
+
+public:
+  explicit Builder(UnwindTable *table)
+      : table_(table), section_(nullptr), section_addr_(0), eh_(false) {}
+
+  void section(const void *data, size_t size, uint64_t addr, bool eh);
+  void finish();
+};
+
+bool UnwindTable::Builder::read_encoded(DwarfReader &r, uint8_t encoding,
+                                        uint64_t *value) {
+  uint64_t field = section_addr_ + (r.data() - section_);
+  switch (encoding & 0x0f) {
+  case DW_EH_PE_absptr: *value = r.u64(); break;
+  case DW_EH_PE_uleb128: *value = r.uleb(); break;
+  case DW_EH_PE_udata2: *value = r.u16(); break;
+  case DW_EH_PE_udata4: *value = r.u32(); break;
+  case DW_EH_PE_udata8: *value = r.u64(); break;
+  case DW_EH_PE_sleb128: *value = r.sleb(); break;
+  case DW_EH_PE_sdata2: *value = (int16_t)r.u16(); break;
+  case DW_EH_PE_sdata4: *value = (int32_t)r.u32(); break;
+  case DW_EH_PE_sdata8: *value = r.u64(); break;
+  default: return false;
+  }
+  // addresses of code are absolute or relative to the field in practice, the
+  // other applications only show up in personality and LSDA pointers
+  switch (encoding & 0x70) {
+  case 0: break;
+  case DW_EH_PE_pcrel: *value += field; break;
+  default: return false;
+  }
+  return r.ok();
+}
+
+const UnwindTable::Builder::Cie &UnwindTable::Builder::cie(uint64_t offset,
+                                                           size_t size) {
+  auto it = cies_.find(offset);
+  if (it != cies_.end())
+    return it->second;
+  Cie &c = cies_[offset];
+  c.ok = false;
+
+  DwarfReader r(section_, size);
+  r.seek(offset);
+  bool dwarf64;
+  uint64_t len = r.initial_length(&dwarf64);
+  r = r.sub(len);
+  r.offset(dwarf64);
+  uint8_t version = r.u8();
+  const char *augmentation = r.cstr();
+  if (version >= 4) {
+    // address and segment selector sizes, only 8 and 0 are expected
+    if (r.u8() != 8 || r.u8() != 0)
+      return c;
+  }
+  c.code_align = r.uleb();
+  c.data_align = r.sleb();
+  c.ra_reg = version == 1 ? r.u8() : r.uleb();
+  c.fde_encoding = DW_EH_PE_absptr;
+  c.augmented = augmentation[0] == 'z';
+  if (augmentation[0] && !c.augmented)
+    return c;
+  if (c.augmented) {
+    DwarfReader aug = r.sub(r.uleb());
+    for (const char *a = augmentation + 1; *a; ++a) {
+      uint64_t unused;
+      if (*a == 'R') {
+        c.fde_encoding = aug.u8();
+      } else if (*a == 'L') {
+        aug.u8();
+      } else if (*a == 'P') {
+        if (!read_encoded(aug, aug.u8() & 0x0f, &unused))
+          return c;
+      } else if (*a != 'S' && *a != 'B') {
+        return c;
+      }
+    }
+  }
+  c.initial = r;
+  c.ok = r.ok();
+  return c;
+}
+
+void UnwindTable::Builder::set_reg(Rules *rules, const Cie &cie, uint64_t reg,
+                                   Rule rule, int64_t offset) {
+  if (reg == cie.ra_reg) {
+    rules->ra = rule;
+    rules->ra_offset = offset;
+  } else if (reg == REG_BP) {
+    rules->bp = rule;
+    rules->bp_offset = offset;
+  }
+}
+
+bool UnwindTable::Builder::run(DwarfReader r, const Cie &cie,
+                               const Rules &initial, Rules *rules,
+                               uint64_t *loc, uint64_t end, bool record) {
+  std::vector<Rules> remembered;
+  size_t first = table_->rows_.size();
+  uint64_t reg;
+
+  while (!r.done() && r.ok()) {
+    uint8_t op = r.u8();
+    uint64_t advance = 0;
+    bool restore = false;
+
+    switch (op & 0xc0) {
+    case DW_CFA_advance_loc:
+      advance = op & 0x3f;
+      break;
+    case DW_CFA_offset:
+      set_reg(rules, cie, op & 0x3f, RULE_OFFSET, r.uleb() * cie.data_align);
+      break;
+    case DW_CFA_restore:
+      reg = op & 0x3f;
+      restore = true;
+      break;
+    default:
+      switch (op) {
+      case DW_CFA_nop:
+        break;
+      case DW_CFA_GNU_args_size:
+        r.uleb();
+        break;
+      case DW_CFA_set_loc: {
+        uint64_t to;
+        if (!read_encoded(r, cie.fde_encoding, &to) || to < *loc)
+          return false;
+        if (record)
+          emit(*loc, *rules, first);
+        *loc = to;
+        break;
+      }
+      case DW_CFA_advance_loc1: advance = r.u8(); break;
+      case DW_CFA_advance_loc2: advance = r.u16(); break;
+      case DW_CFA_advance_loc4: advance = r.u32(); break;
+      case DW_CFA_offset_extended:
+        reg = r.uleb();
+        set_reg(rules, cie, reg, RULE_OFFSET, r.uleb() * cie.data_align);
+        break;
+      case DW_CFA_offset_extended_sf:
+        reg = r.uleb();
+        set_reg(rules, cie, reg, RULE_OFFSET, r.sleb() * cie.data_align);
+        break;
+      case DW_CFA_GNU_negative_offset_extended:
+        reg = r.uleb();
+        set_reg(rules, cie, reg, RULE_OFFSET, -(r.uleb() * cie.data_align));
+        break;
+      case DW_CFA_restore_extended:
+        reg = r.uleb();
+        restore = true;
+        break;
+      case DW_CFA_undefined:
+        set_reg(rules, cie, r.uleb(), RULE_UNDEFINED, 0);
+        break;
+      case DW_CFA_same_value:
+        set_reg(rules, cie, r.uleb(), RULE_SAME, 0);
+        break;
+      case DW_CFA_register:
+      case DW_CFA_val_offset:
+      case DW_CFA_val_offset_sf:
+        reg = r.uleb();
+        r.uleb();
+        if (reg == cie.ra_reg || reg == REG_BP)
+          rules->unknown = true;
+        break;
+      case DW_CFA_expression:
+      case DW_CFA_val_expression:
+        reg = r.uleb();
+        r.skip(r.uleb());
+        if (reg == cie.ra_reg || reg == REG_BP)
+          rules->unknown = true;
+        break;
+      case DW_CFA_remember_state:
+        remembered.push_back(*rules);
+        break;
+      case DW_CFA_restore_state:
+        if (remembered.empty())
+          return false;
+        *rules = remembered.back();
+        remembered.pop_back();
+        break;
+      case DW_CFA_def_cfa:
+      case DW_CFA_def_cfa_sf:
+        reg = r.uleb();
+        rules->cfa = reg == REG_SP ? CFA_SP : reg == REG_BP ? CFA_BP : CFA_NONE;
+        rules->cfa_offset = op == DW_CFA_def_cfa
+                                ? (int64_t)r.uleb()
+                                : r.sleb() * cie.data_align;
+        break;
+      case DW_CFA_def_cfa_register:
+        reg = r.uleb();
+        rules->cfa = reg == REG_SP ? CFA_SP : reg == REG_BP ? CFA_BP : CFA_NONE;
+        break;
+      case DW_CFA_def_cfa_offset:
+        rules->cfa_offset = r.uleb();
+        break;
+      case DW_CFA_def_cfa_offset_sf:
+        rules->cfa_offset = r.sleb() * cie.data_align;
+        break;
+      case DW_CFA_def_cfa_expression:
+        r.skip(r.uleb());
+        rules->cfa = CFA_NONE;
+        break;
+      default:
+        return false;
+      }
+    }
+
+    if (restore) {
+      if (reg == cie.ra_reg)
+        set_reg(rules, cie, reg, initial.ra, initial.ra_offset);
+      else if (reg == REG_BP)
+        set_reg(rules, cie, reg, initial.bp, initial.bp_offset);
+    }
+    if (advance) {
+      if (record)
+        emit(*loc, *rules, first);
+      *loc += advance * cie.code_align;
+    }
+  }
+  if (record && *loc < end)
+    emit(*loc, *rules, first);
+  return r.ok();
+}
+
+void UnwindTable::Builder::emit(uint64_t loc, const Rules &rules,
+                                size_t first) {
+  Row row;
+  row.start = loc;
+  row.cfa = rules.unknown ? CFA_NONE : rules.cfa;
+  row.cfa_offset = rules.cfa_offset;
+  row.ra = rules.ra;
+  row.ra_offset = rules.ra_offset;
+  row.bp = rules.bp;
+  row.bp_offset = rules.bp_offset;
+
+  std::vector<Row> &rows = table_->rows_;
+  // the last rules for an address are the ones that hold there
+  if (rows.size() > first && rows.back().start == loc)
+    rows.back() = row;
+  else
+    rows.push_back(row);
+}
+
+void UnwindTable::Builder::fde(DwarfReader r, const Cie &cie) {
+  uint64_t start, range;
+  if (!read_encoded(r, cie.fde_encoding, &start) ||
+      !read_encoded(r, cie.fde_encoding & 0x0f, &range) || !range)
+    return;
+  uint64_t end = start + range;
+  if (cie.augmented)
+    r.skip(r.uleb());
+
+  if (eh_) {
+    covered_.push_back(Range{start, end});
+  } else {
+    Range key{start, end};
+    auto it = std::upper_bound(covered_.begin(), covered_.end(), key);
+    if ((it != covered_.end() && it->start < end) ||
+        (it != covered_.begin() && (it - 1)->end > start))
+      return;
+  }
+
+  Rules initial = {CFA_NONE, false, 0, RULE_UNDEFINED, 0, RULE_SAME, 0};
+  uint64_t loc = start;
+  size_t first = table_->rows_.size();
+  if (!run(cie.initial, cie, initial, &initial, &loc, end, false))
+    return;
+  Rules rules = initial;
+  if (!run(r, cie, initial, &rules, &loc, end, true)) {
+    table_->rows_.resize(first);
+    return;
+  }
+
+  Row stop = {};
+  stop.start = end;
+  stop.cfa = CFA_NONE;
+  table_->rows_.push_back(stop);
+}
+
+void UnwindTable::Builder::section(const void *data, size_t size,
+                                   uint64_t addr, bool eh) {
+  section_ = static_cast<const uint8_t *>(data);
+  section_addr_ = addr;
+  eh_ = eh;
+  cies_.clear();
+
+  DwarfReader r(data, size);
+  while (!r.done()) {
+    bool dwarf64;
+    uint64_t len = r.initial_length(&dwarf64);
+    if (!r.ok())
+      break;
+    // a zero length ends .eh_frame
+    if (!len)
+      break;
+    DwarfReader entry = r.sub(len);
+    if (!r.ok())
+      break;
+
+    // in .eh_frame, FDEs point back to their CIE relative to this field; in
+    // .debug_frame, they hold its section offset
+    uint64_t id_offset = entry.data() - section_;
+    uint64_t id = entry.offset(dwarf64);
+    if (eh ? id == 0 : id == (dwarf64 ? ~0ull : 0xffffffffull))
+      continue;
+    uint64_t cie_offset = eh ? id_offset - id : id;
+    if (cie_offset >= size)
+      continue;
+    const Cie &c = cie(cie_offset, size);
+    if (c.ok)
+      fde(entry, c);
+  }
+
+  if (eh)
+    std::sort(covered_.begin(), covered_.end());
+}
+
+void UnwindTable::Builder::finish() {
+  std::vector<Row> &rows = table_->rows_;
+  std::stable_sort(rows.begin(), rows.end(),
+                   [](const Row &a, const Row &b) { return a.start < b.start; });
+
+  // where one FDE ends as the next starts, keep the rules of the next; then
+  // drop the rows that change nothing
+  size_t n = 0;
+  for (size_t i = 0; i < rows.size(); ++i) {
+    const Row &row = rows[i];
+    if (n && rows[n - 1].start == row.start) {
+      if (row.cfa != CFA_NONE || rows[n - 1].cfa == CFA_NONE)
+        rows[n - 1] = row;
+      continue;
+    }
+    if (n) {
+      const Row &prev = rows[n - 1];
+      if (prev.cfa == row.cfa &&
+          (row.cfa == CFA_NONE ||
+           (prev.cfa_offset == row.cfa_offset && prev.ra == row.ra &&
+            prev.ra_offset == row.ra_offset && prev.bp == row.bp &&
+            prev.bp_offset == row.bp_offset)))
+        continue;
+    }
+    rows[n++] = row;
+  }
+  rows.resize(n);
+  rows.shrink_to_fit();
+}
+
+std::unique_ptr<UnwindTable> UnwindTable::load(const std::string &path) {
+  struct bcc_elf_file *elf = bcc_elf_open(path.c_str());
+  if (!elf)
+    return nullptr;
+
+  std::unique_ptr<UnwindTable> table(new UnwindTable());
+  Builder builder(table.get());
+  size_t size;
+  uint64_t addr;
+  const void *data = bcc_elf_file_section(elf, ".eh_frame", &size);
+  if (data && bcc_elf_file_section_addr(elf, ".eh_frame", &addr) == 0)
+    builder.section(data, size, addr, true);
+
+  // .debug_frame is in the debug file when there is one, for code that has
+  // no .eh_frame, such as that built with -fno-asynchronous-unwind-tables
+  char debug_path[PATH_MAX];
+  if (bcc_elf_file_find_debug_file(elf, debug_path, sizeof(debug_path)) < 0) {
+    data = bcc_elf_file_section(elf, ".debug_frame", &size);
+    if (data)
+      builder.section(data, size, 0, false);
+  } else {
+    if (path != debug_path) {
+      bcc_elf_close(elf);
+      elf = bcc_elf_open(debug_path);
+    }
+    data = elf ? bcc_elf_file_section(elf, ".debug_frame", &size) : nullptr;
+    if (data)
+      builder.section(data, size, 0, false);
+  }
+  if (elf)
+    bcc_elf_close(elf);
+
+  builder.finish();
+  if (table->rows_.empty())
+    return nullptr;
+  return table;
+}
+
+bool UnwindTable::lookup(uint64_t addr, Row *row) const {
+  auto it = std::upper_bound(
+      rows_.begin(), rows_.end(), addr,
+      [](uint64_t a, const Row &r) { return a < r.start; });
+  if (it == rows_.begin())
+    return false;
+  *row = *(it - 1);
+  return row->cfa != CFA_NONE;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+// Call frame information of one x86-64 ELF file, from its .eh_frame and from
+// the .debug_frame of the file or of its separate debug file, with the CFA
+// programs run ahead of time. What is left is a row per address where the
+// rules change: the canonical frame address as sp or bp plus an offset, and
+// where the return address and the caller's bp are saved relative to it.
+// Rows are sorted by address; a lookup is a binary search.
+class UnwindTable {
+public:
+  enum Cfa : uint8_t {
+    // no CFI covers the address, or its rules are beyond this table, such as
+    // DWARF expressions
+    CFA_NONE,
+    CFA_SP,
+    CFA_BP,
+  };
+  enum Rule : uint8_t {
+    // the register keeps its value in the caller
+    RULE_SAME,
+    // saved at cfa + offset
+    RULE_OFFSET,
+    // no value, a return address without one ends the stack
+    RULE_UNDEFINED,
+  };
+  struct Row {
+    uint64_t start;
+    int32_t cfa_offset;
+    int32_t ra_offset;
+    int32_t bp_offset;
+    Cfa cfa;
+    Rule ra;
+    Rule bp;
+  };
+
+private:
+  std::vector<Row> rows_;
+
+  class Builder;
+
+public:
+  // NULL if neither path nor its debug file has call frame information
+  static std::unique_ptr<UnwindTable> load(const std::string &path);
+
+  // the rules at the link time address addr, false if no CFI covers it
+  bool lookup(uint64_t addr, Row *row) const;
+  size_t size() const { return rows_.size(); }
+  size_t memory() const { return rows_.capacity() * sizeof(Row); }
+};
@@ -199,11 +199,38 @@ void Context::_each_probe(const char *binpath, const struct bcc_elf_usdt *probe,
   ctx->add_probe(binpath, probe);
 }
 
-int Context::_each_module(const char *modpath, uint64_t, uint64_t, void *p) {
-  bcc_elf_foreach_usdt(modpath, _each_probe, p);
+int Context::_each_module(const struct bcc_mapping *map, void *p) {
+  Context *ctx = static_cast<Context *>(p);
+  if (!strchr(map->perms, 'x') || !map->path[0] || map->path[0] == '[')
+    return 0;
+
+  // a deleted file can still be read through its mapping
+  if (map->deleted) {
+    ctx->add_probes(tfm::format("/proc/%d/map_files/%llx-%llx", *ctx->pid_,
+                                (unsigned long long)map->start,
+                                (unsigned long long)map->end).c_str());
+  } else {
+    ctx->add_probes((ctx->root_ + map->path).c_str());
+  }
   return 0;
 }
 
+int Context::add_probes(const char *binpath) {
+  struct bcc_elf_file *elf = bcc_elf_open(binpath);
+  if (!elf)
+    return -1;
+
+  int res = bcc_elf_file_foreach_usdt(elf, _each_probe, this);
+  // the probes need the type of the file later, take it from the same headers
+  bool shared = bcc_elf_file_is_shared_obj(elf) == 1;
+  bcc_elf_close(elf);
+  for (auto &p : probes_) {
+    if (!p->in_shared_object_ && p->bin_path_ == binpath)
+      p->in_shared_object_ = shared;
+  }
+  return res;
+}
+
 void Context::add_probe(const char *binpath, const struct bcc_elf_usdt *probe) {
   for (auto &p : probes_) {
     if (p->provider_ == probe->provider && p->name_ == probe->name) {
@@ -284,13 +311,17 @@ void Context::each_uprobe(each_uprobe_cb callback) {
 Context::Context(const std::string &bin_path) : loaded_(false) {
   std::string full_path = resolve_bin_path(bin_path);
   if (!full_path.empty()) {
-    if (bcc_elf_foreach_usdt(full_path.c_str(), _each_probe, this) == 0)
+    if (add_probes(full_path.c_str()) == 0)
       loaded_ = true;
   }
 }
 
 Context::Context(int pid) : pid_(pid), pid_stat_(pid), loaded_(false) {
-  if (bcc_procutils_each_module(pid, _each_module, this) == 0)
+  // probes in a container are attached through its root
+  char root[64];
+  if (bcc_procutils_mount_root(pid, root, sizeof(root)) == 0)
+    root_ = root;
+  if (bcc_procutils_each_mapping(pid, _each_module, this) == 0)
     loaded_ = true;
 }
 
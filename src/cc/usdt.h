@@ -177,13 +177,15 @@ class Context {
 
   optional<int> pid_;
   optional<ProcStat> pid_stat_;
+  std::string root_;
   bool loaded_;
 
   static void _each_probe(const char *binpath, const struct bcc_elf_usdt *probe,
                           void *p);
-  static int _each_module(const char *modpath, uint64_t, uint64_t, void *p);
+  static int _each_module(const struct bcc_mapping *map, void *p);
 
   void add_probe(const char *binpath, const struct bcc_elf_usdt *probe);
+  int add_probes(const char *binpath);
   std::string resolve_bin_path(const std::string &bin_path);
 
 public:
@@ -158,12 +158,19 @@ function Bpf:load_func(fn_name, prog_type)
   assert(libbcc.bpf_function_start(self.module, fn_name) ~= nil,
     "unknown program: "..fn_name)
 
+  -- without a log buffer libbpf loads again with one to print the log
+  assert(libbcc.bpf_function_load_parts(self.module, fn_name, prog_type, nil, 0) == 0,
+    "failed to load split parts of BPF program "..fn_name)
+
   local fd = libbcc.bpf_prog_load(prog_type,
     libbcc.bpf_function_start(self.module, fn_name),
     libbcc.bpf_function_size(self.module, fn_name),
     libbcc.bpf_module_license(self.module),
     libbcc.bpf_module_kern_version(self.module), nil, 0)
 
+  if fd < 0 then
+    libbcc.bpf_function_unload_parts(self.module, fn_name)
+  end
   assert(fd >= 0, "failed to load BPF program "..fn_name)
   log.info("loaded %s (%d)", fn_name, fd)
 
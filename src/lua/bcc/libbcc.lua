@@ -64,6 +64,9 @@ void * bpf_function_start_id(void *program, size_t id);
 void * bpf_function_start(void *program, const char *name);
 size_t bpf_function_size_id(void *program, size_t id);
 size_t bpf_function_size(void *program, const char *name);
+int bpf_function_load_parts(void *program, const char *name, enum bpf_prog_type prog_type,
+                            char *log_buf, unsigned log_buf_size);
+void bpf_function_unload_parts(void *program, const char *name);
 size_t bpf_num_tables(void *program);
 size_t bpf_table_id(void *program, const char *table_name);
 int bpf_table_fd(void *program, const char *table_name);
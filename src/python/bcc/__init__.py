@@ -14,6 +14,7 @@
 
 from __future__ import print_function
 import atexit
+from collections import OrderedDict
 import ctypes as ct
 import fcntl
 import json
@@ -23,15 +24,19 @@ import re
 import struct
 import errno
 import sys
+import time
+import zlib
 basestring = (unicode if sys.version_info[0] < 3 else str)
 
-from .libbcc import lib, _CB_TYPE, bcc_symbol, _SYM_CB_TYPE
+from .libbcc import lib, _CB_TYPE, bcc_symbol, bcc_source_frame, \
+    bcc_user_regs, _SYM_CB_TYPE
 from .table import Table
 from .perf import Perf
 from .usyms import ProcessSymbols
 
 _kprobe_limit = 1000
 _num_open_probes = 0
+_stale_probes_removed = False
 
 # for tests
 def _get_num_open_probes():
@@ -43,11 +48,39 @@ TRACEFS = "/sys/kernel/debug/tracing"
 DEBUG_LLVM_IR = 0x1
 DEBUG_BPF = 0x2
 DEBUG_PREPROCESSOR = 0x4
+DEBUG_PROG_STATS = 0x8
 LOG_BUFFER_SIZE = 65536
 
+# keep in sync with bpf_attach_kind in libbpf.h
+ATTACH_KPROBE = 0
+ATTACH_UPROBE = 1
+ATTACH_TRACEPOINT = 2
+ATTACH_PERF_EVENT = 3
+
 class SymbolCache(object):
-    def __init__(self, pid):
+    def __init__(self, pid, demangle=True, prefetch=False):
+        self.pid = pid
         self.cache = lib.bcc_symcache_new(pid)
+        if not demangle:
+            lib.bcc_symcache_set_demangle(self.cache, 0)
+        if prefetch:
+            self.prefetch()
+
+    def __del__(self):
+        if self.cache:
+            lib.bcc_free_symcache(self.cache, self.pid)
+            self.cache = None
+
+    def memory(self):
+        """Bytes held by the cache, counting the symbol tables of libraries
+        it shares with the caches of other processes for their share."""
+        return lib.bcc_symcache_memory(self.cache)
+
+    def prefetch(self):
+        """Load the symbols of every module of the process up front, on
+        several threads, rather than one module at a time as addresses in
+        them are first resolved."""
+        lib.bcc_symcache_prefetch(self.cache)
 
     def resolve(self, addr):
         sym = bcc_symbol()
@@ -56,12 +89,120 @@ class SymbolCache(object):
             return "[unknown]", 0
         return sym.demangle_name.decode(), sym.offset
 
+    def resolve_batch(self, addrs):
+        """Resolve a sequence of addresses with one call into libbcc,
+        returning a list of (name, offset) in the same order."""
+        addrs = list(addrs)
+        n = len(addrs)
+        caddrs = (ct.c_ulonglong * n)(*addrs)
+        syms = (bcc_symbol * n)()
+        lib.bcc_symcache_resolve_batch(self.cache, caddrs, n, syms)
+        return [(s.demangle_name.decode(), s.offset) if s.name
+                else ("[unknown]", 0) for s in syms]
+
+    def resolve_source(self, addr, max_frames=32):
+        """Return the source frames of addr from the DWARF debug info of its
+        module, innermost inlined call first, as a list of (function, file,
+        line); empty when the module has no debug info. Unknown values are
+        None, and 0 for the line."""
+        frames = (bcc_source_frame * max_frames)()
+        n = lib.bcc_symcache_resolve_source(self.cache, addr, frames,
+                                            max_frames)
+        return [(f.function.decode() if f.function else None,
+                 f.file.decode() if f.file else None, f.line)
+                for f in frames[:n]]
+
+    def unwind(self, ip, sp, bp, stack, size, max_frames=127):
+        """Unwind a user stack from its registers and a copy of size bytes
+        of it from sp up, stack being a buffer or an address, with the call
+        frame information of the binaries of the process. Returns the return
+        addresses, innermost first."""
+        regs = bcc_user_regs(ip, sp, bp)
+        ips = (ct.c_ulonglong * max_frames)()
+        n = lib.bcc_symcache_unwind(self.cache, ct.byref(regs), stack, size,
+                                    ips, max_frames)
+        return ips[:n]
+
     def resolve_name(self, name):
         addr = ct.c_ulonglong()
         if lib.bcc_symcache_resolve_name(self.cache, name, ct.pointer(addr)) < 0:
             return -1
         return addr.value
 
+class SymbolCacheLRU(object):
+    """Symbol caches of processes by pid, bounded by the memory they hold:
+    past max_bytes, the least recently used ones are dropped. The cache of a
+    pid is also dropped once the pid belongs to another process, told by its
+    start time in /proc/PID/stat, and once the process exited and the cache
+    went unused for a check interval, so that its last samples still
+    resolve. libbcc shares the symbol tables of a library between processes,
+    so dropping a cache only frees what is private to its process. The kernel
+    cache, for pids below zero, is always kept. clock gives the current time
+    in seconds."""
+
+    # seconds between checks for exited processes and for the memory held
+    CHECK_INTERVAL = 1.0
+
+    def __init__(self, max_bytes=256 * 1024 * 1024, clock=time.time):
+        self.max_bytes = max_bytes
+        self.clock = clock
+        # pid -> [SymbolCache, start time, last use], least recent first
+        self._caches = OrderedDict()
+        self._last_check = 0
+
+    @staticmethod
+    def start_time(pid):
+        """Start time of pid in clock ticks after boot, None if it is gone."""
+        try:
+            with open("/proc/%d/stat" % pid) as f:
+                stat = f.read()
+        except IOError:
+            return None
+        # comm may hold spaces and parentheses, the fields after it do not
+        fields = stat[stat.rfind(")") + 2:].split()
+        return int(fields[19]) if len(fields) > 19 else None
+
+    def get(self, pid):
+        now = self.clock()
+        if now - self._last_check >= self.CHECK_INTERVAL:
+            self._check(now)
+            self._last_check = now
+        entry = self._caches.pop(pid, None)
+        if entry is None:
+            start = self.start_time(pid) if pid >= 0 else None
+            entry = [SymbolCache(pid), start, now]
+        entry[2] = now
+        self._caches[pid] = entry
+        return entry[0]
+
+    def _check(self, now):
+        for pid, (cache, start, used) in list(self._caches.items()):
+            if pid < 0:
+                continue
+            current = self.start_time(pid)
+            # gone, maybe before its first lookup and with no start time then
+            if current is None:
+                if now - used >= self.CHECK_INTERVAL:
+                    del self._caches[pid]
+            elif current != start:
+                del self._caches[pid]
+
+        sizes = [(pid, entry[0].memory())
+                 for pid, entry in self._caches.items() if pid >= 0]
+        total = sum(size for _, size in sizes)
+        # the most recently used cache stays, however large
+        for pid, size in sizes[:-1]:
+            if total <= self.max_bytes:
+                break
+            del self._caches[pid]
+            total -= size
+
+    def __contains__(self, pid):
+        return pid in self._caches
+
+    def __len__(self):
+        return len(self._caches)
+
 class PerfType:
     # From perf_type_id in uapi/linux/perf_event.h
     HARDWARE = 0
@@ -105,7 +246,7 @@ class BPF(object):
     PERF_EVENT = 7
 
     _probe_repl = re.compile("[^a-zA-Z0-9_]")
-    _sym_caches = {}
+    _sym_caches = SymbolCacheLRU()
 
     _auto_includes = {
         "linux/time.h": ["time"],
@@ -197,6 +338,8 @@ class BPF(object):
                 DEBUG_LLVM_IR: print LLVM IR to stderr
                 DEBUG_BPF: print BPF bytecode to stderr
                 DEBUG_PREPROCESSOR: print Preprocessed C file to stderr
+                DEBUG_PROG_STATS: count runs and run time of each function in
+                    the program itself, for kernels without bpf_stats
         """
 
         self.open_kprobes = {}
@@ -204,8 +347,17 @@ class BPF(object):
         self.open_tracepoints = {}
         self.open_perf_events = {}
         self.tracefile = None
+        self._attach_registry = lib.bpf_attach_registry_new()
+        self._attach_handles = {}
         atexit.register(self.cleanup)
 
+        # probe events left behind by bcc processes that died without
+        # cleaning up slow down every later attach; sweep them once
+        global _stale_probes_removed
+        if not _stale_probes_removed:
+            lib.bpf_remove_stale_probes()
+            _stale_probes_removed = True
+
         self._reader_cb_impl = _CB_TYPE(BPF._reader_cb)
         self._user_cb = cb
         self.debug = debug
@@ -259,35 +411,47 @@ class BPF(object):
 
         return fns
 
-    def load_func(self, func_name, prog_type):
-        if func_name in self.funcs:
-            return self.funcs[func_name]
-        if not lib.bpf_function_start(self.module, func_name.encode("ascii")):
-            raise Exception("Unknown program %s" % func_name)
+    def _load_with_log(self, func_name, load):
+        """Call load(log_buf, size), with a verifier log buffer grown until
+        the log fits when debugging, and print the log for DEBUG_BPF."""
         buffer_len = LOG_BUFFER_SIZE
         while True:
             log_buf = ct.create_string_buffer(buffer_len) if self.debug else None
-            fd = lib.bpf_prog_load(prog_type,
-                    lib.bpf_function_start(self.module, func_name.encode("ascii")),
-                    lib.bpf_function_size(self.module, func_name.encode("ascii")),
-                    lib.bpf_module_license(self.module),
-                    lib.bpf_module_kern_version(self.module),
-                    log_buf, ct.sizeof(log_buf) if log_buf else 0)
-            if fd < 0 and ct.get_errno() == errno.ENOSPC and self.debug:
+            res = load(log_buf, ct.sizeof(log_buf) if log_buf else 0)
+            if res < 0 and ct.get_errno() == errno.ENOSPC and self.debug:
                 buffer_len <<= 1
             else:
                 break
 
         if self.debug & DEBUG_BPF and log_buf.value:
             print(log_buf.value.decode(), file=sys.stderr)
+        return res
 
+    def load_func(self, func_name, prog_type):
+        if func_name in self.funcs:
+            return self.funcs[func_name]
+        if not lib.bpf_function_start(self.module, func_name.encode("ascii")):
+            raise Exception("Unknown program %s" % func_name)
+        # programs over the instruction limit are split, the parts reached
+        # by tail call have to be in place before the head is loaded
+        res = self._load_with_log(func_name, lambda log_buf, size:
+                lib.bpf_function_load_parts(self.module,
+                    func_name.encode("ascii"), prog_type, log_buf, size))
+        if res < 0:
+            raise Exception("Failed to load BPF program %s: %s" %
+                    (func_name, os.strerror(ct.get_errno())))
+        fd = self._load_with_log(func_name, lambda log_buf, size:
+                lib.bpf_prog_load(prog_type,
+                    lib.bpf_function_start(self.module, func_name.encode("ascii")),
+                    lib.bpf_function_size(self.module, func_name.encode("ascii")),
+                    lib.bpf_module_license(self.module),
+                    lib.bpf_module_kern_version(self.module),
+                    log_buf, size))
         if fd < 0:
             errstr = os.strerror(ct.get_errno())
-            if self.debug & DEBUG_BPF:
-                raise Exception("Failed to load BPF program %s: %s" %
-                                (func_name, errstr))
-            else:
-                raise Exception("Failed to load BPF program %s: %s" % (func_name, errstr))
+            lib.bpf_function_unload_parts(self.module, func_name.encode("ascii"))
+            raise Exception("Failed to load BPF program %s: %s" %
+                            (func_name, errstr))
 
         fn = BPF.Function(self, func_name, fd)
         self.funcs[func_name] = fn
@@ -429,15 +593,77 @@ class BPF(object):
         if _num_open_probes + num_new_probes > _kprobe_limit:
             raise Exception("Number of open probes would exceed global quota")
 
+    # BPF_PROBE_EVENT_NAME_MAX of libbpf.h, less the terminating nul; longer
+    # names are refused by bpf_attach_kprobe and bpf_attach_uprobe
+    _event_name_max = 64 - 1
+
+    @staticmethod
+    def _probe_event_name(prefix, name):
+        # the owner tag lets bpf_remove_stale_probes recognize our events if
+        # this process exits without running cleanup(); a pid only means
+        # something in its pid namespace, which the tag names as well
+        try:
+            ns = os.stat("/proc/self/ns/pid").st_ino
+        except OSError:
+            ns = 0
+        tag = "_bcc_%d_%d" % (ns, os.getpid())
+        room = BPF._event_name_max - len(prefix) - 1 - len(tag)
+        if len(name) > room:
+            # long paths of uprobes: a hash of the name keeps it unique, and
+            # its end, with the address, keeps it readable
+            digest = "%08x" % (zlib.crc32(name.encode()) & 0xffffffff)
+            name = digest + name[len(name) - (room - len(digest)):]
+        return "%s_%s%s" % (prefix, name, tag)
+
+    def _register_attach(self, key, kind, ev_name, reader, fd=-1):
+        handle = -1
+        if self._attach_registry:
+            handle = lib.bpf_attach_registry_add(self._attach_registry, kind,
+                    ev_name.encode("ascii") if ev_name else None, reader, fd)
+        # what the registry could not take is detached on its own
+        self._attach_handles[key] = handle if handle >= 0 else \
+                (kind, ev_name, reader, fd)
+
+    def _unregister_attach(self, key):
+        handle = self._attach_handles.pop(key, None)
+        if handle is None:
+            return 0
+        if isinstance(handle, tuple):
+            return BPF._detach_unregistered(*handle)
+        return lib.bpf_attach_registry_detach(self._attach_registry, handle)
+
+    @staticmethod
+    def _detach_unregistered(kind, ev_name, reader, fd):
+        if reader:
+            lib.perf_reader_free(reader)
+        if fd >= 0:
+            os.close(fd)
+        if kind == ATTACH_KPROBE:
+            desc = "-:kprobes/%s" % ev_name
+            return lib.bpf_detach_kprobe(desc.encode("ascii"))
+        if kind == ATTACH_UPROBE:
+            desc = "-:uprobes/%s" % ev_name
+            return lib.bpf_detach_uprobe(desc.encode("ascii"))
+        return 0
+
     def _add_kprobe(self, name, probe):
         global _num_open_probes
         self.open_kprobes[name] = probe
+        # non-string keys here include the perf_events reader
+        if isinstance(name, str):
+            self._register_attach((ATTACH_KPROBE, name), ATTACH_KPROBE,
+                    name, probe)
+        else:
+            self._register_attach((ATTACH_KPROBE, name), ATTACH_PERF_EVENT,
+                    None, probe)
         _num_open_probes += 1
 
     def _del_kprobe(self, name):
         global _num_open_probes
+        res = self._unregister_attach((ATTACH_KPROBE, name))
         del self.open_kprobes[name]
         _num_open_probes -= 1
+        return res
 
     def attach_kprobe(self, event="", fn_name="", event_re="",
             pid=-1, cpu=0, group_fd=-1):
@@ -457,7 +683,8 @@ class BPF(object):
         event = str(event)
         self._check_probe_quota(1)
         fn = self.load_func(fn_name, BPF.KPROBE)
-        ev_name = "p_" + event.replace("+", "_").replace(".", "_")
+        ev_name = BPF._probe_event_name("p",
+                event.replace("+", "_").replace(".", "_"))
         desc = "p:kprobes/%s %s" % (ev_name, event)
         res = lib.bpf_attach_kprobe(fn.fd, ev_name.encode("ascii"),
                 desc.encode("ascii"), pid, cpu, group_fd,
@@ -470,15 +697,12 @@ class BPF(object):
 
     def detach_kprobe(self, event):
         event = str(event)
-        ev_name = "p_" + event.replace("+", "_").replace(".", "_")
+        ev_name = BPF._probe_event_name("p",
+                event.replace("+", "_").replace(".", "_"))
         if ev_name not in self.open_kprobes:
             raise Exception("Kprobe %s is not attached" % event)
-        lib.perf_reader_free(self.open_kprobes[ev_name])
-        desc = "-:kprobes/%s" % ev_name
-        res = lib.bpf_detach_kprobe(desc.encode("ascii"))
-        if res < 0:
+        if self._del_kprobe(ev_name) < 0:
             raise Exception("Failed to detach BPF from kprobe")
-        self._del_kprobe(ev_name)
 
     def attach_kretprobe(self, event="", fn_name="", event_re="",
             pid=-1, cpu=0, group_fd=-1):
@@ -496,7 +720,8 @@ class BPF(object):
         event = str(event)
         self._check_probe_quota(1)
         fn = self.load_func(fn_name, BPF.KPROBE)
-        ev_name = "r_" + event.replace("+", "_").replace(".", "_")
+        ev_name = BPF._probe_event_name("r",
+                event.replace("+", "_").replace(".", "_"))
         desc = "r:kprobes/%s %s" % (ev_name, event)
         res = lib.bpf_attach_kprobe(fn.fd, ev_name.encode("ascii"),
                 desc.encode("ascii"), pid, cpu, group_fd,
@@ -509,15 +734,12 @@ class BPF(object):
 
     def detach_kretprobe(self, event):
         event = str(event)
-        ev_name = "r_" + event.replace("+", "_").replace(".", "_")
+        ev_name = BPF._probe_event_name("r",
+                event.replace("+", "_").replace(".", "_"))
         if ev_name not in self.open_kprobes:
             raise Exception("Kretprobe %s is not attached" % event)
-        lib.perf_reader_free(self.open_kprobes[ev_name])
-        desc = "-:kprobes/%s" % ev_name
-        res = lib.bpf_detach_kprobe(desc.encode("ascii"))
-        if res < 0:
+        if self._del_kprobe(ev_name) < 0:
             raise Exception("Failed to detach BPF from kprobe")
-        self._del_kprobe(ev_name)
 
     @staticmethod
     def attach_xdp(dev, fn):
@@ -622,6 +844,8 @@ class BPF(object):
         if not res:
             raise Exception("Failed to attach BPF to tracepoint")
         self.open_tracepoints[tp] = res
+        self._register_attach((ATTACH_TRACEPOINT, tp), ATTACH_TRACEPOINT,
+                None, res)
         return self
 
     def detach_tracepoint(self, tp=""):
@@ -635,7 +859,7 @@ class BPF(object):
 
         if tp not in self.open_tracepoints:
             raise Exception("Tracepoint %s is not attached" % tp)
-        lib.perf_reader_free(self.open_tracepoints[tp])
+        self._unregister_attach((ATTACH_TRACEPOINT, tp))
         (tp_category, tp_name) = tp.split(':')
         res = lib.bpf_detach_tracepoint(tp_category.encode("ascii"),
                                         tp_name.encode("ascii"))
@@ -663,6 +887,9 @@ class BPF(object):
                 res[i] = self._attach_perf_event(fn.fd, ev_type, ev_config,
                         sample_period, sample_freq, pid, i, group_fd)
         self.open_perf_events[(ev_type, ev_config)] = res
+        for cpu, fd in res.items():
+            self._register_attach((ATTACH_PERF_EVENT, ev_type, ev_config, cpu),
+                    ATTACH_PERF_EVENT, None, None, fd)
 
     def detach_perf_event(self, ev_type=-1, ev_config=-1):
         try:
@@ -670,8 +897,8 @@ class BPF(object):
         except KeyError:
             raise Exception("Perf event type {} config {} not attached".format(
                 ev_type, ev_config))
-        for fd in fds.values():
-            os.close(fd)
+        for cpu in fds.keys():
+            self._unregister_attach((ATTACH_PERF_EVENT, ev_type, ev_config, cpu))
         res = lib.bpf_detach_perf_event(ev_type, ev_config)
         if res < 0:
             raise Exception("Failed to detach BPF from perf event")
@@ -681,12 +908,15 @@ class BPF(object):
     def _add_uprobe(self, name, probe):
         global _num_open_probes
         self.open_uprobes[name] = probe
+        self._register_attach((ATTACH_UPROBE, name), ATTACH_UPROBE, name, probe)
         _num_open_probes += 1
 
     def _del_uprobe(self, name):
         global _num_open_probes
+        res = self._unregister_attach((ATTACH_UPROBE, name))
         del self.open_uprobes[name]
         _num_open_probes -= 1
+        return res
 
     @staticmethod
     def get_user_functions(name, sym_re):
@@ -756,7 +986,8 @@ class BPF(object):
 
         self._check_probe_quota(1)
         fn = self.load_func(fn_name, BPF.KPROBE)
-        ev_name = "p_%s_0x%x" % (self._probe_repl.sub("_", path), addr)
+        ev_name = BPF._probe_event_name("p",
+                "%s_0x%x" % (self._probe_repl.sub("_", path), addr))
         desc = "p:uprobes/%s %s:0x%x" % (ev_name, path, addr)
         res = lib.bpf_attach_uprobe(fn.fd, ev_name.encode("ascii"),
                 desc.encode("ascii"), pid, cpu, group_fd,
@@ -776,15 +1007,12 @@ class BPF(object):
 
         name = str(name)
         (path, addr) = BPF._check_path_symbol(name, sym, addr)
-        ev_name = "p_%s_0x%x" % (self._probe_repl.sub("_", path), addr)
+        ev_name = BPF._probe_event_name("p",
+                "%s_0x%x" % (self._probe_repl.sub("_", path), addr))
         if ev_name not in self.open_uprobes:
             raise Exception("Uprobe %s is not attached" % event)
-        lib.perf_reader_free(self.open_uprobes[ev_name])
-        desc = "-:uprobes/%s" % ev_name
-        res = lib.bpf_detach_uprobe(desc.encode("ascii"))
-        if res < 0:
+        if self._del_uprobe(ev_name) < 0:
             raise Exception("Failed to detach BPF from uprobe")
-        self._del_uprobe(ev_name)
 
     def attach_uretprobe(self, name="", sym="", sym_re="", addr=None,
             fn_name="", pid=-1, cpu=0, group_fd=-1):
@@ -808,7 +1036,8 @@ class BPF(object):
 
         self._check_probe_quota(1)
         fn = self.load_func(fn_name, BPF.KPROBE)
-        ev_name = "r_%s_0x%x" % (self._probe_repl.sub("_", path), addr)
+        ev_name = BPF._probe_event_name("r",
+                "%s_0x%x" % (self._probe_repl.sub("_", path), addr))
         desc = "r:uprobes/%s %s:0x%x" % (ev_name, path, addr)
         res = lib.bpf_attach_uprobe(fn.fd, ev_name.encode("ascii"),
                 desc.encode("ascii"), pid, cpu, group_fd,
@@ -828,15 +1057,12 @@ class BPF(object):
 
         name = str(name)
         (path, addr) = BPF._check_path_symbol(name, sym, addr)
-        ev_name = "r_%s_0x%x" % (self._probe_repl.sub("_", path), addr)
+        ev_name = BPF._probe_event_name("r",
+                "%s_0x%x" % (self._probe_repl.sub("_", path), addr))
         if ev_name not in self.open_uprobes:
             raise Exception("Kretprobe %s is not attached" % event)
-        lib.perf_reader_free(self.open_uprobes[ev_name])
-        desc = "-:uprobes/%s" % ev_name
-        res = lib.bpf_detach_uprobe(desc.encode("ascii"))
-        if res < 0:
+        if self._del_uprobe(ev_name) < 0:
             raise Exception("Failed to detach BPF from uprobe")
-        self._del_uprobe(ev_name)
 
     def _trace_autoload(self):
         for i in range(0, lib.bpf_num_functions(self.module)):
@@ -934,12 +1160,36 @@ class BPF(object):
 
         Returns a symbol cache for the specified PID.
         The kernel symbol cache is accessed by providing any PID less than zero.
+        Caches are bounded in memory and dropped when their process exits or
+        its pid is reused, see SymbolCacheLRU.
         """
         if pid < 0 and pid != -1:
             pid = -1
-        if not pid in BPF._sym_caches:
-            BPF._sym_caches[pid] = SymbolCache(pid)
-        return BPF._sym_caches[pid]
+        return BPF._sym_caches.get(pid)
+
+    @staticmethod
+    def unwind_user_stack(data, stack_size=4096, max_frames=127):
+        """unwind_user_stack(data, stack_size=4096, max_frames=127)
+
+        Unwind a user stack sampled by bpf_user_stack_sample(), from the data
+        of a perf buffer record that starts with a struct bpf_user_stack of a
+        BPF_USER_STACK_SIZE of stack_size. Returns the pid and the addresses
+        of the stack, innermost first, which sym() and sym_batch() translate.
+        """
+        class UserStack(ct.Structure):
+            _fields_ = [
+                ("pid", ct.c_uint),
+                ("size", ct.c_uint),
+                ("ip", ct.c_ulonglong),
+                ("sp", ct.c_ulonglong),
+                ("bp", ct.c_ulonglong),
+                ("stack", ct.c_ubyte * stack_size),
+            ]
+        s = ct.cast(data, ct.POINTER(UserStack)).contents
+        stack = ct.addressof(s) + UserStack.stack.offset
+        ips = BPF._sym_cache(s.pid).unwind(s.ip, s.sp, s.bp, stack,
+                                           min(s.size, stack_size), max_frames)
+        return s.pid, ips
 
     @staticmethod
     def sym(addr, pid):
@@ -952,6 +1202,16 @@ class BPF(object):
         name, _ = BPF._sym_cache(pid).resolve(addr)
         return name
 
+    @staticmethod
+    def sym_batch(addrs, pid):
+        """sym_batch(addrs, pid)
+
+        Translate a list of memory addresses of a pid into function names,
+        returned as a list in the same order. Faster than calling sym() for
+        each address, e.g. for all the frames of a stack.
+        """
+        return [name for (name, _) in BPF._sym_cache(pid).resolve_batch(addrs)]
+
     @staticmethod
     def symaddr(addr, pid):
         """symaddr(addr, pid)
@@ -1013,6 +1273,24 @@ class BPF(object):
         """
         return len(self.open_tracepoints)
 
+    def prog_stats(self):
+        """prog_stats()
+
+        Get the run count and total run time in nanoseconds of each loaded
+        function, as a dict of name to (run_cnt, run_time_ns). The kernel's
+        bpf_stats are used when enabled (sysctl kernel.bpf_stats_enabled=1),
+        otherwise the module must be built with DEBUG_PROG_STATS. Functions
+        without stats are left out.
+        """
+        stats = {}
+        run_cnt = ct.c_ulonglong()
+        run_time_ns = ct.c_ulonglong()
+        for name, fn in self.funcs.items():
+            if lib.bpf_function_stats(self.module, name.encode("ascii"), fn.fd,
+                    ct.byref(run_cnt), ct.byref(run_time_ns)) == 0:
+                stats[name] = (run_cnt.value, run_time_ns.value)
+        return stats
+
     def kprobe_poll(self, timeout = -1):
         """kprobe_poll(self)
 
@@ -1028,25 +1306,21 @@ class BPF(object):
             exit()
 
     def cleanup(self):
-        for k, v in list(self.open_kprobes.items()):
-            lib.perf_reader_free(v)
-            # non-string keys here include the perf_events reader
-            if isinstance(k, str):
-                desc = "-:kprobes/%s" % k
-                lib.bpf_detach_kprobe(desc.encode("ascii"))
-            self._del_kprobe(k)
-        for k, v in list(self.open_uprobes.items()):
-            lib.perf_reader_free(v)
-            desc = "-:uprobes/%s" % k
-            lib.bpf_detach_uprobe(desc.encode("ascii"))
-            self._del_uprobe(k)
-        for k, v in self.open_tracepoints.items():
-            lib.perf_reader_free(v)
-            (tp_category, tp_name) = k.split(':')
-            lib.bpf_detach_tracepoint(tp_category, tp_name)
+        global _num_open_probes
+        # the registry closes every reader and perf fd, then removes all of
+        # our kprobe/uprobe events in one pass per tracefs control file
+        for key, handle in list(self._attach_handles.items()):
+            if isinstance(handle, tuple):
+                self._unregister_attach(key)
+        if self._attach_registry:
+            lib.bpf_attach_registry_free(self._attach_registry)
+            self._attach_registry = None
+        self._attach_handles.clear()
+        _num_open_probes -= len(self.open_kprobes) + len(self.open_uprobes)
+        self.open_kprobes.clear()
+        self.open_uprobes.clear()
         self.open_tracepoints.clear()
-        for (ev_type, ev_config) in list(self.open_perf_events.keys()):
-            self.detach_perf_event(ev_type, ev_config)
+        self.open_perf_events.clear()
         if self.tracefile:
             self.tracefile.close()
             self.tracefile = None
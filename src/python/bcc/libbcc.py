@@ -39,6 +39,14 @@ lib.bpf_function_start.restype = ct.c_void_p
 lib.bpf_function_start.argtypes = [ct.c_void_p, ct.c_char_p]
 lib.bpf_function_size.restype = ct.c_size_t
 lib.bpf_function_size.argtypes = [ct.c_void_p, ct.c_char_p]
+lib.bpf_function_load_parts.restype = ct.c_int
+lib.bpf_function_load_parts.argtypes = [ct.c_void_p, ct.c_char_p, ct.c_int,
+        ct.c_char_p, ct.c_uint]
+lib.bpf_function_unload_parts.restype = None
+lib.bpf_function_unload_parts.argtypes = [ct.c_void_p, ct.c_char_p]
+lib.bpf_function_stats.restype = ct.c_int
+lib.bpf_function_stats.argtypes = [ct.c_void_p, ct.c_char_p, ct.c_int,
+        ct.POINTER(ct.c_ulonglong), ct.POINTER(ct.c_ulonglong)]
 lib.bpf_table_id.restype = ct.c_ulonglong
 lib.bpf_table_id.argtypes = [ct.c_void_p, ct.c_char_p]
 lib.bpf_table_fd.restype = ct.c_int
@@ -76,6 +84,9 @@ lib.bpf_delete_elem.restype = ct.c_int
 lib.bpf_delete_elem.argtypes = [ct.c_int, ct.c_void_p]
 lib.bpf_open_raw_sock.restype = ct.c_int
 lib.bpf_open_raw_sock.argtypes = [ct.c_char_p]
+lib.bpf_prog_get_stats.restype = ct.c_int
+lib.bpf_prog_get_stats.argtypes = [ct.c_int, ct.POINTER(ct.c_ulonglong),
+        ct.POINTER(ct.c_ulonglong)]
 lib.bpf_attach_socket.restype = ct.c_int
 lib.bpf_attach_socket.argtypes = [ct.c_int, ct.c_int]
 lib.bpf_prog_load.restype = ct.c_int
@@ -119,6 +130,20 @@ lib.bpf_attach_perf_event.argtype = [ct.c_int, ct.c_uint, ct.c_uint, ct.c_ulongl
 lib.bpf_detach_perf_event.restype = ct.c_int;
 lib.bpf_detach_perf_event.argtype = [ct.c_uint, ct.c_uint]
 
+lib.bpf_attach_registry_new.restype = ct.c_void_p
+lib.bpf_attach_registry_new.argtypes = []
+lib.bpf_attach_registry_add.restype = ct.c_int
+lib.bpf_attach_registry_add.argtypes = [ct.c_void_p, ct.c_int, ct.c_char_p,
+        ct.c_void_p, ct.c_int]
+lib.bpf_attach_registry_detach.restype = ct.c_int
+lib.bpf_attach_registry_detach.argtypes = [ct.c_void_p, ct.c_int]
+lib.bpf_attach_registry_detach_all.restype = ct.c_int
+lib.bpf_attach_registry_detach_all.argtypes = [ct.c_void_p]
+lib.bpf_attach_registry_free.restype = None
+lib.bpf_attach_registry_free.argtypes = [ct.c_void_p]
+lib.bpf_remove_stale_probes.restype = ct.c_int
+lib.bpf_remove_stale_probes.argtypes = []
+
 # bcc symbol helpers
 class bcc_symbol(ct.Structure):
     _fields_ = [
@@ -128,6 +153,13 @@ class bcc_symbol(ct.Structure):
             ('offset', ct.c_ulonglong),
         ]
 
+class bcc_source_frame(ct.Structure):
+    _fields_ = [
+            ('function', ct.c_char_p),
+            ('file', ct.c_char_p),
+            ('line', ct.c_int),
+        ]
+
 lib.bcc_procutils_which_so.restype = ct.c_char_p
 lib.bcc_procutils_which_so.argtypes = [ct.c_char_p]
 
@@ -148,13 +180,77 @@ lib.bcc_free_symcache.argtypes = [ct.c_void_p, ct.c_int]
 lib.bcc_symcache_resolve.restype = ct.c_int
 lib.bcc_symcache_resolve.argtypes = [ct.c_void_p, ct.c_ulonglong, ct.POINTER(bcc_symbol)]
 
+lib.bcc_symcache_resolve_batch.restype = ct.c_int
+lib.bcc_symcache_resolve_batch.argtypes = [ct.c_void_p,
+    ct.POINTER(ct.c_ulonglong), ct.c_size_t, ct.POINTER(bcc_symbol)]
+
+lib.bcc_symcache_resolve_source.restype = ct.c_int
+lib.bcc_symcache_resolve_source.argtypes = [ct.c_void_p, ct.c_ulonglong,
+    ct.POINTER(bcc_source_frame), ct.c_int]
+
+class bcc_user_regs(ct.Structure):
+    _fields_ = [
+            ('ip', ct.c_ulonglong),
+            ('sp', ct.c_ulonglong),
+            ('bp', ct.c_ulonglong),
+        ]
+
+lib.bcc_symcache_unwind.restype = ct.c_int
+lib.bcc_symcache_unwind.argtypes = [ct.c_void_p, ct.POINTER(bcc_user_regs),
+    ct.c_void_p, ct.c_size_t, ct.POINTER(ct.c_ulonglong), ct.c_int]
+
+lib.bcc_symcache_memory.restype = ct.c_size_t
+lib.bcc_symcache_memory.argtypes = [ct.c_void_p]
+
 lib.bcc_symcache_resolve_name.restype = ct.c_int
 lib.bcc_symcache_resolve_name.argtypes = [
     ct.c_void_p, ct.c_char_p, ct.POINTER(ct.c_ulonglong)]
 
+lib.bcc_symcache_prefetch.restype = None
+lib.bcc_symcache_prefetch.argtypes = [ct.c_void_p]
+
 lib.bcc_symcache_refresh.restype = None
 lib.bcc_symcache_refresh.argtypes = [ct.c_void_p]
 
+lib.bcc_symcache_set_demangle.restype = None
+lib.bcc_symcache_set_demangle.argtypes = [ct.c_void_p, ct.c_int]
+
+lib.bcc_symcache_set_index_dir.restype = None
+lib.bcc_symcache_set_index_dir.argtypes = [ct.c_char_p]
+
+class bcc_stack_key(ct.Structure):
+    _fields_ = [
+            ('key_size', ct.c_int),
+            ('value_size', ct.c_int),
+            ('pid_offset', ct.c_int),
+            ('comm_offset', ct.c_int),
+            ('comm_size', ct.c_int),
+            ('user_stack_offset', ct.c_int),
+            ('kernel_stack_offset', ct.c_int),
+            ('kernel_ip_offset', ct.c_int),
+        ]
+
+BCC_STACKS_PPROF = 0x1
+BCC_STACKS_ANNOTATE = 0x2
+BCC_STACKS_DELIMIT = 0x4
+
+lib.bcc_stacks_report.restype = ct.c_int
+lib.bcc_stacks_report.argtypes = [ct.c_int, ct.c_int,
+    ct.POINTER(bcc_stack_key), ct.c_int, ct.c_int, ct.POINTER(ct.c_int)]
+
+lib.bcc_stacks_clear.restype = ct.c_int
+lib.bcc_stacks_clear.argtypes = [ct.c_int, ct.c_int]
+
+lib.bcc_stacks_reclaimer_new.restype = ct.c_void_p
+lib.bcc_stacks_reclaimer_new.argtypes = [ct.c_int, ct.c_int]
+
+lib.bcc_stacks_reclaimer_free.restype = None
+lib.bcc_stacks_reclaimer_free.argtypes = [ct.c_void_p]
+
+lib.bcc_stacks_reclaim.restype = ct.c_int
+lib.bcc_stacks_reclaim.argtypes = [ct.c_void_p, ct.POINTER(ct.c_int),
+    ct.POINTER(bcc_stack_key), ct.c_int]
+
 lib.bcc_usdt_new_frompid.restype = ct.c_void_p
 lib.bcc_usdt_new_frompid.argtypes = [ct.c_int]
 
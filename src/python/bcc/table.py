@@ -16,8 +16,10 @@ from collections import MutableMapping
 import ctypes as ct
 import multiprocessing
 import os
+import sys
 
-from .libbcc import lib, _RAW_CB_TYPE
+from .libbcc import lib, _RAW_CB_TYPE, bcc_stack_key, BCC_STACKS_PPROF, \
+    BCC_STACKS_ANNOTATE, BCC_STACKS_DELIMIT
 from .perf import Perf
 from subprocess import check_output
 
@@ -443,9 +445,7 @@ class PerfEventArray(ArrayBase):
         self._cbs[cpu] = fn
 
     def close_perf_buffer(self, key):
-        reader = self.bpf.open_kprobes.get((id(self), key))
-        if reader:
-            lib.perf_reader_free(reader)
+        if (id(self), key) in self.bpf.open_kprobes:
             self.bpf._del_kprobe((id(self), key))
         del self._cbs[key]
 
@@ -584,6 +584,29 @@ class StackTrace(TableBase):
 
     def __init__(self, *args, **kwargs):
         super(StackTrace, self).__init__(*args, **kwargs)
+        self.max_entries = lib.bpf_table_max_entries_id(self.bpf.module,
+                self.map_id)
+        self._reclaimer = None
+
+    def __del__(self):
+        if self._reclaimer:
+            lib.bcc_stacks_reclaimer_free(self._reclaimer)
+            self._reclaimer = None
+
+    @staticmethod
+    def _stack_key(counts):
+        def field(name):
+            f = getattr(counts.Key, name, None)
+            return (f.offset, f.size) if f is not None else (-1, 0)
+        key = bcc_stack_key()
+        key.key_size = ct.sizeof(counts.Key)
+        key.value_size = ct.sizeof(counts.Leaf)
+        key.pid_offset = field("pid")[0]
+        key.comm_offset, key.comm_size = field("name")
+        key.user_stack_offset = field("user_stack_id")[0]
+        key.kernel_stack_offset = field("kernel_stack_id")[0]
+        key.kernel_ip_offset = field("kernel_ip")[0]
+        return key
 
     class StackWalker(object):
         def __init__(self, stack, resolve=None):
@@ -611,6 +634,32 @@ class StackTrace(TableBase):
     def walk(self, stack_id, resolve=None):
         return StackTrace.StackWalker(self[self.Key(stack_id)], resolve)
 
+    def report(self, counts, out=None, pprof=False, annotate=False,
+               delimit=False):
+        """Write the stacks counted in counts, a table whose keys have
+        user_stack_id and/or kernel_stack_id fields holding ids of this
+        table, to the file out (stdout by default), as folded stacks for
+        flame graphs or, with pprof=True, as a pprof profile. The pid, name
+        and kernel_ip fields are used when the key has them. Stacks and
+        symbols are read and resolved in libbcc, each once. Returns the
+        number of keys whose stacks are missing, and of those the number
+        that this table had no room for."""
+        key = StackTrace._stack_key(counts)
+        flags = (BCC_STACKS_PPROF if pprof else 0) | \
+            (BCC_STACKS_ANNOTATE if annotate else 0) | \
+            (BCC_STACKS_DELIMIT if delimit else 0)
+
+        if out is None:
+            out = sys.stdout
+        out.flush()
+        out_of_room = ct.c_int()
+        res = lib.bcc_stacks_report(counts.map_fd, self.map_fd,
+                                    ct.byref(key), flags, out.fileno(),
+                                    ct.byref(out_of_room))
+        if res < 0:
+            raise Exception("Failed to report stacks")
+        return res, out_of_room.value
+
     def __len__(self):
         i = 0
         for k in self: i += 1
@@ -623,5 +672,30 @@ class StackTrace(TableBase):
             raise KeyError
 
     def clear(self):
-        pass
+        if lib.bcc_stacks_clear(self.map_fd, self.max_entries) < 0:
+            raise Exception("Failed to clear stacks")
+
+    def reclaim(self, *counts):
+        """Delete the stacks that none of the counts tables refers to, and
+        that none referred to at the previous call either: a stack stored
+        meanwhile may not be counted yet. Keys refer to stacks with
+        user_stack_id, kernel_stack_id or stackid fields. Called after each
+        interval, this keeps the stacks of long running tools bounded.
+        Returns the number of stacks deleted."""
+        if not self._reclaimer:
+            self._reclaimer = lib.bcc_stacks_reclaimer_new(self.map_fd,
+                    self.max_entries)
+        keys = (bcc_stack_key * len(counts))()
+        fds = (ct.c_int * len(counts))()
+        for i, table in enumerate(counts):
+            keys[i] = StackTrace._stack_key(table)
+            if keys[i].user_stack_offset < 0 and \
+                    keys[i].kernel_stack_offset < 0 and \
+                    hasattr(table.Key, "stackid"):
+                keys[i].user_stack_offset = table.Key.stackid.offset
+            fds[i] = table.map_fd
+        res = lib.bcc_stacks_reclaim(self._reclaimer, fds, keys, len(counts))
+        if res < 0:
+            raise Exception("Failed to reclaim stacks")
+        return res
 
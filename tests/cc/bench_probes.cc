@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Probe overhead benchmark. A syscall, or a uprobed function of this binary,
+// is run in a tight loop with nothing attached and then with each program
+// shape attached through a kprobe, a tracepoint and a uprobe. The cost of the
+// probe is the difference in ns per iteration.
+//
+// usage: bench_probes [iterations]
+
+#include <atomic>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "bcc_syms.h"
+#include "bpf_common.h"
+#include "libbpf.h"
+#include "perf_reader.h"
+
+using std::string;
+using std::vector;
+
+extern "C" __attribute__((noinline)) void bench_uprobe_target(void) {
+  asm volatile("");
+}
+
+struct Shape {
+  const char *name;
+  const char *text;
+  int data_size;  // perf output size, 0 when the shape does not submit
+};
+
+static const char *COUNT_TEXT = R"(
+BPF_HASH(counts, u32, u64);
+int probe(void *ctx) {
+  counts.increment(0);
+  return 0;
+}
+)";
+
+static const char *HIST_TEXT = R"(
+BPF_HISTOGRAM(dist);
+int probe(void *ctx) {
+  dist.increment(bpf_log2l(bpf_ktime_get_ns() & 0xfffff));
+  return 0;
+}
+)";
+
+static const char *STACKID_TEXT = R"(
+BPF_STACK_TRACE(stacks, 1024);
+BPF_HASH(counts, int, u64);
+int probe(void *ctx) {
+  counts.increment(stacks.get_stackid(ctx, BPF_F_REUSE_STACKID));
+  return 0;
+}
+)";
+
+// staged in a per-cpu array, 1024 bytes do not fit on the bpf stack
+static const char *PERF_TEXT = R"(
+struct data_t { char buf[DATA_SIZE]; };
+BPF_TABLE("percpu_array", int, struct data_t, scratch, 1);
+BPF_PERF_OUTPUT(events);
+int probe(void *ctx) {
+  int zero = 0;
+  struct data_t *data = scratch.lookup(&zero);
+  if (data)
+    events.perf_submit(ctx, data, sizeof(*data));
+  return 0;
+}
+)";
+
+static const Shape SHAPES[] = {
+  {"count", COUNT_TEXT, 0},
+  {"hist", HIST_TEXT, 0},
+  {"stackid", STACKID_TEXT, 0},
+  {"perf64", PERF_TEXT, 64},
+  {"perf256", PERF_TEXT, 256},
+  {"perf1024", PERF_TEXT, 1024},
+};
+
+enum Probe { KPROBE, TRACEPOINT, UPROBE };
+static const char *PROBE_NAMES[] = {"kprobe", "tracepoint", "uprobe"};
+
+static const char *GETPPID_SYMS[] = {
+  "__x64_sys_getppid", "__arm64_sys_getppid", "SyS_getppid", "sys_getppid",
+};
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double run_loop(Probe probe, long iterations) {
+  double start = now_ns();
+  if (probe == UPROBE) {
+    for (long i = 0; i < iterations; ++i)
+      bench_uprobe_target();
+  } else {
+    for (long i = 0; i < iterations; ++i)
+      syscall(SYS_getppid);
+  }
+  return (now_ns() - start) / iterations;
+}
+
+struct Reader {
+  std::vector<struct perf_reader *> readers;
+  std::atomic<long> events;
+  std::atomic<bool> stop;
+  std::thread thread;
+};
+
+static void count_event(void *cookie, void *raw, int raw_size) {
+  static_cast<Reader *>(cookie)->events++;
+}
+
+static int open_readers(void *mod, Reader *r) {
+  int map_fd = bpf_table_fd(mod, "events");
+  int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  for (int cpu = 0; cpu < ncpus; ++cpu) {
+    void *reader = bpf_open_perf_buffer(count_event, r, -1, cpu);
+    if (!reader)
+      return -1;
+    r->readers.push_back(static_cast<struct perf_reader *>(reader));
+    int fd = perf_reader_fd(r->readers.back());
+    if (bpf_update_elem(map_fd, &cpu, &fd, 0) < 0)
+      return -1;
+  }
+  r->events = 0;
+  r->stop = false;
+  r->thread = std::thread([r]() {
+    while (!r->stop)
+      perf_reader_poll(r->readers.size(), r->readers.data(), 100);
+  });
+  return 0;
+}
+
+static void close_readers(Reader *r) {
+  if (r->thread.joinable()) {
+    r->stop = true;
+    r->thread.join();
+  }
+  for (auto reader : r->readers)
+    perf_reader_free(reader);
+  r->readers.clear();
+}
+
+// returns the registry handle of the attached probe, or -1
+static int attach(void *registry, Probe probe, int prog_fd) {
+  char ev_name[128], desc[512];
+  void *reader;
+  int kind;
+
+  if (probe == TRACEPOINT) {
+    reader = bpf_attach_tracepoint(prog_fd, "syscalls", "sys_enter_getppid", -1, 0, -1,
+                                   NULL, NULL);
+    return reader ? bpf_attach_registry_add(registry, BPF_ATTACH_TRACEPOINT, NULL, reader, -1) : -1;
+  }
+
+  struct stat ns;
+  if (stat("/proc/self/ns/pid", &ns) < 0)
+    ns.st_ino = 0;
+  snprintf(ev_name, sizeof(ev_name), "p_bench" BPF_PROBE_OWNER_TAG "%lu_%d",
+           (unsigned long)ns.st_ino, getpid());
+  if (probe == KPROBE) {
+    reader = NULL;
+    for (size_t i = 0; !reader && i < sizeof(GETPPID_SYMS) / sizeof(GETPPID_SYMS[0]); ++i) {
+      snprintf(desc, sizeof(desc), "p:kprobes/%s %s", ev_name, GETPPID_SYMS[i]);
+      reader = bpf_attach_kprobe(prog_fd, ev_name, desc, -1, 0, -1, NULL, NULL);
+    }
+    kind = BPF_ATTACH_KPROBE;
+  } else {
+    char exe[256];
+    struct bcc_symbol sym;
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len < 0)
+      return -1;
+    exe[len] = 0;
+    if (bcc_resolve_symname(exe, "bench_uprobe_target", 0, &sym) < 0)
+      return -1;
+    snprintf(desc, sizeof(desc), "p:uprobes/%s %s:0x%lx", ev_name, exe,
+             (unsigned long)sym.offset);
+    reader = bpf_attach_uprobe(prog_fd, ev_name, desc, -1, 0, -1, NULL, NULL);
+    kind = BPF_ATTACH_UPROBE;
+  }
+  return reader ? bpf_attach_registry_add(registry, kind, ev_name, reader, -1) : -1;
+}
+
+static int load(void *mod, Probe probe) {
+  enum bpf_prog_type type = probe == TRACEPOINT ? BPF_PROG_TYPE_TRACEPOINT : BPF_PROG_TYPE_KPROBE;
+  return bpf_prog_load(type, (const struct bpf_insn *)bpf_function_start(mod, "probe"),
+                       bpf_function_size(mod, "probe"), bpf_module_license(mod),
+                       bpf_module_kern_version(mod), NULL, 0);
+}
+
+int main(int argc, char **argv) {
+  long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+
+  // keep the loop and its perf buffer on one cpu
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(sched_getcpu(), &set);
+  sched_setaffinity(0, sizeof(set), &set);
+
+  bpf_remove_stale_probes();
+  void *registry = bpf_attach_registry_new();
+
+  printf("%-11s %-9s %12s %12s %12s\n", "PROBE", "SHAPE", "NS/ITER", "NS/EVENT", "RECEIVED");
+  for (int p = KPROBE; p <= UPROBE; ++p) {
+    Probe probe = static_cast<Probe>(p);
+    double base = run_loop(probe, iterations);
+    printf("%-11s %-9s %12.1f %12s %12s\n", PROBE_NAMES[p], "none", base, "-", "-");
+
+    for (auto &shape : SHAPES) {
+      string size_flag = "-DDATA_SIZE=" + std::to_string(shape.data_size);
+      const char *cflags[] = {size_flag.c_str()};
+      void *mod = bpf_module_create_c_from_string(shape.text, 0, cflags, 1);
+      if (!mod) {
+        fprintf(stderr, "%s: failed to compile\n", shape.name);
+        return 1;
+      }
+      int prog_fd = load(mod, probe);
+      if (prog_fd < 0) {
+        printf("%-11s %-9s %12s\n", PROBE_NAMES[p], shape.name, "unsupported");
+        bpf_module_destroy(mod);
+        continue;
+      }
+
+      Reader reader;
+      if (shape.data_size && open_readers(mod, &reader) < 0) {
+        fprintf(stderr, "%s: failed to open perf buffers\n", shape.name);
+        return 1;
+      }
+      int handle = attach(registry, probe, prog_fd);
+      double ns = 0;
+      if (handle >= 0) {
+        ns = run_loop(probe, iterations);
+        bpf_attach_registry_detach(registry, handle);
+      }
+      close_readers(&reader);
+      if (handle < 0) {
+        printf("%-11s %-9s %12s\n", PROBE_NAMES[p], shape.name, "unsupported");
+      } else {
+        char received[32] = "-";
+        if (shape.data_size)
+          snprintf(received, sizeof(received), "%ld", reader.events.load());
+        printf("%-11s %-9s %12.1f %12.1f %12s\n", PROBE_NAMES[p], shape.name, ns, ns - base,
+               received);
+      }
+      close(prog_fd);
+      bpf_module_destroy(mod);
+    }
+  }
+  bpf_attach_registry_free(registry);
+  return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// User space throughput benchmark for libbcc: events through perf_reader_poll
+// with a C callback, map iteration, and the key/leaf printf and scanf helpers.
+// The events come from a thread calling getppid() in a loop, with a program
+// on the syscalls:sys_enter_getppid tracepoint submitting 64 bytes for each.
+// tests/python/bench_userspace.py measures the same through the Python API.
+//
+// usage: bench_userspace [seconds] [iterations]
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "bpf_common.h"
+#include "libbpf.h"
+#include "perf_reader.h"
+
+static const char *PROG_TEXT = R"(
+struct data_t { u64 seq; char pad[56]; };
+BPF_PERF_OUTPUT(events);
+int on_getppid(void *ctx) {
+  struct data_t data = {};
+  data.seq = bpf_ktime_get_ns();
+  events.perf_submit(ctx, &data, sizeof(data));
+  return 0;
+}
+
+struct key_t { u32 pid; u64 ts; char comm[16]; };
+BPF_HASH(keyed, struct key_t, u64);
+BPF_HASH(flat, u64, u64);
+)";
+
+static const int FLAT_ENTRIES = 10000;
+
+static double clock_ns(clockid_t clk) {
+  struct timespec ts;
+  clock_gettime(clk, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, long ops, double wall_ns, double cpu_ns) {
+  printf("%-20s %12ld %14.0f %12.1f\n", name, ops, ops / (wall_ns / 1e9),
+         ops ? cpu_ns / ops : 0.);
+}
+
+static void count_event(void *cookie, void *raw, int raw_size) {
+  ++*static_cast<long *>(cookie);
+}
+
+static int bench_perf(void *mod, double seconds) {
+  int prog_fd = bpf_prog_load(BPF_PROG_TYPE_TRACEPOINT,
+                              (const struct bpf_insn *)bpf_function_start(mod, "on_getppid"),
+                              bpf_function_size(mod, "on_getppid"), bpf_module_license(mod),
+                              bpf_module_kern_version(mod), NULL, 0);
+  if (prog_fd < 0)
+    return -1;
+
+  long events = 0;
+  std::vector<struct perf_reader *> readers;
+  int map_fd = bpf_table_fd(mod, "events");
+  int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  for (int cpu = 0; cpu < ncpus; ++cpu) {
+    void *reader = bpf_open_perf_buffer(count_event, &events, -1, cpu);
+    if (!reader)
+      return -1;
+    readers.push_back(static_cast<struct perf_reader *>(reader));
+    int fd = perf_reader_fd(readers.back());
+    // a reader missing from the map would only show as no events
+    if (bpf_update_elem(map_fd, &cpu, &fd, 0) < 0)
+      return -1;
+  }
+  void *tp = bpf_attach_tracepoint(prog_fd, "syscalls", "sys_enter_getppid", -1, 0, -1,
+                                   NULL, NULL);
+  if (!tp)
+    return -1;
+
+  std::atomic<bool> stop(false);
+  std::thread producer([&stop]() {
+    while (!stop)
+      syscall(SYS_getppid);
+  });
+  double wall = clock_ns(CLOCK_MONOTONIC), cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+  double end = wall + seconds * 1e9;
+  while (clock_ns(CLOCK_MONOTONIC) < end)
+    perf_reader_poll(readers.size(), readers.data(), 100);
+  wall = clock_ns(CLOCK_MONOTONIC) - wall;
+  cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+  stop = true;
+  producer.join();
+  report("perf_poll_c_cb", events, wall, cpu);
+
+  perf_reader_free(tp);
+  for (auto reader : readers)
+    perf_reader_free(reader);
+  close(prog_fd);
+  return 0;
+}
+
+static int bench_iterate(void *mod, long iterations) {
+  int fd = bpf_table_fd(mod, "flat");
+  for (uint64_t k = 0; k < FLAT_ENTRIES; ++k)
+    if (bpf_update_elem(fd, &k, &k, 0) < 0)
+      return -1;
+
+  long keys = 0;
+  double wall = clock_ns(CLOCK_MONOTONIC), cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+  // a key that is not in the table starts the walk from the beginning
+  while (keys < iterations) {
+    uint64_t key = -1, next, leaf;
+    while (bpf_get_next_key(fd, &key, &next) == 0) {
+      bpf_lookup_elem(fd, &next, &leaf);
+      key = next;
+      ++keys;
+    }
+  }
+  report("map_iterate", keys, clock_ns(CLOCK_MONOTONIC) - wall,
+         clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu);
+  return 0;
+}
+
+static int bench_format(void *mod, long iterations) {
+  struct {
+    uint32_t pid;
+    uint64_t ts;
+    char comm[16];
+  } key = {1234, 0x123456789, "bench"};
+  uint64_t leaf = 42;
+  char buf[512];
+  size_t id = bpf_table_id(mod, "keyed");
+
+  double wall = clock_ns(CLOCK_MONOTONIC), cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+  for (long i = 0; i < iterations; ++i)
+    if (bpf_table_key_snprintf(mod, id, buf, sizeof(buf), &key) < 0)
+      return -1;
+  report("key_printf", iterations, clock_ns(CLOCK_MONOTONIC) - wall,
+         clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu);
+
+  wall = clock_ns(CLOCK_MONOTONIC), cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+  for (long i = 0; i < iterations; ++i)
+    if (bpf_table_key_sscanf(mod, id, buf, &key) < 0)
+      return -1;
+  report("key_scanf", iterations, clock_ns(CLOCK_MONOTONIC) - wall,
+         clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu);
+
+  bpf_table_leaf_snprintf(mod, id, buf, sizeof(buf), &leaf);
+  wall = clock_ns(CLOCK_MONOTONIC), cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+  for (long i = 0; i < iterations; ++i)
+    if (bpf_table_leaf_sscanf(mod, id, buf, &leaf) < 0)
+      return -1;
+  report("leaf_scanf", iterations, clock_ns(CLOCK_MONOTONIC) - wall,
+         clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 5;
+  long iterations = argc > 2 ? atol(argv[2]) : 1000000;
+
+  void *mod = bpf_module_create_c_from_string(PROG_TEXT, 0, NULL, 0);
+  if (!mod) {
+    fprintf(stderr, "failed to compile the benchmark program\n");
+    return 1;
+  }
+
+  printf("%-20s %12s %14s %12s\n", "BENCH", "OPS", "OPS/S", "CPU-NS/OP");
+  int rc = 0;
+  if (bench_perf(mod, seconds) < 0) {
+    fprintf(stderr, "perf_poll_c_cb: failed to set up\n");
+    rc = 1;
+  }
+  if (bench_iterate(mod, iterations) < 0) {
+    fprintf(stderr, "map_iterate: failed to fill the table\n");
+    rc = 1;
+  }
+  if (bench_format(mod, iterations) < 0) {
+    fprintf(stderr, "key/leaf format: failed\n");
+    rc = 1;
+  }
+  bpf_module_destroy(mod);
+  return rc;
+}
@@ -14,15 +14,19 @@
  * limitations under the License.
  */
 #include <dlfcn.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 #include "bcc_elf.h"
 #include "bcc_perf_map.h"
 #include "bcc_proc.h"
 #include "bcc_syms.h"
+#include "libbpf.h"
 #include "vendor/tinyformat.hpp"
 
 #include "catch.hpp"
@@ -36,6 +40,21 @@ TEST_CASE("shared object resolution", "[c_api]") {
   REQUIRE(string(libm).find("libm.so") != string::npos);
 }
 
+TEST_CASE("shared object resolution from several threads", "[c_api]") {
+  const char *libc = bcc_procutils_which_so("c");
+  REQUIRE(libc);
+  vector<const char *> found(8);
+  vector<thread> threads;
+  for (size_t i = 0; i < found.size(); ++i)
+    threads.emplace_back([&found, i]() { found[i] = bcc_procutils_which_so("c"); });
+  for (auto &t : threads)
+    t.join();
+  // one copy of each path, kept for the life of the process
+  for (const char *path : found)
+    REQUIRE(path == libc);
+  REQUIRE(bcc_procutils_which_so("no-such-library-bcc") == NULL);
+}
+
 TEST_CASE("binary resolution with `which`", "[c_api]") {
   char *ld = bcc_procutils_which("ld");
   REQUIRE(ld);
@@ -65,6 +84,34 @@ TEST_CASE("resolve symbol name in external library", "[c_api]") {
   REQUIRE(sym.offset != 0);
 }
 
+static int _count_sym(const char *name, uint64_t addr, uint64_t size,
+                      int flags, void *payload) {
+  ++*static_cast<int *>(payload);
+  return 0;
+}
+
+TEST_CASE("inspect an ELF file through one handle", "[c_api]") {
+  const char *libc = bcc_procutils_which_so("c");
+  REQUIRE(libc);
+  struct bcc_elf_file *elf = bcc_elf_open(libc);
+  REQUIRE(elf);
+
+  uint64_t addr, path_addr;
+  REQUIRE(bcc_elf_file_loadaddr(elf, &addr) == 0);
+  REQUIRE(bcc_elf_loadaddr(libc, &path_addr) == 0);
+  REQUIRE(addr == path_addr);
+  REQUIRE(bcc_elf_file_is_shared_obj(elf) == 1);
+
+  int count = 0, path_count = 0;
+  REQUIRE(bcc_elf_file_foreach_sym(elf, _count_sym, &count) == 0);
+  REQUIRE(bcc_elf_foreach_sym(libc, _count_sym, &path_count) == 0);
+  REQUIRE(count > 0);
+  REQUIRE(count == path_count);
+  bcc_elf_close(elf);
+
+  REQUIRE(bcc_elf_open("/proc/self/nonexistent") == NULL);
+}
+
 extern "C" int _a_test_function(const char *a_string) {
   int i;
   for (i = 0; a_string[i]; ++i)
@@ -198,3 +245,36 @@ TEST_CASE("resolve symbols using /tmp/perf-pid.map", "[c_api]") {
 
   munmap(map_addr, map_sz);
 }
+
+TEST_CASE("attach registry releases fds", "[c_api]") {
+  int fds[2];
+  void *registry = bpf_attach_registry_new();
+
+  REQUIRE(registry);
+  REQUIRE(pipe(fds) == 0);
+
+  int h0 = bpf_attach_registry_add(registry, BPF_ATTACH_PERF_EVENT, NULL, NULL,
+                                   fds[0]);
+  int h1 = bpf_attach_registry_add(registry, BPF_ATTACH_PERF_EVENT, NULL, NULL,
+                                   fds[1]);
+  REQUIRE(h0 >= 0);
+  REQUIRE(h1 >= 0);
+  REQUIRE(h0 != h1);
+
+  SECTION("detach a single handle") {
+    REQUIRE(bpf_attach_registry_detach(registry, h0) == 0);
+    REQUIRE(fcntl(fds[0], F_GETFD) < 0);
+    REQUIRE(fcntl(fds[1], F_GETFD) >= 0);
+    REQUIRE(bpf_attach_registry_detach(registry, h0) < 0);
+    REQUIRE(bpf_attach_registry_detach_all(registry) == 0);
+    REQUIRE(fcntl(fds[1], F_GETFD) < 0);
+  }
+
+  SECTION("detach everything") {
+    REQUIRE(bpf_attach_registry_detach_all(registry) == 0);
+    REQUIRE(fcntl(fds[0], F_GETFD) < 0);
+    REQUIRE(fcntl(fds[1], F_GETFD) < 0);
+  }
+
+  bpf_attach_registry_free(registry);
+}
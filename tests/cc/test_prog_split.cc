@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <vector>
+#include <linux/bpf.h>
+
+#include "catch.hpp"
+#include "prog_split.h"
+
+using std::vector;
+
+static struct bpf_insn insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off,
+                            int32_t imm) {
+  struct bpf_insn i = {};
+  i.code = code;
+  i.dst_reg = dst;
+  i.src_reg = src;
+  i.off = off;
+  i.imm = imm;
+  return i;
+}
+
+// r6 = ctx, then blocks that each go through the stack and end with nothing
+// but r6 live
+static vector<struct bpf_insn> make_prog(int nblocks) {
+  vector<struct bpf_insn> prog;
+  prog.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0));
+  for (int i = 0; i < nblocks; ++i) {
+    prog.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, 0, 6, 0, 0));
+    prog.push_back(insn(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1, 0));
+    prog.push_back(insn(BPF_ALU64 | BPF_ADD | BPF_K, 0, 0, 0, i));
+    prog.push_back(insn(BPF_STX | BPF_MEM | BPF_W, 10, 0, -4, 0));
+    prog.push_back(insn(BPF_LDX | BPF_MEM | BPF_W, 1, 10, -4, 0));
+  }
+  prog.push_back(insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, 0));
+  prog.push_back(insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+  return prog;
+}
+
+TEST_CASE("split large program with tail calls", "[prog_split]") {
+  vector<struct bpf_insn> prog = make_prog(2000);
+  ebpf::ProgSplitter splitter(prog.data(), prog.size(), 4096);
+  REQUIRE(splitter.find_cuts());
+  REQUIRE(splitter.num_parts() == 3);
+
+  vector<vector<struct bpf_insn>> parts;
+  splitter.build(42, &parts);
+  REQUIRE(parts.size() == 3);
+
+  size_t total = 0;
+  for (size_t k = 0; k < parts.size(); ++k) {
+    const vector<struct bpf_insn> &p = parts[k];
+    REQUIRE(p.size() <= 4096);
+    if (k > 0) {
+      // context restored from r1
+      REQUIRE(p[0].code == (BPF_ALU64 | BPF_MOV | BPF_X));
+      REQUIRE(p[0].dst_reg == 6);
+      REQUIRE(p[0].src_reg == 1);
+      total -= 1;
+    }
+    if (k + 1 < parts.size()) {
+      const struct bpf_insn *stub = &p[p.size() - 7];
+      REQUIRE(stub[0].dst_reg == 1);
+      REQUIRE(stub[0].src_reg == 6);
+      REQUIRE(stub[1].src_reg == BPF_PSEUDO_MAP_FD);
+      REQUIRE(stub[1].imm == 42);
+      REQUIRE(stub[3].imm == (int)k + 1);
+      REQUIRE(stub[4].imm == BPF_FUNC_tail_call);
+      total -= 7;
+    }
+    total += p.size();
+  }
+  REQUIRE(total == prog.size());
+}
+
+TEST_CASE("small program is left alone", "[prog_split]") {
+  vector<struct bpf_insn> prog = make_prog(10);
+  ebpf::ProgSplitter splitter(prog.data(), prog.size(), 4096);
+  REQUIRE(splitter.find_cuts());
+  REQUIRE(splitter.num_parts() == 1);
+}
+
+TEST_CASE("stack carried across the program cannot be split", "[prog_split]") {
+  vector<struct bpf_insn> prog = make_prog(2000);
+  // written at the start, read back just before exit
+  prog.insert(prog.begin() + 1, insn(BPF_ST | BPF_MEM | BPF_DW, 10, 0, -16, 7));
+  prog.insert(prog.end() - 2, insn(BPF_LDX | BPF_MEM | BPF_DW, 0, 10, -16, 0));
+  ebpf::ProgSplitter splitter(prog.data(), prog.size(), 4096);
+  REQUIRE(!splitter.find_cuts());
+}
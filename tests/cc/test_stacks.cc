@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+
+#include "bcc_syms.h"
+#include "libbpf.h"
+#include "stacks.h"
+
+#include "catch.hpp"
+
+using namespace std;
+
+namespace {
+
+struct CountKey {
+  uint32_t pid;
+  int user_stack_id;
+  int kernel_stack_id;
+  char name[16];
+};
+
+const int STACK_DEPTH = 127;
+
+__attribute__((noinline)) int stack_leaf_fn() { return 1; }
+__attribute__((noinline)) int stack_root_fn() { return stack_leaf_fn() + 1; }
+
+void count(int fd, const char *comm, int user_stack, int kernel_stack,
+           uint64_t n) {
+  CountKey key = {};
+  key.pid = getpid();
+  key.user_stack_id = user_stack;
+  key.kernel_stack_id = kernel_stack;
+  strncpy(key.name, comm, sizeof(key.name));
+  REQUIRE(bpf_update_elem(fd, &key, &n, 0) == 0);
+}
+
+#ifdef __x86_64__
+// what the BPF side of an unwinding profile would copy: the registers of the
+// leaf of a call chain built without frame pointers, and the stack above
+struct UnwindSnapshot {
+  struct bcc_user_regs regs;
+  size_t size;
+  uint8_t stack[8192];
+} snapshot;
+
+__attribute__((noinline))
+int unwind_leaf_fn(int depth) {
+  uint64_t ip, sp, bp;
+  asm volatile("lea 0(%%rip), %0\n\tmov %%rsp, %1\n\tmov %%rbp, %2"
+               : "=r"(ip), "=r"(sp), "=r"(bp));
+  snapshot.regs.ip = ip;
+  snapshot.regs.sp = sp;
+  snapshot.regs.bp = bp;
+
+  pthread_attr_t attr;
+  void *stack;
+  size_t size;
+  pthread_getattr_np(pthread_self(), &attr);
+  pthread_attr_getstack(&attr, &stack, &size);
+  pthread_attr_destroy(&attr);
+  snapshot.size = std::min(sizeof(snapshot.stack),
+                           (size_t)((uint64_t)stack + size - sp));
+  memcpy(snapshot.stack, (void *)sp, snapshot.size);
+  return depth + 1;
+}
+
+__attribute__((noinline))
+int unwind_middle_fn(int depth) { return unwind_leaf_fn(depth + 1) * 2; }
+
+__attribute__((noinline))
+int unwind_root_fn() { return unwind_middle_fn(0) + 1; }
+#endif
+
+}  // namespace
+
+TEST_CASE("stacks are folded from a counts and a stack map", "[stacks]") {
+  int counts = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(CountKey),
+                              sizeof(uint64_t), 16);
+  // stack trace maps take no updates from user space, a hash map with the
+  // same layout stands in for one
+  int stacks = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(uint32_t),
+                              STACK_DEPTH * sizeof(uint64_t), 16);
+  REQUIRE(counts >= 0);
+  REQUIRE(stacks >= 0);
+
+  uint64_t ips[STACK_DEPTH] = {(uint64_t)&stack_leaf_fn + 1,
+                               (uint64_t)&stack_root_fn + 1};
+  uint32_t id = 3;
+  REQUIRE(bpf_update_elem(stacks, &id, ips, 0) == 0);
+  count(counts, "worker", 3, -1, 3);
+  count(counts, "worker", 3, -EFAULT, 2);
+  count(counts, "other", 3, -1, 1);
+  // a stack that was not stored
+  count(counts, "lost", 7, -1, 4);
+  // a stack the stack map had no room for
+  count(counts, "full", 3, -ENOMEM, 1);
+
+  struct bcc_stack_key layout = {sizeof(CountKey),
+                                 sizeof(uint64_t),
+                                 offsetof(CountKey, pid),
+                                 offsetof(CountKey, name),
+                                 sizeof(((CountKey *)0)->name),
+                                 offsetof(CountKey, user_stack_id),
+                                 offsetof(CountKey, kernel_stack_id),
+                                 -1};
+  StackReport report;
+  REQUIRE(report.read(counts, stacks, layout));
+  REQUIRE(report.missing() == 2);
+  REQUIRE(report.out_of_room() == 1);
+
+  string folded = report.folded();
+  size_t worker = folded.find("worker;");
+  REQUIRE(worker != string::npos);
+  string line = folded.substr(worker, folded.find('\n', worker) - worker);
+  size_t root = line.find("stack_root_fn"), leaf = line.find("stack_leaf_fn");
+  REQUIRE(root != string::npos);
+  REQUIRE(leaf != string::npos);
+  REQUIRE(root < leaf);
+  REQUIRE(line.substr(line.size() - 2) == " 5");
+  REQUIRE(folded.find("other;") != string::npos);
+  REQUIRE(folded.find("lost") != string::npos);
+
+  // one location per address, referring to interned names
+  string pprof = report.pprof();
+  REQUIRE(pprof.size() > 0);
+  REQUIRE(pprof[0] == 0x0a);
+  REQUIRE(pprof.find("stack_leaf_fn") != string::npos);
+  REQUIRE(pprof.find("stack_leaf_fn") == pprof.rfind("stack_leaf_fn"));
+  REQUIRE(pprof.find("worker") != string::npos);
+
+  close(counts);
+  close(stacks);
+}
+
+TEST_CASE("stacks no count refers to are reclaimed", "[stacks]") {
+  int counts = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(CountKey),
+                              sizeof(uint64_t), 16);
+  int stacks = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(uint32_t),
+                              STACK_DEPTH * sizeof(uint64_t), 16);
+  REQUIRE(counts >= 0);
+  REQUIRE(stacks >= 0);
+
+  uint64_t ips[STACK_DEPTH] = {(uint64_t)&stack_leaf_fn};
+  for (uint32_t id : {1, 2, 3})
+    REQUIRE(bpf_update_elem(stacks, &id, ips, 0) == 0);
+  count(counts, "worker", 1, 3, 1);
+
+  struct bcc_stack_key layout = {sizeof(CountKey), sizeof(uint64_t), -1, -1, 0,
+                                 offsetof(CountKey, user_stack_id),
+                                 offsetof(CountKey, kernel_stack_id), -1};
+  void *reclaimer = bcc_stacks_reclaimer_new(stacks, 16);
+  // unreferenced stacks get one pass of grace
+  REQUIRE(bcc_stacks_reclaim(reclaimer, &counts, &layout, 1) == 0);
+  REQUIRE(bcc_stacks_reclaim(reclaimer, &counts, &layout, 1) == 1);
+  uint32_t id = 2;
+  REQUIRE(bpf_lookup_elem(stacks, &id, ips) < 0);
+
+  CountKey key = {};
+  REQUIRE(bpf_get_first_key(counts, &key, sizeof(key)) == 0);
+  REQUIRE(bpf_delete_elem(counts, &key) == 0);
+  REQUIRE(bcc_stacks_reclaim(reclaimer, &counts, &layout, 1) == 0);
+  REQUIRE(bcc_stacks_reclaim(reclaimer, &counts, &layout, 1) == 2);
+  bcc_stacks_reclaimer_free(reclaimer);
+
+  for (uint32_t id : {4, 5})
+    REQUIRE(bpf_update_elem(stacks, &id, ips, 0) == 0);
+  REQUIRE(bcc_stacks_clear(stacks, 16) == 2);
+  REQUIRE(bcc_stacks_clear(stacks, 16) == 0);
+
+  close(counts);
+  close(stacks);
+}
+
+#ifdef __x86_64__
+TEST_CASE("user stacks unwind through their call frame information",
+          "[stacks]") {
+  REQUIRE(unwind_root_fn() == 5);
+
+  void *cache = bcc_symcache_new(getpid());
+  uint64_t ips[32];
+  int n = bcc_symcache_unwind(cache, &snapshot.regs, snapshot.stack,
+                              snapshot.size, ips, 32);
+  REQUIRE(n > 3);
+  const char *callers[] = {"unwind_leaf_fn", "unwind_middle_fn",
+                           "unwind_root_fn"};
+  for (int i = 0; i < 3; ++i) {
+    struct bcc_symbol sym;
+    REQUIRE(bcc_symcache_resolve(cache, ips[i], &sym) == 0);
+    REQUIRE(string(sym.name).find(callers[i]) != string::npos);
+  }
+
+  // nothing past the copy of the stack is read
+  REQUIRE(bcc_symcache_unwind(cache, &snapshot.regs, snapshot.stack, 8, ips,
+                              32) <= 2);
+  bcc_free_symcache(cache, getpid());
+}
+#endif
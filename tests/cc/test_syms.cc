@@ -0,0 +1,673 @@
+/*
+ * Copyright (c) 2026 The bcc Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <atomic>
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "bcc_elf.h"
+#include "bcc_proc.h"
+#include "bcc_syms.h"
+#include "syms.h"
+#include "vendor/tinyformat.hpp"
+
+#include "catch.hpp"
+
+using namespace std;
+
+static string self_exe() {
+  char buf[256];
+  ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+  REQUIRE(len > 0);
+  return string(buf, len);
+}
+
+TEST_CASE("symbol table lookups", "[syms]") {
+  SymbolTable narrow, wide;
+  narrow.add("c", 0x7f0000003000, 0x100, 0);
+  narrow.add("a", 0x7f0000001000, 0x10, 0);
+  narrow.add("b", 0x7f0000002000, 0, 0);
+  narrow.add("a", 0x7f0000004000, 0x10, 0);
+  narrow.finalize();
+  // kallsyms mixes per-cpu offsets with kernel text addresses
+  wide.add("percpu_var", 0x1000, 0, 0);
+  wide.add("_stext", 0xffffffff81000000ull, 0, 0);
+  wide.finalize();
+
+  REQUIRE(narrow.count() == 4);
+  REQUIRE(string("a") == narrow.name(0));
+  REQUIRE(narrow.start(3) == 0x7f0000004000);
+  REQUIRE(narrow.find_addr(0x7f0000001008) == 0);
+  REQUIRE(narrow.find_addr(0x7f0000001010) == -1);
+  REQUIRE(narrow.find_addr(0x7f0000002000) == -1);
+  REQUIRE(narrow.find_preceding(0x7f0000002008) == 1);
+  REQUIRE(narrow.find_preceding(0x10) == -1);
+  REQUIRE(narrow.find_preceding(0x7f0000003008, 1) == 2);
+  REQUIRE(narrow.find_preceding(0x7f0000008000, 1) == 3);
+  REQUIRE(narrow.find_name("a") == 0);
+  REQUIRE(narrow.find_name("c") == 2);
+  REQUIRE(narrow.find_name("d") == -1);
+
+  REQUIRE(wide.start(1) == 0xffffffff81000000ull);
+  REQUIRE(wide.find_preceding(0xffffffff81000010ull) == 1);
+  REQUIRE(wide.find_name("percpu_var") == 0);
+}
+
+TEST_CASE("shared symbol tables are parsed once per file", "[syms]") {
+  SymbolTableCache *cache = SymbolTableCache::instance();
+  string exe = self_exe();
+
+  auto a = cache->get(exe);
+  auto b = cache->get(exe);
+  REQUIRE(a.get() == b.get());
+  REQUIRE(a->count() > 0);
+  bool sorted = true;
+  for (size_t i = 1; i < a->count(); ++i)
+    sorted = sorted && a->start(i - 1) <= a->start(i);
+  REQUIRE(sorted);
+}
+
+TEST_CASE("copies of a library share a table by build-id", "[syms]") {
+  const char *libc = bcc_procutils_which_so("c");
+  char buildid[128];
+  REQUIRE(libc);
+  if (bcc_elf_get_buildid(libc, buildid, sizeof(buildid)) < 0)
+    return;
+
+  // as a library in two containers is two files
+  string copy = tfm::format("/tmp/bcc-test-copy-%d.so", getpid());
+  REQUIRE(system(tfm::format("cp %s %s", libc, copy).c_str()) == 0);
+  SymbolTableCache *cache = SymbolTableCache::instance();
+  auto original = cache->get(libc);
+  REQUIRE(cache->get(copy).get() == original.get());
+  unlink(copy.c_str());
+
+  char root[64];
+  REQUIRE(bcc_procutils_mount_root(getpid(), root, sizeof(root)) == 0);
+  REQUIRE(string(root) == "");
+}
+
+TEST_CASE("a file loaded from several threads is parsed once", "[syms]") {
+  const char *libc = bcc_procutils_which_so("c");
+  REQUIRE(libc);
+  string copy = tfm::format("/tmp/bcc-test-threads-%d.so", getpid());
+  REQUIRE(system(tfm::format("cp %s %s", libc, copy).c_str()) == 0);
+
+  SymbolTableCache *cache = SymbolTableCache::instance();
+  std::vector<std::shared_ptr<const SymbolTable>> tables(8);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < tables.size(); ++i)
+    threads.emplace_back([&, i]() { tables[i] = cache->get(copy); });
+  for (std::thread &t : threads)
+    t.join();
+  unlink(copy.c_str());
+
+  REQUIRE(tables[0]->count() > 0);
+  for (auto &table : tables)
+    REQUIRE(table.get() == tables[0].get());
+}
+
+TEST_CASE("prefetched modules resolve like lazily loaded ones", "[syms]") {
+  void *addr = dlsym(RTLD_DEFAULT, "getpid");
+  REQUIRE(addr);
+
+  ProcSyms lazy(getpid()), eager(getpid(), true);
+  eager.prefetch();
+  struct bcc_symbol a, b;
+  REQUIRE(lazy.resolve_addr((uint64_t)addr, &a));
+  REQUIRE(eager.resolve_addr((uint64_t)addr, &b));
+  REQUIRE(string(a.name) == b.name);
+  REQUIRE(string(a.module) == b.module);
+  REQUIRE(a.offset == b.offset);
+}
+
+TEST_CASE("a cache resolves from several threads while it prefetches",
+          "[syms]") {
+  void *addr = dlsym(RTLD_DEFAULT, "getpid");
+  REQUIRE(addr);
+  string name, module;
+  {
+    ProcSyms syms(getpid());
+    struct bcc_symbol sym;
+    REQUIRE(syms.resolve_addr((uint64_t)addr, &sym));
+    name = sym.name;
+    module = sym.module;
+  }
+
+  ProcSyms syms(getpid());
+  // every miss reloads the mappings
+  syms.set_check_interval(0);
+  const int rounds = 200;
+  std::atomic<int> resolved(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < rounds; ++j) {
+        struct bcc_symbol sym, batch[2];
+        uint64_t addrs[2] = {(uint64_t)addr, 0x10};
+        if (syms.resolve_addr((uint64_t)addr, &sym) && name == sym.name &&
+            module == sym.module)
+          ++resolved;
+        if (syms.resolve_batch(addrs, 2, batch) == 1 && name == batch[0].name)
+          ++resolved;
+        syms.memory();
+      }
+    });
+  }
+  syms.prefetch();
+  for (std::thread &t : threads)
+    t.join();
+  // Catch assertions are for the main thread only
+  REQUIRE(resolved == 4 * rounds * 2);
+}
+
+TEST_CASE("shared symbol tables are evicted past capacity", "[syms]") {
+  SymbolTableCache *cache = SymbolTableCache::instance();
+  string exe = self_exe();
+  const char *libc = bcc_procutils_which_so("c");
+  REQUIRE(libc);
+
+  cache->set_capacity(1);
+  auto a = cache->get(exe);
+  auto b = cache->get(libc);
+  REQUIRE(cache->size() == 1);
+  // still usable after it left the cache, and found again by build-id while
+  // it is
+  REQUIRE(a->count() > 0);
+  REQUIRE(cache->get(exe)->count() == a->count());
+  cache->set_capacity(1024);
+}
+
+TEST_CASE("modules mapped after creation are found on a miss", "[syms]") {
+  ProcSyms never(getpid()), always(getpid());
+  never.set_check_interval(~0ull);
+  always.set_check_interval(0);
+
+  void *handle = dlopen("libcrypt.so.1", RTLD_NOW);
+  REQUIRE(handle);
+  Dl_info info;
+  REQUIRE(dladdr(dlsym(handle, "crypt"), &info));
+  char path[PATH_MAX];
+  REQUIRE(realpath(info.dli_fname, path));
+
+  uint64_t addr;
+  REQUIRE(!never.resolve_name(path, "crypt", &addr));
+  REQUIRE(always.resolve_name(path, "crypt", &addr));
+  never.refresh();
+  REQUIRE(never.resolve_name(path, "crypt", &addr));
+  dlclose(handle);
+}
+
+TEST_CASE("results of unchanged mappings survive a reload", "[syms]") {
+  void *addr = dlsym(RTLD_DEFAULT, "getpid");
+  REQUIRE(addr);
+
+  ProcSyms syms(getpid());
+  struct bcc_symbol before, after;
+  REQUIRE(syms.resolve_addr((uint64_t)addr, &before));
+  syms.refresh();
+  REQUIRE(syms.resolve_addr((uint64_t)addr, &after));
+  // the same module, not a copy of it
+  REQUIRE(before.module == after.module);
+  REQUIRE(before.name == after.name);
+}
+
+static int find_mapping(const struct bcc_mapping *map, void *payload) {
+  auto *found = static_cast<pair<uint64_t, struct bcc_mapping> *>(payload);
+  if (map->start <= found->first && found->first < map->end) {
+    found->second = *map;
+    found->second.path = nullptr;
+    return -1;
+  }
+  return 0;
+}
+
+TEST_CASE("mappings are listed with their file offset and identity", "[syms]") {
+  pair<uint64_t, struct bcc_mapping> found((uint64_t)&strtok, {});
+  REQUIRE(bcc_procutils_each_mapping(getpid(), find_mapping, &found) == 0);
+  REQUIRE(found.second.end > found.second.start);
+  REQUIRE(string(found.second.perms).find('x') != string::npos);
+  REQUIRE(found.second.inode != 0);
+  REQUIRE(!found.second.deleted);
+
+  // a library unlinked after it was loaded is read through its mapping
+  void *handle = dlopen("libcrypt.so.1", RTLD_NOW);
+  REQUIRE(handle);
+  Dl_info info;
+  REQUIRE(dladdr(dlsym(handle, "crypt"), &info));
+  string copy = tfm::format("/tmp/bcc-test-deleted-%d.so", getpid());
+  REQUIRE(system(tfm::format("cp %s %s", info.dli_fname, copy).c_str()) == 0);
+  void *deleted = dlopen(copy.c_str(), RTLD_NOW | RTLD_LOCAL);
+  unlink(copy.c_str());
+  REQUIRE(deleted);
+
+  uint64_t addr = (uint64_t)dlsym(deleted, "crypt");
+  found.first = addr;
+  REQUIRE(bcc_procutils_each_mapping(getpid(), find_mapping, &found) == 0);
+  REQUIRE(found.second.deleted);
+
+  ProcSyms syms(getpid());
+  struct bcc_symbol sym;
+  REQUIRE(syms.resolve_addr(addr, &sym));
+  REQUIRE(string(sym.module) == copy);
+  // crypt has aliases, any of them will do
+  REQUIRE(string(sym.name).find("crypt") != string::npos);
+  REQUIRE(sym.offset == 0);
+  dlclose(deleted);
+  dlclose(handle);
+}
+
+TEST_CASE("addresses outside of any mapping fall back to the perf map", "[syms]") {
+  void *anon = mmap(NULL, 4096, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  REQUIRE(anon != MAP_FAILED);
+  string path = tfm::format("/tmp/perf-%d.map", getpid());
+  FILE *file = fopen(path.c_str(), "w");
+  REQUIRE(file);
+  fprintf(file, "%llx 10 jitted_fn\n", (unsigned long long)anon);
+  fclose(file);
+
+  ProcSyms syms(getpid());
+  struct bcc_symbol sym;
+  uint64_t libc_addr = (uint64_t)&strtok;
+  for (int i = 0; i < 2; ++i) {
+    syms.resolve_addr(libc_addr, &sym);
+    REQUIRE(sym.module);
+    REQUIRE(string(sym.module).find("libc") != string::npos);
+
+    REQUIRE(syms.resolve_addr((uint64_t)anon + 4, &sym));
+    REQUIRE(string(sym.module) == path);
+    REQUIRE(string("jitted_fn") == sym.name);
+    REQUIRE(sym.offset == 4);
+  }
+
+  unlink(path.c_str());
+  munmap(anon, 4096);
+}
+
+TEST_CASE("perf maps are read incrementally as they grow", "[syms]") {
+  string path = tfm::format("/tmp/perf-%d-tail.map", getpid());
+  FILE *file = fopen(path.c_str(), "w");
+  REQUIRE(file);
+  fprintf(file, "1000 100 first\n2000 100 second\n");
+  fflush(file);
+
+  PerfMapTable table;
+  const char *name;
+  uint64_t start, addr;
+  REQUIRE(table.update(path));
+  REQUIRE(table.find_addr(0x1010, &name, &start));
+  REQUIRE(string("first") == name);
+  REQUIRE(!table.update(path));
+
+  // the runtime reused the code of first, and is writing another line
+  fprintf(file, "1000 80 replaced\n3000 100 third\n4000 10 unfin");
+  fflush(file);
+  REQUIRE(table.update(path));
+  REQUIRE(table.find_addr(0x1010, &name, &start));
+  REQUIRE(string("replaced") == name);
+  REQUIRE(!table.find_addr(0x1090, &name, &start));
+  REQUIRE(table.find_addr(0x2050, &name, &start));
+  REQUIRE(string("second") == name);
+  REQUIRE(table.find_addr(0x3000, &name, &start));
+  REQUIRE(string("third") == name);
+  REQUIRE(!table.find_addr(0x4000, &name, &start));
+  REQUIRE(!table.find_name("first", &addr));
+
+  fprintf(file, "ished\n");
+  fflush(file);
+  REQUIRE(table.update(path));
+  REQUIRE(table.find_addr(0x4004, &name, &start));
+  REQUIRE(string("unfinished") == name);
+  REQUIRE(start == 0x4000);
+  REQUIRE(table.find_name("third", &addr));
+  REQUIRE(addr == 0x3000);
+
+  // a run too small to be merged yet still hides what it overlaps
+  fprintf(file, "3000 40 fourth\n");
+  fflush(file);
+  REQUIRE(table.update(path));
+  REQUIRE(table.find_addr(0x3000, &name, &start));
+  REQUIRE(string("fourth") == name);
+  REQUIRE(!table.find_addr(0x3050, &name, &start));
+  REQUIRE(!table.find_name("third", &addr));
+
+  fclose(file);
+  unlink(path.c_str());
+}
+
+static int collect_match(const char *name, uint64_t addr, int pattern, void *payload) {
+  auto *found = static_cast<vector<pair<string, int>> *>(payload);
+  found->emplace_back(name, pattern);
+  return 0;
+}
+
+TEST_CASE("enumerate symbols matching several patterns", "[syms]") {
+  const char *libc = bcc_procutils_which_so("c");
+  REQUIRE(libc);
+  vector<pair<string, int>> found;
+
+  SECTION("globs") {
+    const char *patterns[] = {"strtok", "strto*l"};
+    REQUIRE(bcc_foreach_symbol_match(libc, patterns, 2, 0, collect_match, &found) == 0);
+    REQUIRE(find(found.begin(), found.end(), make_pair(string("strtok"), 0)) != found.end());
+    REQUIRE(find(found.begin(), found.end(), make_pair(string("strtol"), 1)) != found.end());
+    REQUIRE(find(found.begin(), found.end(), make_pair(string("strtok_r"), 0)) == found.end());
+  }
+
+  SECTION("regexes") {
+    const char *patterns[] = {"^strtok(_r)?$"};
+    REQUIRE(bcc_foreach_symbol_match(libc, patterns, 1, BCC_SYM_MATCH_REGEX, collect_match,
+                                     &found) == 0);
+    REQUIRE(find(found.begin(), found.end(), make_pair(string("strtok"), 0)) != found.end());
+    REQUIRE(find(found.begin(), found.end(), make_pair(string("strtok_r"), 0)) != found.end());
+    REQUIRE(find(found.begin(), found.end(), make_pair(string("strtol"), 0)) == found.end());
+
+    const char *bad[] = {"("};
+    REQUIRE(bcc_foreach_symbol_match(libc, bad, 1, BCC_SYM_MATCH_REGEX, collect_match,
+                                     &found) < 0);
+  }
+}
+
+TEST_CASE("demangled names are cached in the table", "[syms]") {
+  SymbolTable table;
+  table.add("_ZN4ebpf9BPFModule4loadEv", 0x1000, 0x10, 0);
+  table.add("plain_c_function", 0x2000, 0x10, 0);
+  table.add("_Znot_valid", 0x3000, 0x10, 0);
+  table.finalize();
+
+  const char *name = table.demangled(0);
+  REQUIRE(string("ebpf::BPFModule::load()") == name);
+  REQUIRE(table.demangled(0) == name);
+  REQUIRE(table.demangled(1) == table.name(1));
+  REQUIRE(table.demangled(2) == table.name(2));
+}
+
+TEST_CASE("resolve a batch of addresses", "[syms]") {
+  void *anon = mmap(NULL, 4096, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  REQUIRE(anon != MAP_FAILED);
+  uint64_t base = (uint64_t)anon;
+  string path = tfm::format("/tmp/perf-%d.map", getpid());
+  FILE *file = fopen(path.c_str(), "w");
+  REQUIRE(file);
+  fprintf(file, "%llx 10 first_fn\n", (unsigned long long)base);
+  fprintf(file, "%llx 10 second_fn\n", (unsigned long long)base + 0x10);
+  fclose(file);
+
+  void *resolver = bcc_symcache_new(getpid());
+  REQUIRE(resolver);
+  uint64_t addrs[] = {base + 0x14, base + 2, base + 0x14, base + 0x100};
+  struct bcc_symbol out[4];
+  REQUIRE(bcc_symcache_resolve_batch(resolver, addrs, 4, out) == 3);
+  REQUIRE(string("second_fn") == out[0].name);
+  REQUIRE(out[0].offset == 4);
+  REQUIRE(string("first_fn") == out[1].name);
+  REQUIRE(out[1].offset == 2);
+  REQUIRE(string("second_fn") == out[2].name);
+  REQUIRE(out[3].name == nullptr);
+  bcc_free_symcache(resolver, getpid());
+
+  unlink(path.c_str());
+  munmap(anon, 4096);
+}
+
+TEST_CASE("a batch resolves like its addresses one by one", "[syms]") {
+  vector<uint64_t> addrs;
+  for (const char *name : {"getpid", "malloc", "free", "write", "dlsym"})
+    addrs.push_back((uint64_t)dlsym(RTLD_DEFAULT, name) + 1);
+  addrs.push_back((uint64_t)&self_exe);
+  addrs.push_back((uint64_t)&self_exe + 4);
+  addrs.push_back(16);
+
+  ProcSyms syms(getpid());
+  vector<struct bcc_symbol> out(addrs.size());
+  size_t resolved = syms.resolve_batch(addrs.data(), addrs.size(), out.data());
+  size_t expected = 0;
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    struct bcc_symbol sym;
+    bool res = syms.resolve_addr(addrs[i], &sym);
+    expected += res;
+    REQUIRE((out[i].name != nullptr) == res);
+    if (res) {
+      REQUIRE(string(sym.name) == out[i].name);
+      REQUIRE(string(sym.module) == out[i].module);
+      REQUIRE(sym.offset == out[i].offset);
+    }
+  }
+  REQUIRE(resolved == expected);
+  REQUIRE(resolved == addrs.size() - 1);
+}
+
+static __attribute__((noinline)) uint64_t current_pc() {
+  asm volatile("" ::: "memory");
+  return (uint64_t)__builtin_return_address(0);
+}
+
+static inline __attribute__((always_inline)) uint64_t
+inlined_source_fn(int *line) {
+  uint64_t pc = current_pc();
+  *line = __LINE__ - 1;
+  return pc;
+}
+
+static __attribute__((noinline)) uint64_t outer_source_fn(int *inner_line,
+                                                          int *outer_line) {
+  uint64_t pc = inlined_source_fn(inner_line);
+  *outer_line = __LINE__ - 1;
+  return pc;
+}
+
+TEST_CASE("addresses resolve to source lines through inlined calls", "[syms]") {
+  int inner_line, outer_line;
+  // within the call instruction, the return address is past it
+  uint64_t pc = outer_source_fn(&inner_line, &outer_line) - 1;
+
+  void *resolver = bcc_symcache_new(getpid());
+  REQUIRE(resolver);
+  struct bcc_source_frame frames[8];
+  int n = bcc_symcache_resolve_source(resolver, pc, frames, 8);
+  REQUIRE(n == 2);
+  REQUIRE(string(frames[0].function).find("inlined_source_fn") != string::npos);
+  REQUIRE(string(frames[0].file).find("test_syms.cc") != string::npos);
+  REQUIRE(frames[0].line == inner_line);
+  REQUIRE(string(frames[1].function).find("outer_source_fn") != string::npos);
+  REQUIRE(string(frames[1].file).find("test_syms.cc") != string::npos);
+  REQUIRE(frames[1].line == outer_line);
+  bcc_free_symcache(resolver, getpid());
+}
+
+// An inlined call whose origin is a DW_FORM_GNU_ref_alt into the alternate
+// file of dwz, at the same offset as a subprogram of this file.
+static const char alt_ref_asm[] =
+    "  .section .debug_abbrev,\"\",%progbits\n"
+    "  .uleb128 1\n  .uleb128 0x11\n  .byte 1\n"  // compile_unit
+    "  .uleb128 0x03\n  .uleb128 0x08\n  .byte 0, 0\n"
+    "  .uleb128 2\n  .uleb128 0x2e\n  .byte 0\n"  // subprogram
+    "  .uleb128 0x03\n  .uleb128 0x08\n"
+    "  .uleb128 0x11\n  .uleb128 0x01\n  .uleb128 0x12\n  .uleb128 0x07\n"
+    "  .byte 0, 0\n"
+    "  .uleb128 3\n  .uleb128 0x2e\n  .byte 1\n"  // subprogram, children
+    "  .uleb128 0x03\n  .uleb128 0x08\n"
+    "  .uleb128 0x11\n  .uleb128 0x01\n  .uleb128 0x12\n  .uleb128 0x07\n"
+    "  .byte 0, 0\n"
+    "  .uleb128 4\n  .uleb128 0x1d\n  .byte 0\n"  // inlined_subroutine
+    "  .uleb128 0x31\n  .uleb128 0x1f20\n"
+    "  .uleb128 0x11\n  .uleb128 0x01\n  .uleb128 0x12\n  .uleb128 0x07\n"
+    "  .byte 0, 0\n"
+    "  .byte 0\n"
+    "  .section .debug_info,\"\",%progbits\n"
+    ".Linfo:\n"
+    "  .long .Lend - .Lstart\n"
+    ".Lstart:\n"
+    "  .short 4\n  .long 0\n  .byte 8\n"
+    "  .uleb128 1\n  .asciz \"alt.c\"\n"
+    ".Llocal:\n"
+    "  .uleb128 2\n  .asciz \"local_fn\"\n  .quad 0x1000, 0x10\n"
+    "  .uleb128 3\n  .asciz \"outer_fn\"\n  .quad 0x2000, 0x100\n"
+    "  .uleb128 4\n  .long .Llocal - .Linfo\n  .quad 0x2010, 0x10\n"
+    "  .byte 0\n"
+    "  .byte 0\n"
+    ".Lend:\n"
+    "  .section .debug_line,\"\",%progbits\n"
+    "  .byte 0\n";
+
+TEST_CASE("inlined calls named in a dwz alternate file are unknown", "[syms]") {
+  char dir[] = "/tmp/bcc_altref_XXXXXX";
+  REQUIRE(mkdtemp(dir));
+  string src = string(dir) + "/alt.s", obj = string(dir) + "/alt.o";
+  FILE *f = fopen(src.c_str(), "w");
+  REQUIRE(f);
+  fputs(alt_ref_asm, f);
+  fclose(f);
+  REQUIRE(system(tfm::format("as -o %s %s", obj, src).c_str()) == 0);
+
+  std::unique_ptr<LineTable> table = LineTable::load(obj);
+  REQUIRE(table);
+  vector<LineTable::Frame> frames;
+  REQUIRE(table->lookup(0x2018, &frames) == 2);
+  REQUIRE(string("[unknown]") == frames[0].function);
+  REQUIRE(frames[1].function == nullptr);
+
+  system(tfm::format("rm -rf %s", dir).c_str());
+}
+
+TEST_CASE("symbol tables round trip through index files", "[syms]") {
+  char dir[] = "/tmp/bcc_symindex_XXXXXX";
+  REQUIRE(mkdtemp(dir));
+  string path = string(dir) + "/test.syms";
+
+  for (uint64_t high : {0x7f0000005000ull, 0xffffffff81000000ull}) {
+    SymbolTable table, mapped;
+    table.add("_ZN4ebpf9BPFModule4loadEv", 0x7f0000001000, 0x10, 2);
+    table.add("other", high, 0x20, 1);
+    table.finalize();
+    REQUIRE(table.save_index(path));
+    REQUIRE(mapped.load_index(path));
+    REQUIRE(mapped.count() == 2);
+    REQUIRE(mapped.start(1) == high);
+    REQUIRE(mapped.size(0) == 0x10);
+    REQUIRE(mapped.flags(0) == 2);
+    REQUIRE(mapped.find_name("other") == 1);
+    REQUIRE(string("ebpf::BPFModule::load()") == mapped.demangled(0));
+  }
+
+  // index files others can write to are not trusted
+  SymbolTable shared;
+  REQUIRE(chmod(path.c_str(), 0666) == 0);
+  REQUIRE(!shared.load_index(path));
+  REQUIRE(chmod(path.c_str(), 0600) == 0);
+  REQUIRE(shared.load_index(path));
+
+  FILE *f = fopen(path.c_str(), "r+");
+  REQUIRE(f);
+  fputs("garbage", f);
+  fclose(f);
+  SymbolTable corrupt;
+  REQUIRE(!corrupt.load_index(path));
+  unlink(path.c_str());
+
+  SECTION("ELF tables are saved by build-id") {
+    const char *libc = bcc_procutils_which_so("c");
+    char buildid[128];
+    REQUIRE(libc);
+    if (bcc_elf_get_buildid(libc, buildid, sizeof(buildid)) == 0) {
+      SymbolTableCache *cache = SymbolTableCache::instance();
+      cache->set_index_dir(dir);
+      cache->set_capacity(0);
+      auto parsed = cache->get(libc);
+      size_t count = parsed->count();
+      string middle = parsed->name(count / 2);
+      parsed.reset();
+      auto mapped = cache->get(libc);
+      REQUIRE(mapped->count() == count);
+      REQUIRE(middle == mapped->name(count / 2));
+      cache->set_capacity(1024);
+      cache->set_index_dir("");
+    }
+  }
+
+  SECTION("directories others can write to are not used") {
+    SymbolTableCache *cache = SymbolTableCache::instance();
+    cache->set_index_dir(dir);
+    REQUIRE(!cache->index_path("test.syms").empty());
+    REQUIRE(chmod(dir, 0777) == 0);
+    REQUIRE(cache->index_path("test.syms").empty());
+    REQUIRE(chmod(dir, 0700) == 0);
+    cache->set_index_dir("");
+  }
+
+  system(tfm::format("rm -rf %s", dir).c_str());
+}
+
+static void count_kallsym(const char *name, uint64_t addr, char type,
+                          const char *module, void *payload) {
+  auto *counts = static_cast<pair<size_t, size_t> *>(payload);
+  if (module)
+    ++counts->second;
+  else if (string(name) == "_stext")
+    ++counts->first;
+}
+
+TEST_CASE("kernel symbols are resolved with their module", "[syms]") {
+  if (geteuid() != 0)
+    return;
+
+  pair<size_t, size_t> counts;
+  REQUIRE(bcc_procutils_each_kallsym(count_kallsym, &counts) == 0);
+  REQUIRE(counts.first == 1);
+
+  void *resolver = bcc_symcache_new(-1);
+  uint64_t addr;
+  struct bcc_symbol sym;
+  REQUIRE(bcc_symcache_resolve_name(resolver, "_stext", &addr) == 0);
+  REQUIRE(bcc_symcache_resolve(resolver, addr, &sym) == 0);
+  REQUIRE(string("[kernel]") == sym.module);
+  REQUIRE(sym.offset == 0);
+  bcc_free_symcache(resolver, -1);
+}
+
+static void find_bpf_kallsym(const char *name, uint64_t addr, char type,
+                             const char *module, void *payload) {
+  auto *found = static_cast<pair<string, uint64_t> *>(payload);
+  if (module && string(module) == "bpf" && found->first.empty())
+    *found = make_pair(string(name), addr);
+}
+
+TEST_CASE("bpf program symbols are read past the module index", "[syms]") {
+  if (geteuid() != 0)
+    return;
+
+  // [bpf] symbols change while /proc/modules does not
+  pair<string, uint64_t> found;
+  REQUIRE(bcc_procutils_each_kallsym(find_bpf_kallsym, &found) == 0);
+  if (found.first.empty())
+    return;
+
+  void *resolver = bcc_symcache_new(-1);
+  uint64_t addr;
+  struct bcc_symbol sym;
+  REQUIRE(bcc_symcache_resolve_name(resolver, found.first.c_str(), &addr) == 0);
+  REQUIRE(addr == found.second);
+  REQUIRE(bcc_symcache_resolve(resolver, addr, &sym) == 0);
+  REQUIRE(string("[bpf]") == sym.module);
+  bcc_free_symcache(resolver, -1);
+}
@@ -0,0 +1,126 @@
+#!/usr/bin/env python
+# Copyright (c) 2026 The bcc Authors
+# Licensed under the Apache License, Version 2.0 (the "License")
+
+# User space throughput benchmark for the Python API: events through
+# kprobe_poll with a Python callback, TableBase iteration, and key/leaf
+# formatting. A forked child calls getppid() in a loop to feed a program on
+# the syscalls:sys_enter_getppid tracepoint. tests/cc/bench_userspace.cc
+# measures the same through the C API.
+#
+# usage: bench_userspace.py [seconds] [iterations]
+
+from __future__ import print_function
+from bcc import BPF
+import ctypes as ct
+import os
+import resource
+import signal
+import sys
+import time
+
+text = """
+struct data_t { u64 seq; char pad[56]; };
+BPF_PERF_OUTPUT(events);
+int on_getppid(void *ctx) {
+  struct data_t data = {};
+  data.seq = bpf_ktime_get_ns();
+  events.perf_submit(ctx, &data, sizeof(data));
+  return 0;
+}
+
+struct key_t { u32 pid; u64 ts; char comm[16]; };
+BPF_HASH(keyed, struct key_t, u64);
+BPF_HASH(flat, u64, u64);
+"""
+
+FLAT_ENTRIES = 10000
+
+def cpu_time():
+    usage = resource.getrusage(resource.RUSAGE_SELF)
+    return usage.ru_utime + usage.ru_stime
+
+class Bench(object):
+    def __init__(self, name):
+        self.name = name
+    def __enter__(self):
+        self.wall = time.time()
+        self.cpu = cpu_time()
+        return self
+    def __exit__(self, *args):
+        wall = time.time() - self.wall
+        cpu = cpu_time() - self.cpu
+        print("%-20s %12d %14.0f %12.1f" % (self.name, self.ops, self.ops / wall,
+            cpu * 1e9 / self.ops if self.ops else 0))
+
+def bench_perf(b, seconds):
+    b.attach_tracepoint(tp="syscalls:sys_enter_getppid", fn_name="on_getppid")
+    libc = ct.CDLL("libc.so.6", use_errno=True)
+    parent = os.getpid()
+    child = os.fork()
+    if child == 0:
+        # getppid() changes once the parent is gone, don't outlive it
+        try:
+            while libc.getppid() == parent:
+                pass
+        finally:
+            os._exit(0)
+
+    try:
+        counter = [0]
+        def on_event(cpu, data, size):
+            counter[0] += 1
+        b["events"].open_perf_buffer(on_event)
+        with Bench("perf_poll_py_cb") as bench:
+            end = time.time() + seconds
+            while time.time() < end:
+                b.kprobe_poll(100)
+            bench.ops = counter[0]
+    finally:
+        os.kill(child, signal.SIGKILL)
+        os.waitpid(child, 0)
+
+def bench_iterate(b, iterations):
+    flat = b["flat"]
+    for i in range(0, FLAT_ENTRIES):
+        flat[flat.Key(i)] = flat.Leaf(i)
+    with Bench("table_items") as bench:
+        bench.ops = 0
+        while bench.ops < iterations:
+            bench.ops += len(flat.items())
+    with Bench("table_keys") as bench:
+        bench.ops = 0
+        while bench.ops < iterations:
+            for k in flat.keys():
+                bench.ops += 1
+
+def bench_format(b, iterations):
+    keyed = b["keyed"]
+    key = keyed.Key(1234, 0x123456789, b"bench")
+    with Bench("key_sprintf") as bench:
+        for i in range(0, iterations):
+            key_str = keyed.key_sprintf(key)
+        bench.ops = iterations
+    with Bench("key_scanf") as bench:
+        for i in range(0, iterations):
+            keyed.key_scanf(key_str)
+        bench.ops = iterations
+    leaf_str = keyed.leaf_sprintf(keyed.Leaf(42))
+    with Bench("leaf_scanf") as bench:
+        for i in range(0, iterations):
+            keyed.leaf_scanf(leaf_str)
+        bench.ops = iterations
+
+def main():
+    seconds = float(sys.argv[1]) if len(sys.argv) > 1 else 5
+    iterations = int(sys.argv[2]) if len(sys.argv) > 2 else 100000
+
+    b = BPF(text=text)
+    print("%-20s %12s %14s %12s" % ("BENCH", "OPS", "OPS/S", "CPU-NS/OP"))
+    bench_perf(b, seconds)
+    bench_iterate(b, iterations)
+    bench_format(b, iterations)
+    b.cleanup()
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,60 @@
+#!/usr/bin/env python
+# Copyright (c) 2026 The bcc Authors
+# Licensed under the Apache License, Version 2.0 (the "License")
+
+from bcc import BPF, DEBUG_PROG_STATS
+import os
+import shutil
+import tempfile
+from unittest import main, TestCase
+
+class TestProgStats(TestCase):
+    def setUp(self):
+        self.b = BPF(text="""
+        int do_sync(void *ctx) {
+          if (bpf_get_current_pid_tgid() == 0)
+            return 1;
+          return 0;
+        }
+        int unused(void *ctx) { return 0; }
+        """, debug=DEBUG_PROG_STATS)
+        self.b.attach_kprobe(event="sys_sync", fn_name="do_sync")
+        self.b.load_func("unused", BPF.KPROBE)
+
+    def test_prog_stats(self):
+        for i in range(0, 10):
+            os.system("sync")
+        stats = self.b.prog_stats()
+        run_cnt, run_time_ns = stats["do_sync"]
+        self.assertGreaterEqual(run_cnt, 10)
+        self.assertGreater(run_time_ns, 0)
+        self.assertEqual(stats["unused"][0], 0)
+
+    def test_prog_stats_with_included_functions(self):
+        # functions of included files sort among the others in the module,
+        # but get no stats slot
+        include_dir = tempfile.mkdtemp()
+        try:
+            with open(os.path.join(include_dir, "helpers.h"), "w") as f:
+                f.write("int aaa_included(void *ctx) { return 0; }\n")
+            b = BPF(text="""
+            #include "helpers.h"
+            int do_sync(void *ctx) { return 0; }
+            int unused(void *ctx) { return 0; }
+            """, cflags=["-I" + include_dir], debug=DEBUG_PROG_STATS)
+        finally:
+            shutil.rmtree(include_dir)
+        b.attach_kprobe(event="sys_sync", fn_name="do_sync")
+        b.load_func("unused", BPF.KPROBE)
+        for i in range(0, 10):
+            os.system("sync")
+        stats = b.prog_stats()
+        self.assertGreaterEqual(stats["do_sync"][0], 10)
+        self.assertEqual(stats["unused"][0], 0)
+        b.cleanup()
+
+    def tearDown(self):
+        self.b.cleanup()
+
+if __name__ == "__main__":
+    main()
@@ -21,7 +21,7 @@ def kernel_version_ge(major, minor):
 
 @unittest.skipUnless(kernel_version_ge(4,6), "requires kernel >= 4.6")
 class TestStackid(unittest.TestCase):
-    def test_simple(self):
+    def load(self):
         b = bcc.BPF(text="""
 #include <uapi/linux/ptrace.h>
 struct bpf_map;
@@ -38,7 +38,6 @@ int kprobe__htab_map_lookup_elem(struct pt_regs *ctx, struct bpf_map *map, u64 *
 }
 """)
         stub = b["stub"]
-        stack_traces = b["stack_traces"]
         stack_entries = b["stack_entries"]
         try: x = stub[stub.Key(1)]
         except: pass
@@ -46,9 +45,21 @@ int kprobe__htab_map_lookup_elem(struct pt_regs *ctx, struct bpf_map *map, u64 *
         self.assertIn(k, stack_entries)
         stackid = stack_entries[k]
         self.assertIsNotNone(stackid)
-        stack = stack_traces[stackid].ip
+        return b, stackid
+
+    def test_simple(self):
+        b, stackid = self.load()
+        stack = b["stack_traces"][stackid].ip
         self.assertEqual(b.ksym(stack[0]), "htab_map_lookup_elem")
 
+    def test_clear(self):
+        b, stackid = self.load()
+        stack_traces = b["stack_traces"]
+        key = stack_traces.Key(stackid.value)
+        self.assertIn(key, stack_traces)
+        stack_traces.clear()
+        self.assertNotIn(key, stack_traces)
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,70 @@
+#!/usr/bin/env python
+# Copyright (c) 2026 The bcc Authors
+# Licensed under the Apache License, Version 2.0 (the "License")
+
+from bcc import SymbolCacheLRU
+import os
+import subprocess
+from unittest import main, TestCase
+
+class Clock(object):
+    def __init__(self):
+        self.now = 1000.0
+    def __call__(self):
+        return self.now
+
+class TestSymCache(TestCase):
+    def setUp(self):
+        self.clock = Clock()
+
+    def check(self, caches, pid=None):
+        # the next lookup checks for exited processes and the memory held
+        self.clock.now += caches.CHECK_INTERVAL
+        caches.get(os.getpid() if pid is None else pid)
+
+    def test_exited(self):
+        caches = SymbolCacheLRU(clock=self.clock)
+        p = subprocess.Popen(["sleep", "30"])
+        caches.get(p.pid)
+        p.kill()
+        p.wait()
+        # the last samples of a process resolve after it exited
+        self.clock.now += caches.CHECK_INTERVAL / 2
+        caches.get(p.pid)
+        self.clock.now += caches.CHECK_INTERVAL / 2
+        caches.get(os.getpid())
+        self.assertIn(p.pid, caches)
+        self.check(caches)
+        self.assertNotIn(p.pid, caches)
+
+    def test_exited_before_lookup(self):
+        caches = SymbolCacheLRU(clock=self.clock)
+        p = subprocess.Popen(["true"])
+        p.wait()
+        caches.get(p.pid)
+        self.assertIn(p.pid, caches)
+        self.check(caches)
+        self.assertNotIn(p.pid, caches)
+
+    def test_reused(self):
+        caches = SymbolCacheLRU(clock=self.clock)
+        starts = {1: 100}
+        caches.start_time = starts.get
+        caches.get(1)
+        starts[1] = 200
+        self.check(caches)
+        self.assertNotIn(1, caches)
+
+    def test_memory(self):
+        caches = SymbolCacheLRU(max_bytes=1, clock=self.clock)
+        caches.get(-1)
+        caches.get(1)
+        caches.get(os.getppid())
+        self.check(caches, os.getppid())
+        # the kernel cache and the most recently used one stay
+        self.assertNotIn(1, caches)
+        self.assertIn(-1, caches)
+        self.assertIn(os.getppid(), caches)
+
+if __name__ == "__main__":
+    main()
@@ -247,44 +247,41 @@ missing_stacks = 0
 has_enomem = False
 counts = b.get_table("counts")
 stack_traces = b.get_table("stack_traces")
-for k, v in sorted(counts.items(), key=lambda counts: counts[1].value):
-    # handle get_stackid erorrs
-    if (not args.user_stacks_only and k.kernel_stack_id < 0 and
-            k.kernel_stack_id != -errno.EFAULT) or \
-            (not args.kernel_stacks_only and k.user_stack_id < 0 and
-            k.user_stack_id != -errno.EFAULT):
-        missing_stacks += 1
-        # check for an ENOMEM error
-        if k.kernel_stack_id == -errno.ENOMEM or \
-                k.user_stack_id == -errno.ENOMEM:
-            has_enomem = True
-
-    user_stack = [] if k.user_stack_id < 0 else \
-        stack_traces.walk(k.user_stack_id)
-    kernel_tmp = [] if k.kernel_stack_id < 0 else \
-        stack_traces.walk(k.kernel_stack_id)
-
-    # fix kernel stack
-    kernel_stack = []
-    if k.kernel_stack_id >= 0:
-        for addr in kernel_tmp:
-            kernel_stack.append(addr)
-        # the later IP checking
-        if k.kernel_ip:
-            kernel_stack.insert(0, k.kernel_ip)
-
-    do_delimiter = need_delimiter and kernel_stack
-
-    if args.folded:
-        # print folded stack output
-        user_stack = list(user_stack)
-        kernel_stack = list(kernel_stack)
-        line = [k.name.decode()] + \
-            [b.sym(addr, k.pid) for addr in reversed(user_stack)] + \
-            (do_delimiter and ["-"] or []) + \
-            [aksym(addr) for addr in reversed(kernel_stack)]
-        print("%s %d" % (";".join(line), v.value))
-    else:
+if args.folded:
+    # read, symbolize and fold the stacks in libbcc, each stack and address
+    # once
+    (missing_stacks, out_of_room) = stack_traces.report(counts,
+        annotate=args.annotations, delimit=need_delimiter)
+    has_enomem = out_of_room > 0
+else:
+    for k, v in sorted(counts.items(), key=lambda counts: counts[1].value):
+        # handle get_stackid erorrs
+        if (not args.user_stacks_only and k.kernel_stack_id < 0 and
+                k.kernel_stack_id != -errno.EFAULT) or \
+                (not args.kernel_stacks_only and k.user_stack_id < 0 and
+                k.user_stack_id != -errno.EFAULT):
+            missing_stacks += 1
+            # check for an ENOMEM error
+            if k.kernel_stack_id == -errno.ENOMEM or \
+                    k.user_stack_id == -errno.ENOMEM:
+                has_enomem = True
+
+        user_stack = [] if k.user_stack_id < 0 else \
+            stack_traces.walk(k.user_stack_id)
+        kernel_tmp = [] if k.kernel_stack_id < 0 else \
+            stack_traces.walk(k.kernel_stack_id)
+
+        # fix kernel stack
+        kernel_stack = []
+        if k.kernel_stack_id >= 0:
+            for addr in kernel_tmp:
+                kernel_stack.append(addr)
+            # the later IP checking
+            if k.kernel_ip:
+                kernel_stack.insert(0, k.kernel_ip)
+
+        do_delimiter = need_delimiter and kernel_stack
+
         # print default multi-line stack output.
         for addr in kernel_stack:
             print("    %016x %s" % (addr, aksym(addr)))
@@ -276,6 +276,8 @@ class Tool(object):
                     print(self._comm_for_pid(k.pid))
                 print("    %d\n" % v.value)
             counts.clear()
+            # keep room for the stacks of the next interval
+            stack_traces.reclaim(counts)
 
             if exiting:
                 print("Detaching...")